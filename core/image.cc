@@ -65,8 +65,9 @@ Image::Image(Image&& other):
    refcount_(other.refcount_),
    marginx_(other.marginx_), marginy_(other.marginy_)
 {
-   // we have a new reference
-   (*refcount_)++;
+   // we have a new reference, views of external data are not counted
+   if(refcount_ != nullptr)
+      (*refcount_)++;
 }
 
 Image::~Image()
@@ -119,10 +120,19 @@ void Image::dealloc()
 
 void Image::resize(int rows, int cols, int szPix)
 {
-   // decrease ref counter
-   (*refcount_)--;
-   if(*refcount_ == 0)
-      dealloc();
+   // keep the buffer if nobody else references it and the size matches
+   if(refcount_ != nullptr && *refcount_ == 1 && rows*cols*szPix == szBits()) {
+      rows_ = rows;
+      cols_ = cols;
+      szPixel_ = szPix;
+      return;
+   }
+   // decrease ref counter, a view just lets go of the external data
+   if(refcount_ != nullptr) {
+      (*refcount_)--;
+      if(*refcount_ == 0)
+         dealloc();
+   }
    // alloc new data
    rows_ = rows;
    cols_ = cols;
@@ -133,6 +143,22 @@ void Image::resize(int rows, int cols, int szPix)
 }
 
 
+// makes the image a view of external data which it neither owns nor frees
+void Image::attach(uint8_t* data, int rows, int cols, int szPix)
+{
+   if(refcount_ != nullptr) {
+      (*refcount_)--;
+      if(*refcount_ == 0)
+         dealloc();
+   }
+   rows_ = rows;
+   cols_ = cols;
+   szPixel_ = szPix;
+   data_ = data;
+   refcount_ = nullptr;
+}
+
+
 ////////////////////////////////////////
 // createPixel
 
@@ -361,6 +387,21 @@ int ImageSet::szBits()  const{
   assert(sz==gx_.szBits());
   return sz;
 }
+int ImageSet::levels()  const{
+  return 1+octaves_.size();
+}
+const Image& ImageSet::smooth(int level)  const{
+  assert(level>=0 && level<levels());
+  return level==0 ? smooth_ : octaves_[level-1].smooth_;
+}
+const Image& ImageSet::gx(int level)  const{
+  assert(level>=0 && level<levels());
+  return level==0 ? gx_ : octaves_[level-1].gx_;
+}
+const Image& ImageSet::gy(int level)  const{
+  assert(level>=0 && level<levels());
+  return level==0 ? gy_ : octaves_[level-1].gy_;
+}
 
 
 //////////////////////////////////////////////////////////////////
@@ -411,85 +452,175 @@ std::vector<double> computeGaussDerivativeKernel(
 }
 	
 
-template <class SrcPixel>
-void convolveImageHorizontal(
-  const core::Image& src,
-  const std::vector<double>& kernel,
-  core::Image& dst)
+// kernel of two correlations applied one after the other
+std::vector<float> composeKernels(
+  const std::vector<double>& k1,
+  const std::vector<double>& k2)
 {
-  assert(src.szPixel_==sizeof(SrcPixel));
-  assert(dst.szPixel_==4);
-
-  int rows=src.rows_;
-  int cols=src.cols_;
-  assert(cols == dst.cols_);
-  assert(rows == dst.rows_);
-  int marginadd = kernel.size() / 2;
-  assert(kernel.size() == 2*marginadd+1);
-  dst.marginx_ = src.marginx_ + marginadd;
-  dst.marginy_ = src.marginy_;
-
-  int srcStride=-kernel.size()+1;
-  for (int j=dst.marginy_; j<rows-dst.marginy_; ++j){
-    SrcPixel const* psrc = src.pcbits<SrcPixel>() + j*cols + src.marginx_;
-    float*   pdst = dst.pbits<float>() + j*cols + dst.marginx_;
-    for (int i = dst.marginx_; i<cols-dst.marginx_; ++i){
-      double sum = 0.0;
-      for (int k = 0; k<kernel.size(); ++k){
-        sum += *psrc++ * kernel[k];
-      }
-      *pdst++ = sum;
-      psrc += srcStride;
+  std::vector<double> kernel(k1.size()+k2.size()-1, 0.0);
+  for (size_t i=0; i<k1.size(); ++i){
+    for (size_t j=0; j<k2.size(); ++j){
+      kernel[i+j] += k1[i]*k2[j];
+    }
+  }
+  return std::vector<float>(kernel.begin(), kernel.end());
+}
+
+// dst[x] = sum_t k[t] * src[x-hw+t] for x in [x0,x1), contiguous in x so it vectorizes
+void correlateRow(
+  const float* src,
+  const std::vector<float>& kernel,
+  int x0, int x1,
+  float* dst)
+{
+  const int hw=kernel.size()/2;
+  std::fill(dst+x0, dst+x1, 0.0f);
+  for (size_t t=0; t<kernel.size(); ++t){
+    const float kt=kernel[t];
+    const float* psrc=src + x0-hw+t;
+    float* pdst=dst + x0;
+    for (int i=0; i<x1-x0; ++i){
+      pdst[i] += kt*psrc[i];
     }
   }
 }
 
+// dst[x] = sum_t k[t] * rows[t][x] for x in [x0,x1)
+void correlateColumns(
+  const float* const* rows,
+  const std::vector<float>& kernel,
+  int x0, int x1,
+  float* dst)
+{
+  std::fill(dst+x0, dst+x1, 0.0f);
+  for (size_t t=0; t<kernel.size(); ++t){
+    const float kt=kernel[t];
+    const float* psrc=rows[t] + x0;
+    float* pdst=dst + x0;
+    for (int i=0; i<x1-x0; ++i){
+      pdst[i] += kt*psrc[i];
+    }
+  }
+}
+
+// zeroes the margins of one row, or the whole row if it lies in the vertical margin
+void clearBorders(
+  core::Image& img, int row)
+{
+  float* p=img.pbits<float>() + row*img.cols_;
+  if (row<img.marginy_ || row>=img.rows_-img.marginy_){
+    std::fill(p, p+img.cols_, 0.0f);
+  } else{
+    std::fill(p, p+img.marginx_, 0.0f);
+    std::fill(p+img.cols_-img.marginx_, p+img.cols_, 0.0f);
+  }
+}
+
+// Computes smooth = Gs_y Gs_x src, gx = G_y D_x smooth and gy = D_y G_x smooth
+// in a single horizontal and a single vertical sweep: the smoothing is folded
+// into the gradient kernels, kgx = D*Gs and kgy = G*Gs. The image is processed
+// in strips of rows in parallel, each strip keeps only the last rows of the
+// horizontal results in a ring buffer.
 template <class SrcPixel>
-void convolveImageVertical(
+void filterImageSet(
   const core::Image& src,
-  const std::vector<double>& kernel,
-  core::Image& dst)
+  const std::vector<float>& ks,  /* smoothing */
+  const std::vector<float>& kg,  /* gradient smoothing composed with ks */
+  const std::vector<float>& kd,  /* gradient derivative composed with ks */
+  core::Image& smooth,
+  core::Image& gx,
+  core::Image& gy)
 {
   assert(src.szPixel_==sizeof(SrcPixel));
-  assert(dst.szPixel_==4);
-
-  int rows=src.rows_;
-  int cols=src.cols_;
-  assert(cols == dst.cols_);
-  assert(rows == dst.rows_);
-  int marginadd = kernel.size() / 2;
-  assert(kernel.size() == 2*marginadd+1);
-  dst.marginx_ = src.marginx_;
-  dst.marginy_ = src.marginy_ + marginadd;
-
-  int srcStride=-kernel.size()*cols+1;
-  for (int j=dst.marginy_; j<rows-dst.marginy_; ++j){
-    SrcPixel const* psrc = src.pcbits<SrcPixel>() + (j-marginadd)*cols + dst.marginx_;
-    float*   pdst = dst.pbits<float>() + j*cols + dst.marginx_;
-    for (int i = dst.marginx_; i<cols-dst.marginx_; ++i){
-      double sum = 0.0;
-      for (int k = 0; k<kernel.size(); ++k){
-        sum += *psrc * kernel[k];
-        // skip to next row
-        psrc += cols;
+  assert(kg.size()==kd.size() && kg.size()>=ks.size());
+  const int rows=src.rows_;
+  const int cols=src.cols_;
+  const int hs=ks.size()/2;
+  const int hg=kg.size()/2;
+  smooth.marginx_ = src.marginx_ + hs;
+  smooth.marginy_ = src.marginy_ + hs;
+  gx.marginx_ = gy.marginx_ = src.marginx_ + hg;
+  gx.marginy_ = gy.marginy_ = src.marginy_ + hg;
+
+  const int ringRows=kg.size();
+  const int stripRows=32;
+  #pragma omp parallel
+  {
+    std::vector<float> line(cols);
+    std::vector<float> ringS(ringRows*cols), ringX(ringRows*cols), ringY(ringRows*cols);
+    std::vector<const float*> taps(ringRows);
+
+    #pragma omp for schedule(static)
+    for (int j0=0; j0<rows; j0+=stripRows){
+      const int j1=std::min(rows, j0+stripRows);
+      for (int j=j0; j<j1; ++j){
+        clearBorders(smooth, j);
+        clearBorders(gx, j);
+        clearBorders(gy, j);
+      }
+
+      // horizontal sweep over the input rows the strip depends on,
+      // each new row completes one smooth and one gradient output row
+      const int r0=std::max(src.marginy_, j0-hg);
+      const int r1=std::min(rows-src.marginy_, j1+hg);
+      for (int r=r0; r<r1; ++r){
+        SrcPixel const* psrc=src.pcbits<SrcPixel>() + r*cols;
+        for (int i=src.marginx_; i<cols-src.marginx_; ++i){
+          line[i]=psrc[i];
+        }
+        const int slot=(r%ringRows)*cols;
+        correlateRow(&line[0], ks, smooth.marginx_, cols-smooth.marginx_, &ringS[slot]);
+        correlateRow(&line[0], kd, gx.marginx_, cols-gx.marginx_, &ringX[slot]);
+        correlateRow(&line[0], kg, gy.marginx_, cols-gy.marginx_, &ringY[slot]);
+
+        const int js=r-hs;
+        if (js>=j0 && js<j1 && js>=smooth.marginy_ && js<rows-smooth.marginy_){
+          for (int t=0; t<2*hs+1; ++t){
+            taps[t]=&ringS[((js-hs+t)%ringRows)*cols];
+          }
+          correlateColumns(&taps[0], ks, smooth.marginx_, cols-smooth.marginx_,
+                           smooth.pbits<float>() + js*cols);
+        }
+        const int jg=r-hg;
+        if (jg>=j0 && jg<j1 && jg>=gx.marginy_ && jg<rows-gx.marginy_){
+          for (int t=0; t<2*hg+1; ++t){
+            taps[t]=&ringX[((jg-hg+t)%ringRows)*cols];
+          }
+          correlateColumns(&taps[0], kg, gx.marginx_, cols-gx.marginx_,
+                           gx.pbits<float>() + jg*cols);
+          for (int t=0; t<2*hg+1; ++t){
+            taps[t]=&ringY[((jg-hg+t)%ringRows)*cols];
+          }
+          correlateColumns(&taps[0], kd, gy.marginx_, cols-gy.marginx_,
+                           gy.pbits<float>() + jg*cols);
+        }
       }
-      *pdst++ = sum;
-      psrc += srcStride;
     }
   }
 }
 
-
-template <class SrcPixel>
-void convolveSeparate(
+// 2x2 box decimation, the pixel centers map as x_half = (x - 0.5) / 2
+void halfsample(
   const core::Image& src,
-  const std::vector<double>& kernelx,
-  const std::vector<double>& kernely,
   core::Image& dst)
 {
-  core::Image tmp(src.rows_, src.cols_, 4);
-  convolveImageHorizontal<SrcPixel>(src, kernelx, tmp);
-  convolveImageVertical<float>(tmp, kernely, dst);
+  assert(src.szPixel_==4);
+  int rows=src.rows_/2;
+  int cols=src.cols_/2;
+  dst.resize(rows, cols, 4);
+  dst.marginx_ = (src.marginx_+1)/2;
+  dst.marginy_ = (src.marginy_+1)/2;
+
+  for (int j=0; j<rows; ++j){
+    float const* psrc0 = src.pcbits<float>() + 2*j*src.cols_;
+    float const* psrc1 = psrc0 + src.cols_;
+    float* pdst = dst.pbits<float>() + j*cols;
+    for (int i=0; i<cols; ++i){
+      *pdst++ = 0.25f * (psrc0[0] + psrc0[1] + psrc1[0] + psrc1[1]);
+      psrc0 += 2;
+      psrc1 += 2;
+    }
+  }
 }
 
 
@@ -502,28 +633,42 @@ ImageSetExact& ImageSetExact::operator=(ImageSetExact& other)
   this->gy_ = other.gy_;
   this->kernelSmooth_ = other.kernelSmooth_;
   this->kernelGrad_ = other.kernelGrad_;
+  this->octaves_ = other.octaves_;
+  this->numLevels_ = other.numLevels_;
   return *this;
 }
 
 void ImageSetExact::compute(const Image& src){
-  smooth_.resize(src.rows_, src.cols_, 4);
+  computeLevel(src, smooth_, gx_, gy_);
+
+  // each octave is built from the decimated smooth image of the level below
+  octaves_.resize(std::max(0, numLevels_-1));
+  const Image* prev=&smooth_;
+  for (auto& octave: octaves_){
+    halfsample(*prev, octave.half_);
+    computeLevel(octave.half_, octave.smooth_, octave.gx_, octave.gy_);
+    prev=&octave.smooth_;
+  }
+}
+
+void ImageSetExact::computeLevel(
+  const Image& src, Image& smooth, Image& gx, Image& gy)
+{
+  smooth.resize(src.rows_, src.cols_, 4);
+  gx.resize(src.rows_, src.cols_, 4);
+  gy.resize(src.rows_, src.cols_, 4);
+
   std::vector<double> kg  = computeGaussKernel(sigmaSmoothing_, kSigma_);
+  std::vector<double> kgd = computeGaussDerivativeKernel(sigmaGradient_, kSigma_);
+  std::vector<double> kg2 = computeGaussKernel(sigmaGradient_, kSigma_);
+  std::vector<float> ks(kg.begin(), kg.end());
+  std::vector<float> kgrad = composeKernels(kg2, kg);
+  std::vector<float> kderiv = composeKernels(kgd, kg);
   if (src.szPixel_==1){
-    convolveSeparate<uint8_t>(src, kg,kg, smooth_);
+    filterImageSet<uint8_t>(src, ks, kgrad, kderiv, smooth, gx, gy);
   } else{
-    convolveSeparate<float>(src, kg,kg, smooth_);
+    filterImageSet<float>(src, ks, kgrad, kderiv, smooth, gx, gy);
   }
-
-  gx_.resize(src.rows_, src.cols_, 4);
-  gy_.resize(src.rows_, src.cols_, 4);
-  std::vector<double> kgd = computeGaussDerivativeKernel(sigmaGradient_, kSigma_);
-  std::vector<double> kg2  = computeGaussKernel(sigmaGradient_, kSigma_);
-  convolveSeparate<float>(smooth_, kgd, kg2, gx_);
-  convolveSeparate<float>(smooth_, kg2, kgd, gy_);
-
-  fillBorders(smooth_, float(0));
-  fillBorders(gx_, float(0));
-  fillBorders(gy_, float(0));
 }
 
 
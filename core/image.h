@@ -22,6 +22,7 @@ public:
 
    Image& operator=(Image other);
    void resize(int rows, int cols, int szPix=1);
+   void attach(uint8_t* data, int rows, int cols, int szPix=1);
    void dealloc();
 
    uint8_t& operator()(int row, int col);
@@ -61,16 +62,31 @@ public:
 };
 
 
+// one coarser octave of an image set
+struct ImageOctave {
+   Image smooth_;
+   Image gx_;
+   Image gy_;
+   Image half_; // decimated level below, kept to reuse the buffer
+};
+
 class ImageSet {
 public:
    Image smooth_;
    Image gx_;
    Image gy_;
+   // pyramid levels above the base, octaves_[l-1] holds level l
+   // at half the resolution of level l-1
+   std::vector<ImageOctave> octaves_;
 public:
    int rows() const;
    int cols() const;
    int szPixel() const;
    int szBits() const;
+   int levels() const;
+   const Image& smooth(int level) const;
+   const Image& gx(int level) const;
+   const Image& gy(int level) const;
 public:
   virtual void compute(const Image& src) =0;
   virtual void config(const std::string& conf) =0;
@@ -82,6 +98,7 @@ public:
   const double sigmaSmoothing_=0.7;
   const double sigmaGradient_=0.7;
   const double kSigma_=3;
+  int numLevels_=1;       // pyramid levels built by compute, 1 - base only
 public:
   std::vector<double> kernelSmooth_;
   std::vector<double> kernelGrad_;
@@ -90,6 +107,8 @@ public:
   virtual void config(const std::string& conf);
   
   ImageSetExact& operator=(ImageSetExact& other);
+private:
+  void computeLevel(const Image& src, Image& smooth, Image& gx, Image& gy);
 };
 
 Image equalize(const Image& src, double mymin=-1, double mymax=-1);
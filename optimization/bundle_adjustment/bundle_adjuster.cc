@@ -10,8 +10,8 @@ BundleAdjuster::BundleAdjuster(int number_of_frames, int max_features, std::stri
                                std::vector<double> loss_params, bool use_weighting) :
       max_features_(max_features), loss_type_(loss_type), loss_params_(loss_params),
       use_weighting_(use_weighting) {
-  if (number_of_frames > 6) {
-    std::cout << "Error: to much frames for BA!\n";
+  if (number_of_frames < 2) {
+    std::cout << "Error: BA needs at least two frames!\n";
     throw 1;
   }
   frame_cnt_ = 0;
@@ -33,35 +33,33 @@ void BundleAdjuster::UpdateTracks(const track::StereoTrackerBase& tracker,
   for (auto& elem : tracks_)
     elem.second.dist_from_cframe++;
 
-  for (int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo feat_left = tracker.featureLeft(i);
-    track::FeatureInfo feat_right = tracker.featureRight(i);
-    int age = feat_left.age_;
-    if(age > 0) {
-      // if the track is newly added we need to save the previous point also
-      if(age == 1) {
-        TrackData data;
-        data.dist_from_cframe = 0;
-        data.left_tracks.push_back(feat_left.prev_);
-        data.right_tracks.push_back(feat_right.prev_);
-        for (int j = 0; ; j++) {
-          auto key = std::make_tuple(i,j);
-          if (tracks_.find(key) == tracks_.end()) {
-            curr_idx_[i] = j;
-            tracks_[key] = data;
-            break;
-          }
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for (int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    int age = batch.age[i];
+    // if the track is newly added we need to save the previous point also
+    if(age == 1) {
+      TrackData data;
+      data.dist_from_cframe = 0;
+      data.left_tracks.push_back(batch.leftPrev(i));
+      data.right_tracks.push_back(batch.rightPrev(i));
+      for (int j = 0; ; j++) {
+        auto key = std::make_tuple(i,j);
+        if (tracks_.find(key) == tracks_.end()) {
+          curr_idx_[i] = j;
+          tracks_[key] = data;
+          break;
         }
       }
-      // now add the tracked point in current frame
-      auto key = std::make_tuple(i, curr_idx_[i]);
-      //if (tracks_.find(key) == tracks_.end())
-      TrackData& data = tracks_.at(key);
-      // reset the distance counter
-      data.dist_from_cframe = 0;
-      data.left_tracks.push_back(feat_left.curr_);
-      data.right_tracks.push_back(feat_right.curr_);
     }
+    // now add the tracked point in current frame
+    auto key = std::make_tuple(i, curr_idx_[i]);
+    //if (tracks_.find(key) == tracks_.end())
+    TrackData& data = tracks_.at(key);
+    // reset the distance counter
+    data.dist_from_cframe = 0;
+    data.left_tracks.push_back(batch.leftCurr(i));
+    data.right_tracks.push_back(batch.rightCurr(i));
   }
 
   // this doesn't work with unordered_map !!!
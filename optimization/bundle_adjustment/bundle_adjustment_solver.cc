@@ -34,7 +34,12 @@ void BundleAdjustmentSolver::AddCameraMotion(const Eigen::Matrix4d& Rt) {
   //quaternion[1] = q.x();
   //quaternion[2] = q.y();
   //quaternion[3] = q.z();
-  core::MathHelper::MotionMatrixToParams(Rt, quaternion, trans);
+  // chain the motion onto the pose of the previous frame
+  if (translation_.empty())
+    core::MathHelper::MotionMatrixToParams(Rt, quaternion, trans);
+  else
+    core::MathHelper::MotionMatrixToParams(Rt * GetCameraPose(translation_.size() - 1),
+                                           quaternion, trans);
   translation_.push_back(trans);
   rotation_.push_back(quaternion);
 }
@@ -58,58 +63,20 @@ void BundleAdjustmentSolver::AddTrackData(const TrackData& data) {
   Eigen::Vector4d pt3d;
   core::MathHelper::Triangulate(camera_params_, data.left_tracks[start_obs],
                                 data.right_tracks[start_obs], pt3d);
+  // the pose of frame k is at k-1, the first frame of the window has no parameters
+  std::vector<double*> param_blocks;
+  if (start_frame > 0) {
+    param_blocks.push_back(&translation_[start_frame-1][0]);
+    param_blocks.push_back(&rotation_[start_frame-1][0]);
+  }
+  const int num_poses = param_blocks.size() / 2 + 1;
+  param_blocks.resize(2 * num_poses);
   for (int i = 1; i < num_used_obs; i++) {
-    ReprojErrorStereo* reproj_error = new ReprojErrorStereo(pt3d, data.left_tracks[start_obs + i],
-        data.right_tracks[start_obs + i], camera_params_, use_weighting_);
-    switch (i) {
-      case 1: {
-        ceres::CostFunction* cost =
-            new ceres::AutoDiffCostFunction<ReprojErrorStereo,4,3,4>(reproj_error);
-        ceres_problem_.AddResidualBlock(cost, loss_function_,
-                                        &translation_[start_frame][0],
-                                        &rotation_[start_frame][0]);
-        break;
-      }
-      case 2: {
-        ceres::CostFunction* cost =
-            new ceres::AutoDiffCostFunction<ReprojErrorStereo,4,3,4,3,4>(reproj_error);
-        ceres_problem_.AddResidualBlock(cost, loss_function_,
-                                        &translation_[start_frame][0],
-                                        &rotation_[start_frame][0],
-                                        &translation_[start_frame+1][0],
-                                        &rotation_[start_frame+1][0]);
-        break;
-      }
-      case 3: {
-        ceres::CostFunction* cost =
-            new ceres::AutoDiffCostFunction<ReprojErrorStereo,4,3,4,3,4,3,4>(reproj_error);
-        ceres_problem_.AddResidualBlock(cost, loss_function_,
-                                        &translation_[start_frame][0],
-                                        &rotation_[start_frame][0],
-                                        &translation_[start_frame+1][0],
-                                        &rotation_[start_frame+1][0],
-                                        &translation_[start_frame+2][0],
-                                        &rotation_[start_frame+2][0]);
-        break;
-      }
-      case 4: {
-        ceres::CostFunction* cost =
-            new ceres::AutoDiffCostFunction<ReprojErrorStereo,4,3,4,3,4,3,4,3,4>(reproj_error);
-        ceres_problem_.AddResidualBlock(cost, loss_function_,
-                                        &translation_[start_frame][0],
-                                        &rotation_[start_frame][0],
-                                        &translation_[start_frame+1][0],
-                                        &rotation_[start_frame+1][0],
-                                        &translation_[start_frame+2][0],
-                                        &rotation_[start_frame+2][0],
-                                        &translation_[start_frame+3][0],
-                                        &rotation_[start_frame+3][0]);
-        break;
-      }
-      default: {
-        assert(false);
-      }
-    }
+    param_blocks[2*num_poses - 2] = &translation_[start_frame+i-1][0];
+    param_blocks[2*num_poses - 1] = &rotation_[start_frame+i-1][0];
+    ceres::CostFunction* cost = new ReprojErrorStereoAnalytic(pt3d, data.left_tracks[start_obs + i],
+        data.right_tracks[start_obs + i], camera_params_, use_weighting_, num_poses);
+    ceres_problem_.AddResidualBlock(cost, loss_function_, param_blocks);
   }
 }
 
@@ -241,21 +208,30 @@ bool BundleAdjustmentSolver::Solve() {
 
 // get camera extrinsic transform from cam local coord to world coord (1-frame coord)
 Eigen::Matrix4d BundleAdjustmentSolver::GetCameraMotion(int camera_index) const {
+  if (camera_index == 0)
+    return GetCameraPose(0);
+  // relative motion between the absolute poses of the two frames
+  Eigen::Matrix4d prev_inv;
+  core::MathHelper::InverseTransform(GetCameraPose(camera_index - 1), prev_inv);
+  return GetCameraPose(camera_index) * prev_inv;
+}
+
+Eigen::Matrix4d BundleAdjustmentSolver::GetCameraPose(int pose_index) const {
   //Eigen::Matrix3d rmat;
   //ceres::AngleAxisToRotationMatrix(&extr_rot_[ci][0], (const double *)rmat.data());
-  //ceres::AngleAxisToRotationMatrix((const double*) &rotation_[camera_index][0], rmat.data());
+  //ceres::AngleAxisToRotationMatrix((const double*) &rotation_[pose_index][0], rmat.data());
   //ceres::QuaternionToRotation()
   Eigen::Quaterniond q;
-  q.w() = rotation_[camera_index][0];
-  q.x() = rotation_[camera_index][1];
-  q.y() = rotation_[camera_index][2];
-  q.z() = rotation_[camera_index][3];
+  q.w() = rotation_[pose_index][0];
+  q.x() = rotation_[pose_index][1];
+  q.y() = rotation_[pose_index][2];
+  q.z() = rotation_[pose_index][3];
   assert(q.norm() - 1.0 < 1e-10);
   //std::cout << "\nNorm = " << q.norm() << "\n";
 
   Eigen::Matrix4d Rt = Eigen::Matrix4d::Identity();
   for (int i = 0; i < 3; i++)
-    Rt(i,3) = translation_[camera_index][i];
+    Rt(i,3) = translation_[pose_index][i];
   Rt.block<3,3>(0,0) = q.toRotationMatrix();
   return Rt;
 }
@@ -2,12 +2,15 @@
 #define OPTIMIZATION_BUNDLE_ADJUSTMENT_SOLVER_H_
 
 #include <vector>
+#include <cassert>
 #include <cmath>
 #include <array>
+#include <algorithm>
 #include <opencv2/core/core.hpp>
 #include <ceres/ceres.h>
 #include <ceres/rotation.h>
 #include "../../core/types.h"
+#include "stereo_projection.h"
 
 namespace optim {
 
@@ -27,6 +30,7 @@ class BundleAdjustmentSolver
     camera_params_ = camera_params;
   }
 
+  // the motions are added in order, each one from the previous frame to the next
   void AddCameraMotion(const Eigen::Matrix4d& Rt);
   void AddTrackData(const TrackData& data);
   bool Solve();
@@ -34,9 +38,14 @@ class BundleAdjustmentSolver
   Eigen::Matrix4d GetCameraMotion(int camera_index) const;
 
  private:
+  // transform of the points from the first frame of the window to frame pose_index+1
+  Eigen::Matrix4d GetCameraPose(int pose_index) const;
+
   ceres::Problem ceres_problem_;  
   ceres::LossFunction* loss_function_;
   Eigen::VectorXd camera_params_;
+  // absolute poses of the frames after the first one in the window which is fixed, so each
+  // residual depends on at most two of them and the window length is not limited
   std::vector<std::array<double,3>> translation_;
   std::vector<std::array<double,4>> rotation_;
   double *trans_params_, *rot_params_;
@@ -67,6 +76,26 @@ void Transform3DPoint(
   trans_pt3d[2] += cam_trans[2];
 }
 
+// Inverse of Transform3DPoint, the conjugate quaternion rotates by the transposed matrix
+template <typename T>
+void InverseTransform3DPoint(
+  const T* const cam_trans,
+  const T* const cam_rot,
+  const T* const pt3d,
+  T* trans_pt3d)
+{
+  T pt[3];
+  pt[0] = pt3d[0] - cam_trans[0];
+  pt[1] = pt3d[1] - cam_trans[1];
+  pt[2] = pt3d[2] - cam_trans[2];
+  T rot_conj[4];
+  rot_conj[0] = cam_rot[0];
+  rot_conj[1] = -cam_rot[1];
+  rot_conj[2] = -cam_rot[2];
+  rot_conj[3] = -cam_rot[3];
+  ceres::UnitQuaternionRotatePoint(rot_conj, pt, trans_pt3d);
+}
+
 //template <typename T>
 //void ComputeStereoResiduals(T* pos_proj,
 //                            const Eigen::VectorXd& cam_intr,
@@ -205,87 +234,22 @@ struct ReprojErrorStereo
     return true;
   }
 
+  // the point is triangulated in the frame with pose (cam_trans1, cam_rot1) and observed in
+  // the frame with pose (cam_trans2, cam_rot2), both relative to the first frame of the window
   template <typename T>
   bool operator()(const T* const cam_trans1, const T* const cam_rot1,
                   const T* const cam_trans2, const T* const cam_rot2, T* out_residuals) const
   {
     T pt3d0[3];
-    //WrapPoint3D(&pt3d0[0]);
     WrapPoint3D(pt3d0);
-    T pt3d1[3];
-    Transform3DPoint(cam_trans1, cam_rot1, pt3d0, pt3d1);
+    T pt3d_world[3];
+    InverseTransform3DPoint(cam_trans1, cam_rot1, pt3d0, pt3d_world);
     T pt3d2[3];
-    Transform3DPoint(cam_trans2, cam_rot2, pt3d1, pt3d2);
+    Transform3DPoint(cam_trans2, cam_rot2, pt3d_world, pt3d2);
     ComputeStereoResiduals(pt3d2, cam_intr_, left_pt_, right_pt_, true, weight, out_residuals);
     return true;
   }
 
-  template <typename T>
-  bool operator()(const T* const cam_trans1, const T* const cam_rot1,
-                  const T* const cam_trans2, const T* const cam_rot2,
-                  const T* const cam_trans3, const T* const cam_rot3, T* out_residuals) const
-  {
-    T pt3d0[3];
-    //WrapPoint3D(&pt3d0[0]);
-    WrapPoint3D(pt3d0);
-    T pt3d1[3];
-    Transform3DPoint(cam_trans1, cam_rot1, pt3d0, pt3d1);
-    T pt3d2[3];
-    Transform3DPoint(cam_trans2, cam_rot2, pt3d1, pt3d2);
-    T pt3d3[3];
-    Transform3DPoint(cam_trans3, cam_rot3, pt3d2, pt3d3);
-    ComputeStereoResiduals(pt3d3, cam_intr_, left_pt_, right_pt_, true, weight, out_residuals);
-    return true;
-  }
-
-  template <typename T>
-  bool operator()(const T* const cam_trans1, const T* const cam_rot1,
-                  const T* const cam_trans2, const T* const cam_rot2,
-                  const T* const cam_trans3, const T* const cam_rot3,
-                  const T* const cam_trans4, const T* const cam_rot4,
-                  T* out_residuals) const
-  {
-    T pt3d0[3];
-    //WrapPoint3D(&pt3d0[0]);
-    WrapPoint3D(pt3d0);
-    T pt3d1[3];
-    Transform3DPoint(cam_trans1, cam_rot1, pt3d0, pt3d1);
-    T pt3d2[3];
-    Transform3DPoint(cam_trans2, cam_rot2, pt3d1, pt3d2);
-    T pt3d3[3];
-    Transform3DPoint(cam_trans3, cam_rot3, pt3d2, pt3d3);
-    T pt3d4[3];
-    Transform3DPoint(cam_trans4, cam_rot4, pt3d3, pt3d4);
-    ComputeStereoResiduals(pt3d4, cam_intr_, left_pt_, right_pt_, true, weight, out_residuals);
-    return true;
-  }
-
-  template <typename T>
-  bool operator()(const T* const cam_trans1, const T* const cam_rot1,
-                  const T* const cam_trans2, const T* const cam_rot2,
-                  const T* const cam_trans3, const T* const cam_rot3,
-                  const T* const cam_trans4, const T* const cam_rot4,
-                  const T* const cam_trans5, const T* const cam_rot5,
-                  T* out_residuals) const
-  {
-    T pt3d0[3];
-    //WrapPoint3D(&pt3d0[0]);
-    WrapPoint3D(pt3d0);
-    T pt3d1[3];
-    Transform3DPoint(cam_trans1, cam_rot1, pt3d0, pt3d1);
-    T pt3d2[3];
-    Transform3DPoint(cam_trans2, cam_rot2, pt3d1, pt3d2);
-    T pt3d3[3];
-    Transform3DPoint(cam_trans3, cam_rot3, pt3d2, pt3d3);
-    T pt3d4[3];
-    Transform3DPoint(cam_trans4, cam_rot4, pt3d3, pt3d4);
-    T pt3d5[3];
-    Transform3DPoint(cam_trans5, cam_rot5, pt3d4, pt3d5);
-    ComputeStereoResiduals(pt3d5, cam_intr_, left_pt_, right_pt_, true, weight, out_residuals);
-    return true;
-  }
-
-
   template <typename T>
   void WrapPoint3D(T (&pt3d)[3]) const {
     for (int i = 0; i < 3; i++)
@@ -294,7 +258,7 @@ struct ReprojErrorStereo
 
   double left_pt_[2];                 // The left 2D observation
   double right_pt_[2];                // The right 2D observation
-  double pt3d_[3];                    // The 3D point in world coords (first frame coord system)
+  double pt3d_[3];                    // The 3D point in the coords of its triangulation frame
   // TODO
   //const core::Point& left_pt_;                 // The left 2D observation
   //const core::Point& right_pt_;                // The right 2D observation
@@ -305,6 +269,110 @@ struct ReprojErrorStereo
   int num_motions_;
 };
 
+// ReprojErrorStereo with hand derived Jacobians. The parameter blocks are the (translation,
+// rotation) pose of the observing frame relative to the first frame of the window, preceded by
+// the pose of the frame the point was triangulated in if that is not the first frame
+// (num_poses == 2). A residual never depends on more than two poses whatever the window length.
+class ReprojErrorStereoAnalytic : public ceres::CostFunction
+{
+ public:
+  ReprojErrorStereoAnalytic(const Eigen::Vector4d& pt3d, const core::Point& left_pt,
+                            const core::Point& right_pt, const Eigen::VectorXd& cam_intr,
+                            bool use_weighting, int num_poses) : num_poses_(num_poses)
+  {
+    assert(num_poses == 1 || num_poses == 2);
+    left_pt_[0] = left_pt.x_;
+    left_pt_[1] = left_pt.y_;
+    right_pt_[0] = right_pt.x_;
+    right_pt_[1] = right_pt.y_;
+    for (int i = 0; i < 3; i++)
+      pt3d_[i] = pt3d[i];
+    for (int i = 0; i < 5; i++)
+      cam_intr_[i] = cam_intr[i];
+    // same weights as ReprojErrorStereo, -1 only flips the residual sign
+    if (use_weighting) {
+      double cx = cam_intr[2];
+      weight_ = 1.0 / (std::fabs(left_pt.x_ - cx)/std::fabs(cx) + 0.05);
+    }
+    else {
+      weight_ = -1.0;
+    }
+    set_num_residuals(4);
+    for (int i = 0; i < num_poses; i++) {
+      mutable_parameter_block_sizes()->push_back(3);
+      mutable_parameter_block_sizes()->push_back(4);
+    }
+  }
+
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override
+  {
+    // pt_world = R1^T (pt3d - t1) with the conjugate quaternion, pt_cam = R2 pt_world + t2
+    const double* trans1 = parameters[0];
+    const double* rot1 = parameters[1];
+    const double* trans2 = parameters[2*num_poses_ - 2];
+    const double* rot2 = parameters[2*num_poses_ - 1];
+    double pt_world[3], rot1_conj[4], pt_anchor[3], jac_rot1[12];
+    if (num_poses_ == 2) {
+      for (int i = 0; i < 3; i++)
+        pt_anchor[i] = pt3d_[i] - trans1[i];
+      rot1_conj[0] = rot1[0];
+      for (int i = 1; i < 4; i++)
+        rot1_conj[i] = -rot1[i];
+      RotatePointWithJacobian(rot1_conj, pt_anchor, pt_world,
+                              jacobians != nullptr ? jac_rot1 : nullptr);
+    }
+    else {
+      std::copy(pt3d_, pt3d_ + 3, pt_world);
+    }
+    double pt_cam[3], jac_rot2[12];
+    RotatePointWithJacobian(rot2, pt_world, pt_cam, jacobians != nullptr ? jac_rot2 : nullptr);
+    for (int i = 0; i < 3; i++)
+      pt_cam[i] += trans2[i];
+    if (jacobians == nullptr) {
+      StereoResidualsWithJacobian(pt_cam, cam_intr_, left_pt_, right_pt_, weight_, residuals,
+                                  nullptr);
+      return true;
+    }
+    double jac_pt[12];
+    StereoResidualsWithJacobian(pt_cam, cam_intr_, left_pt_, right_pt_, weight_, residuals, jac_pt);
+    double** jac2 = jacobians + 2*num_poses_ - 2;
+    if (jac2[0] != nullptr)
+      std::copy(jac_pt, jac_pt + 12, jac2[0]);
+    if (jac2[1] != nullptr)
+      MultiplyRowMajor(jac_pt, jac_rot2, 4, 3, 4, jac2[1]);
+    if (num_poses_ == 1 || (jacobians[0] == nullptr && jacobians[1] == nullptr))
+      return true;
+    // derivative wrt pt_world, then through the inverse of the anchor pose
+    double R[9], jac_world[12];
+    QuaternionRotationMatrix(rot2, R);
+    MultiplyRowMajor(jac_pt, R, 4, 3, 3, jac_world);
+    if (jacobians[0] != nullptr) {
+      // d pt_world / d t1 = -R1^T, which is the rotation matrix of the conjugate
+      QuaternionRotationMatrix(rot1_conj, R);
+      MultiplyRowMajor(jac_world, R, 4, 3, 3, jacobians[0]);
+      for (int i = 0; i < 12; i++)
+        jacobians[0][i] = -jacobians[0][i];
+    }
+    if (jacobians[1] != nullptr) {
+      // the conjugate flips the sign of the vector part
+      for (int i = 0; i < 3; i++)
+        for (int j = 1; j < 4; j++)
+          jac_rot1[i*4 + j] = -jac_rot1[i*4 + j];
+      MultiplyRowMajor(jac_world, jac_rot1, 4, 3, 4, jacobians[1]);
+    }
+    return true;
+  }
+
+ private:
+  double left_pt_[2];
+  double right_pt_[2];
+  double pt3d_[3];
+  double cam_intr_[5];
+  double weight_;
+  int num_poses_;
+};
+
 } // end unnamed namespace
 
 } // end namespace optim
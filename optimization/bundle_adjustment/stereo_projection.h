@@ -0,0 +1,83 @@
+#ifndef OPTIMIZATION_BUNDLE_ADJUSTMENT_STEREO_PROJECTION_H_
+#define OPTIMIZATION_BUNDLE_ADJUSTMENT_STEREO_PROJECTION_H_
+
+// Hand derived Jacobians of the stereo reprojection used by the analytic Ceres cost functions.
+// All Jacobians are row-major like the Ceres jacobian blocks.
+
+namespace optim {
+
+// Rotates p with the quaternion q = (w, x, y, z) using the same formula as
+// ceres::UnitQuaternionRotatePoint, jac_q (3x4) is the derivative wrt the 4 quaternion
+// parameters and can be null.
+inline void RotatePointWithJacobian(const double* q, const double* p, double* out, double* jac_q) {
+  const double a = q[0], b = q[1], c = q[2], d = q[3];
+  out[0] = 2.0 * ((-c*c - d*d) * p[0] + (b*c - a*d) * p[1] + (a*c + b*d) * p[2]) + p[0];
+  out[1] = 2.0 * ((a*d + b*c) * p[0] + (-b*b - d*d) * p[1] + (c*d - a*b) * p[2]) + p[1];
+  out[2] = 2.0 * ((b*d - a*c) * p[0] + (a*b + c*d) * p[1] + (-b*b - c*c) * p[2]) + p[2];
+  if (jac_q == nullptr)
+    return;
+  jac_q[0]  = 2.0 * (-d*p[1] + c*p[2]);
+  jac_q[1]  = 2.0 * (c*p[1] + d*p[2]);
+  jac_q[2]  = 2.0 * (-2.0*c*p[0] + b*p[1] + a*p[2]);
+  jac_q[3]  = 2.0 * (-2.0*d*p[0] - a*p[1] + b*p[2]);
+  jac_q[4]  = 2.0 * (d*p[0] - b*p[2]);
+  jac_q[5]  = 2.0 * (c*p[0] - 2.0*b*p[1] - a*p[2]);
+  jac_q[6]  = 2.0 * (b*p[0] + d*p[2]);
+  jac_q[7]  = 2.0 * (a*p[0] - 2.0*d*p[1] + c*p[2]);
+  jac_q[8]  = 2.0 * (-c*p[0] + b*p[1]);
+  jac_q[9]  = 2.0 * (d*p[0] + a*p[1] - 2.0*b*p[2]);
+  jac_q[10] = 2.0 * (-a*p[0] + d*p[1] - 2.0*c*p[2]);
+  jac_q[11] = 2.0 * (b*p[0] + c*p[1]);
+}
+
+// The 3x3 matrix of the rotation above, which is also its derivative wrt the point.
+inline void QuaternionRotationMatrix(const double* q, double* R) {
+  const double a = q[0], b = q[1], c = q[2], d = q[3];
+  R[0] = 1.0 + 2.0 * (-c*c - d*d); R[1] = 2.0 * (b*c - a*d);       R[2] = 2.0 * (a*c + b*d);
+  R[3] = 2.0 * (a*d + b*c);       R[4] = 1.0 + 2.0 * (-b*b - d*d); R[5] = 2.0 * (c*d - a*b);
+  R[6] = 2.0 * (b*d - a*c);       R[7] = 2.0 * (a*b + c*d);       R[8] = 1.0 + 2.0 * (-b*b - c*c);
+}
+
+// Residuals weight * (projection - observation) of the point X in the left camera frame for
+// (left u, left v, right u, right v), cam_intr = (fx, fy, cx, cy, b) with fx used for both
+// axes. jac_X (4x3) is the weighted derivative wrt X and can be null.
+inline void StereoResidualsWithJacobian(const double* X, const double* cam_intr,
+                                        const double* left_obs, const double* right_obs,
+                                        double weight, double* residuals, double* jac_X) {
+  const double f = cam_intr[0];
+  const double cx = cam_intr[2];
+  const double cy = cam_intr[3];
+  const double b = cam_intr[4];
+  const double iz = 1.0 / X[2];
+  const double xl = X[0] * iz;
+  const double xr = (X[0] - b) * iz;
+  const double y = X[1] * iz;
+  residuals[0] = weight * (f * xl + cx - left_obs[0]);
+  residuals[1] = weight * (f * y + cy - left_obs[1]);
+  residuals[2] = weight * (f * xr + cx - right_obs[0]);
+  residuals[3] = weight * (f * y + cy - right_obs[1]);
+  if (jac_X == nullptr)
+    return;
+  const double wf = weight * f * iz;
+  jac_X[0] = wf; jac_X[1] = 0.0; jac_X[2]  = -wf * xl;
+  jac_X[3] = 0.0; jac_X[4] = wf; jac_X[5]  = -wf * y;
+  jac_X[6] = wf; jac_X[7] = 0.0; jac_X[8]  = -wf * xr;
+  jac_X[9] = 0.0; jac_X[10] = wf; jac_X[11] = -wf * y;
+}
+
+// C (rows x cols) = A (rows x inner) * B (inner x cols), all row-major
+inline void MultiplyRowMajor(const double* A, const double* B, int rows, int inner, int cols,
+                             double* C) {
+  for (int i = 0; i < rows; i++) {
+    for (int j = 0; j < cols; j++) {
+      double sum = 0.0;
+      for (int k = 0; k < inner; k++)
+        sum += A[i*inner + k] * B[k*cols + j];
+      C[i*cols + j] = sum;
+    }
+  }
+}
+
+}   // end optim
+
+#endif  // OPTIMIZATION_BUNDLE_ADJUSTMENT_STEREO_PROJECTION_H_
@@ -75,14 +75,14 @@ void DeformationFieldSolver::UpdateTracks(const track::StereoTrackerBase& tracke
   cam_translation_.push_back(trans);
   cam_rotation_.push_back(euler_angles);
 
-  for (int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo feat_left = tracker.featureLeft(i);
-    track::FeatureInfo feat_right = tracker.featureRight(i);
-    age.push_back(feat_left.age_);
-    auto left_track = std::make_tuple(feat_left.prev_, feat_left.curr_);
-    auto right_track = std::make_tuple(feat_right.prev_, feat_right.curr_);
-    pts_left.push_back(left_track);
-    pts_right.push_back(right_track);
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  age.reserve(batch.size);
+  pts_left.reserve(batch.size);
+  pts_right.reserve(batch.size);
+  for (int i = 0; i < batch.size; i++) {
+    age.push_back(batch.age[i]);
+    pts_left.push_back(std::make_tuple(batch.leftPrev(i), batch.leftCurr(i)));
+    pts_right.push_back(std::make_tuple(batch.rightPrev(i), batch.rightCurr(i)));
   }
 
   left_tracks_.push_back(pts_left);
@@ -118,14 +118,14 @@ void DeformationFieldSolver::UpdateReverseTracks(const track::StereoTrackerBase&
   cam_translation_.push_back(trans);
   cam_rotation_.push_back(euler_angles);
 
-  for (int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo feat_left = tracker.featureLeft(i);
-    track::FeatureInfo feat_right = tracker.featureRight(i);
-    age.push_back(feat_left.age_);
-    auto left_track = std::make_tuple(feat_left.curr_, feat_left.prev_);
-    auto right_track = std::make_tuple(feat_right.curr_, feat_right.prev_);
-    pts_left.push_back(left_track);
-    pts_right.push_back(right_track);
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  age.reserve(batch.size);
+  pts_left.reserve(batch.size);
+  pts_right.reserve(batch.size);
+  for (int i = 0; i < batch.size; i++) {
+    age.push_back(batch.age[i]);
+    pts_left.push_back(std::make_tuple(batch.leftCurr(i), batch.leftPrev(i)));
+    pts_right.push_back(std::make_tuple(batch.rightCurr(i), batch.rightPrev(i)));
   }
 
   left_tracks_.push_back(pts_left);
@@ -3,6 +3,8 @@
 
 #include <iostream>
 #include <unordered_map>
+#include <vector>
+#include <type_traits>
 
 #include <opencv2/core/core.hpp>
 
@@ -46,6 +48,13 @@ void compute_ncc_descriptor(const cv::Mat& img, const int cx, const int cy, cons
 void compute_image_ncc_descriptors(const cv::Mat& img, int window_sz,
                                    std::vector<core::DescriptorNCC>& desciptors);
 
+// computes the NCC of the left descriptor against all right image windows on the scanline
+// for disparities 0..max_disp in one pass, costs[d] = -1 for textureless windows
+template<typename T>
+void compute_ncc_scanline(const core::DescriptorNCC& desc_left, const cv::Mat& img_right,
+                          const int cx, const int cy, const int window_sz, const int max_disp,
+                          std::vector<double>& costs);
+
 } // end namespace: StereoCosts
 
 template<typename T>
@@ -117,6 +126,74 @@ void StereoCosts::compute_image_ncc_descriptors(const cv::Mat& img, int window_s
   }
 }
 
+template<typename T>
+inline
+void StereoCosts::compute_ncc_scanline(const core::DescriptorNCC& desc_left, const cv::Mat& img_right,
+                                       const int cx, const int cy, const int window_sz,
+                                       const int max_disp, std::vector<double>& costs)
+{
+  // integer pixels are summed exactly in 32 bits, float pixels in double
+  typedef typename std::conditional<std::is_integral<T>::value, int32_t, double>::type AccType;
+  int margin_sz = (window_sz - 1) / 2;
+  int num_disp = max_disp + 1;
+  // right windows are scanned left to right so the disparity runs backwards: d = max_disp - k
+  int x0 = cx - max_disp;
+  int span = num_disp + window_sz - 1;
+  assert(x0 >= margin_sz && cx < (img_right.cols - margin_sz));
+  assert(cy >= margin_sz && cy < (img_right.rows - margin_sz));
+  assert(desc_left.vec.isContinuous() && desc_left.vec.rows == window_sz * window_sz);
+  costs.assign(num_disp, -1.0);
+  if (desc_left.C < 0.0)
+    return;
+
+  // per thread scratch buffers, the scanline is called from inside the parallel feature loop
+  static thread_local std::vector<AccType> dots, col_sum, col_sqsum;
+  dots.assign(num_disp, 0);
+  col_sum.assign(span, 0);
+  col_sqsum.assign(span, 0);
+  const T* left = desc_left.vec.ptr<T>();
+  AccType* pdots = dots.data();
+  AccType* pcol_sum = col_sum.data();
+  AccType* pcol_sqsum = col_sqsum.data();
+  for (int wy = 0; wy < window_sz; wy++) {
+    const T* row = img_right.ptr<T>(cy - margin_sz + wy) + (x0 - margin_sz);
+    for (int c = 0; c < span; c++) {
+      AccType val = static_cast<AccType>(row[c]);
+      pcol_sum[c] += val;
+      pcol_sqsum[c] += val * val;
+    }
+    // contiguous over all windows so the compiler can vectorize the inner loop
+    for (int wx = 0; wx < window_sz; wx++) {
+      AccType lval = static_cast<AccType>(left[wy*window_sz + wx]);
+      const T* src = row + wx;
+      for (int k = 0; k < num_disp; k++)
+        pdots[k] += lval * static_cast<AccType>(src[k]);
+    }
+  }
+
+  // slide the window sums A and B along the scanline
+  double n = window_sz * window_sz;
+  AccType sum = 0, sqsum = 0;
+  for (int c = 0; c < window_sz - 1; c++) {
+    sum += pcol_sum[c];
+    sqsum += pcol_sqsum[c];
+  }
+  for (int k = 0; k < num_disp; k++) {
+    sum += pcol_sum[k + window_sz - 1];
+    sqsum += pcol_sqsum[k + window_sz - 1];
+    double A = static_cast<double>(sum);
+    double B = static_cast<double>(sqsum);
+    double var = std::sqrt((n * B) - (A * A));
+    // same as get_cost_NCC on the precomputed descriptor
+    if (var > 0.0) {
+      double C = 1.0 / var;
+      costs[max_disp - k] = (n * static_cast<double>(pdots[k]) - (desc_left.A * A)) * desc_left.C * C;
+    }
+    sum -= pcol_sum[k];
+    sqsum -= pcol_sqsum[k];
+  }
+}
+
 template<typename T>
 inline
 uint8_t StereoCosts::hamming_dist(T x, T y)
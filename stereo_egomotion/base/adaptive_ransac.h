@@ -0,0 +1,126 @@
+#ifndef STEREO_EGOMOTION_BASE_ADAPTIVE_RANSAC_H_
+#define STEREO_EGOMOTION_BASE_ADAPTIVE_RANSAC_H_
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "counter_rng.h"
+
+namespace egomotion
+{
+
+// Number of iterations after which at least one all-inlier sample was drawn with the given
+// confidence, for the inlier ratio inliers / points: log(1-p) / log(1-w^m).
+inline int RequiredRansacIterations(int inliers, int points, int sample_size,
+                                    double confidence, int max_iters) {
+  if (points <= 0 || inliers < sample_size || confidence >= 1.0)
+    return max_iters;
+  double w = (double)inliers / points;
+  double outlier_sample = 1.0 - std::pow(w, sample_size);
+  if (outlier_sample <= 0.0)
+    return 1;
+  double iters = std::ceil(std::log(1.0 - confidence) / std::log(outlier_sample));
+  if (!(iters < max_iters))
+    return max_iters;
+  return std::max(1, (int)iters);
+}
+
+// Iterations per thread of one parallel RANSAC round, only sets how much work past the
+// budget can be discarded and not the result.
+const int kRansacRoundPerThread = 8;
+
+// Iteration budget of an adaptive RANSAC loop, which shrinks as soon as a better hypothesis
+// raises the inlier ratio. The parallel estimators evaluate the iterations in rounds and
+// Report() them in iteration order until required() is reached, so the iterations that count
+// and the winner are those of a serial run for any number of threads.
+class AdaptiveRansacCounter {
+ public:
+  AdaptiveRansacCounter(int points, int sample_size, double confidence, int max_iters)
+      : points_(points), sample_size_(sample_size), confidence_(confidence),
+        required_(max_iters), best_inliers_(0), evaluated_(0) {}
+
+  void Report(int inliers) {
+    evaluated_++;
+    if (inliers > best_inliers_) {
+      best_inliers_ = inliers;
+      required_ = RequiredRansacIterations(inliers, points_, sample_size_, confidence_,
+                                           required_);
+    }
+  }
+
+  int evaluated() const { return evaluated_; }
+  int required() const { return required_; }
+  int best_inliers() const { return best_inliers_; }
+
+ private:
+  const int points_;
+  const int sample_size_;
+  const double confidence_;
+  int required_;
+  int best_inliers_;
+  int evaluated_;
+};
+
+// PROSAC sampling (Chum & Matas 2005) over points sorted by decreasing quality. The sample of
+// iteration k is drawn from the top n(k) points and always contains the n(k)-th one, the set
+// grows with the schedule of the paper until all points are used at max_iters, from then on
+// the samples are uniform like in plain RANSAC.
+class ProsacSampler {
+ public:
+  ProsacSampler(int points, int sample_size, int max_iters)
+      : points_(points), sample_size_(sample_size) {
+    // T_n is the expected number of samples from the top n points among max_iters samples,
+    // growth_[n - sample_size] = T'_n the iteration at which the n-th point enters
+    double tn = max_iters;
+    for (int i = 0; i < sample_size; i++)
+      tn *= (double)(sample_size - i) / (points - i);
+    double tn_prime = 1.0;
+    growth_.reserve(std::max(0, points - sample_size + 1));
+    for (int n = sample_size; n <= points; n++) {
+      growth_.push_back(tn_prime);
+      double tn_next = tn * (n + 1) / (n + 1 - sample_size);
+      tn_prime += std::ceil(tn_next - tn);
+      tn = tn_next;
+    }
+  }
+
+  // Writes sample_size distinct positions into the quality order to sample.
+  template<typename Rng>
+  void Sample(int k, Rng& rng, int* sample) const {
+    // smallest n whose T'_n is not below the 1-based iteration number
+    int n = points_;
+    auto it = std::lower_bound(growth_.begin(), growth_.end(), (double)(k + 1));
+    if (it != growth_.end())
+      n = sample_size_ + (int)(it - growth_.begin());
+    int drawn = 0;
+    if (n < points_)
+      sample[drawn++] = n - 1;
+    const int range = n < points_ ? n - 1 : n;
+    while (drawn < sample_size_) {
+      int idx = UniformIndex(rng, range);
+      if (std::find(sample, sample + drawn, idx) == sample + drawn)
+        sample[drawn++] = idx;
+    }
+  }
+
+ private:
+  const int points_;
+  const int sample_size_;
+  std::vector<double> growth_;
+};
+
+// Track order by decreasing age, older tracks survived more frames and are more likely inliers.
+inline std::vector<int> GetProsacOrder(const std::vector<int>& ages) {
+  std::vector<int> order(ages.size());
+  for (size_t i = 0; i < order.size(); i++)
+    order[i] = i;
+  std::stable_sort(order.begin(), order.end(), [&ages](int a, int b) {
+    return ages[a] > ages[b];
+  });
+  return order;
+}
+
+}
+
+#endif  // STEREO_EGOMOTION_BASE_ADAPTIVE_RANSAC_H_
@@ -3,7 +3,12 @@
 #ifndef STEREO_EGOMOTION_BASE_COST_FUNCTIONS_H_
 #define STEREO_EGOMOTION_BASE_COST_FUNCTIONS_H_
 
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
 #include "../../core/types.h"
+#include "../../optimization/bundle_adjustment/stereo_projection.h"
 #include "ceres/ceres.h"
 #include "ceres/rotation.h"
 
@@ -166,4 +171,175 @@ struct WeightedReprojectionError {
   double weight;
 };
 
+// Weight of WeightedReprojectionError, lowers the influence of points near the image border.
+inline double GetReprojectionWeight(const core::Point& obs_left, const double* camera_intr) {
+  double cx = camera_intr[2];
+  return 1.0 / (std::fabs(obs_left.x_ - cx) / std::fabs(cx) + 0.05);
+}
+
+// ReprojectionErrorWithQuaternion (weight = 1) and WeightedReprojectionError with hand
+// derived Jacobians instead of Jets.
+class ReprojectionErrorAnalytic : public ceres::SizedCostFunction<4,4,3> {
+ public:
+  ReprojectionErrorAnalytic(const Eigen::Vector3d& point3d, const core::Point& obs_left,
+                            const core::Point& obs_right, const double* camera_intr, double weight)
+      : cam_intr_(camera_intr), weight_(weight) {
+    pt3d_[0] = point3d[0];
+    pt3d_[1] = point3d[1];
+    pt3d_[2] = point3d[2];
+    left_[0] = obs_left.x_;
+    left_[1] = obs_left.y_;
+    right_[0] = obs_right.x_;
+    right_[1] = obs_right.y_;
+  }
+
+  // Replaces the observation so a block of a reused ceres::Problem can be moved to another
+  // track between solves.
+  void SetObservation(const Eigen::Vector3d& point3d, const core::Point& obs_left,
+                      const core::Point& obs_right, double weight) {
+    pt3d_[0] = point3d[0];
+    pt3d_[1] = point3d[1];
+    pt3d_[2] = point3d[2];
+    left_[0] = obs_left.x_;
+    left_[1] = obs_left.y_;
+    right_[0] = obs_right.x_;
+    right_[1] = obs_right.y_;
+    weight_ = weight;
+  }
+  // A switched off block has zero residuals and Jacobians and adds nothing to the cost.
+  void SwitchOff() { weight_ = 0.0; }
+  bool active() const { return weight_ != 0.0; }
+
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override {
+    if (!active()) {
+      std::fill(residuals, residuals + 4, 0.0);
+      if (jacobians != nullptr) {
+        if (jacobians[0] != nullptr)
+          std::fill(jacobians[0], jacobians[0] + 16, 0.0);
+        if (jacobians[1] != nullptr)
+          std::fill(jacobians[1], jacobians[1] + 12, 0.0);
+      }
+      return true;
+    }
+    const double* rotation = parameters[0];
+    const double* translation = parameters[1];
+    double jac_rot[12];
+    double pt3d_curr[3];
+    bool need_rot = jacobians != nullptr && jacobians[0] != nullptr;
+    optim::RotatePointWithJacobian(rotation, pt3d_, pt3d_curr, need_rot ? jac_rot : nullptr);
+    for (int i = 0; i < 3; i++)
+      pt3d_curr[i] += translation[i];
+    if (jacobians == nullptr) {
+      optim::StereoResidualsWithJacobian(pt3d_curr, cam_intr_, left_, right_, weight_, residuals,
+                                         nullptr);
+      return true;
+    }
+    // the Jacobian wrt the translation is the one wrt the transformed point
+    double jac_pt[12];
+    optim::StereoResidualsWithJacobian(pt3d_curr, cam_intr_, left_, right_, weight_, residuals,
+                                       jac_pt);
+    if (jacobians[0] != nullptr)
+      optim::MultiplyRowMajor(jac_pt, jac_rot, 4, 3, 4, jacobians[0]);
+    if (jacobians[1] != nullptr)
+      std::copy(jac_pt, jac_pt + 12, jacobians[1]);
+    return true;
+  }
+
+  static ceres::CostFunction* Create(const Eigen::Vector3d& pt3d, const core::Point& left_proj,
+                                     const core::Point& right_proj, const double* camera_intr,
+                                     double weight) {
+    return new ReprojectionErrorAnalytic(pt3d, left_proj, right_proj, camera_intr, weight);
+  }
+
+ private:
+  double pt3d_[3];
+  double left_[2];
+  double right_[2];
+  const double* cam_intr_;
+  double weight_;
+};
+
+// All observations of one motion in a single residual block of 4 * N residuals, Ceres then
+// calls one Evaluate per iteration instead of N. Only valid without a robust loss, a loss
+// function would be applied to the whole block.
+// The block can also be allocated for a capacity of points and refilled with SetPoints()
+// between solves, the rows past the current point count are zero.
+class ReprojectionErrorBatch : public ceres::CostFunction {
+ public:
+  ReprojectionErrorBatch(const std::vector<Eigen::Vector3d>& pts3d,
+                         const std::vector<core::Point>& obs_left,
+                         const std::vector<core::Point>& obs_right,
+                         const double* camera_intr, bool use_weighting)
+      : ReprojectionErrorBatch(pts3d.size(), camera_intr) {
+    SetPoints(pts3d, obs_left, obs_right, use_weighting);
+  }
+
+  ReprojectionErrorBatch(size_t capacity, const double* camera_intr)
+      : cam_intr_(camera_intr), num_pts_(0), data_(capacity * kStride) {
+    set_num_residuals(4 * capacity);
+    mutable_parameter_block_sizes()->push_back(4);
+    mutable_parameter_block_sizes()->push_back(3);
+  }
+
+  size_t capacity() const { return data_.size() / kStride; }
+
+  // Needs pts3d.size() <= capacity().
+  void SetPoints(const std::vector<Eigen::Vector3d>& pts3d,
+                 const std::vector<core::Point>& obs_left,
+                 const std::vector<core::Point>& obs_right, bool use_weighting) {
+    assert(pts3d.size() <= capacity());
+    num_pts_ = pts3d.size();
+    for (size_t i = 0; i < num_pts_; i++) {
+      double* d = &data_[i * kStride];
+      d[0] = pts3d[i][0];
+      d[1] = pts3d[i][1];
+      d[2] = pts3d[i][2];
+      d[3] = obs_left[i].x_;
+      d[4] = obs_left[i].y_;
+      d[5] = obs_right[i].x_;
+      d[6] = obs_right[i].y_;
+      d[7] = use_weighting ? GetReprojectionWeight(obs_left[i], cam_intr_) : 1.0;
+    }
+  }
+
+  bool Evaluate(double const* const* parameters, double* residuals,
+                double** jacobians) const override {
+    const double* rotation = parameters[0];
+    const double* translation = parameters[1];
+    double* jac_rot_out = jacobians != nullptr ? jacobians[0] : nullptr;
+    double* jac_trans_out = jacobians != nullptr ? jacobians[1] : nullptr;
+    bool need_jac = jac_rot_out != nullptr || jac_trans_out != nullptr;
+    double jac_rot[12], jac_pt[12];
+    for (size_t i = 0; i < num_pts_; i++) {
+      const double* d = &data_[i * kStride];
+      double pt3d_curr[3];
+      optim::RotatePointWithJacobian(rotation, d, pt3d_curr,
+                                     jac_rot_out != nullptr ? jac_rot : nullptr);
+      for (int j = 0; j < 3; j++)
+        pt3d_curr[j] += translation[j];
+      optim::StereoResidualsWithJacobian(pt3d_curr, cam_intr_, d + 3, d + 5, d[7],
+                                         residuals + 4*i, need_jac ? jac_pt : nullptr);
+      if (jac_rot_out != nullptr)
+        optim::MultiplyRowMajor(jac_pt, jac_rot, 4, 3, 4, jac_rot_out + 16*i);
+      if (jac_trans_out != nullptr)
+        std::copy(jac_pt, jac_pt + 12, jac_trans_out + 12*i);
+    }
+    const size_t capacity = this->capacity();
+    std::fill(residuals + 4*num_pts_, residuals + 4*capacity, 0.0);
+    if (jac_rot_out != nullptr)
+      std::fill(jac_rot_out + 16*num_pts_, jac_rot_out + 16*capacity, 0.0);
+    if (jac_trans_out != nullptr)
+      std::fill(jac_trans_out + 12*num_pts_, jac_trans_out + 12*capacity, 0.0);
+    return true;
+  }
+
+ private:
+  // point (3), left observation (2), right observation (2), weight (1)
+  static const int kStride = 8;
+  const double* cam_intr_;
+  size_t num_pts_;
+  std::vector<double> data_;
+};
+
 #endif
@@ -0,0 +1,109 @@
+#ifndef STEREO_EGOMOTION_BASE_COUNTER_RNG_H_
+#define STEREO_EGOMOTION_BASE_COUNTER_RNG_H_
+
+#include <cstdint>
+#include <limits>
+
+namespace egomotion
+{
+
+// Counter-based Philox4x32-10 generator (Salmon et al. 2011). The stream is a pure function
+// of (seed, frame, iteration), so each RANSAC iteration draws the same numbers on whatever
+// thread it runs and results do not depend on the thread count or the schedule.
+// Satisfies the UniformRandomBitGenerator requirements.
+class Philox4x32 {
+ public:
+  typedef uint32_t result_type;
+
+  Philox4x32(uint64_t seed, uint32_t frame, uint32_t iteration) {
+    key_[0] = (uint32_t)seed;
+    key_[1] = (uint32_t)(seed >> 32);
+    ctr_[0] = 0;
+    ctr_[1] = 0;
+    ctr_[2] = iteration;
+    ctr_[3] = frame;
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+  result_type operator()() {
+    if (used_ == 4) {
+      Block(ctr_, key_, out_);
+      // the first two words are the block counter within the stream
+      if (++ctr_[0] == 0)
+        ++ctr_[1];
+      used_ = 0;
+    }
+    return out_[used_++];
+  }
+
+  // The 10 round bijection of one counter block.
+  static void Block(const uint32_t* ctr, const uint32_t* key, uint32_t* out) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    for (int r = 0; r < 10; r++) {
+      uint64_t p0 = (uint64_t)0xD2511F53u * c0;
+      uint64_t p1 = (uint64_t)0xCD9E8D57u * c2;
+      uint32_t n0 = (uint32_t)(p1 >> 32) ^ c1 ^ k0;
+      uint32_t n2 = (uint32_t)(p0 >> 32) ^ c3 ^ k1;
+      c0 = n0;
+      c1 = (uint32_t)p1;
+      c2 = n2;
+      c3 = (uint32_t)p0;
+      k0 += 0x9E3779B9u;
+      k1 += 0xBB67AE85u;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+  }
+
+ private:
+  uint32_t key_[2];
+  uint32_t ctr_[4];
+  uint32_t out_[4];
+  int used_ = 4;
+};
+
+// Uniform integer in [0, n) by Lemire's multiply and reject, unlike
+// std::uniform_int_distribution the mapping is the same for every standard library.
+template<typename Rng>
+inline int UniformIndex(Rng& rng, int n) {
+  uint64_t m = (uint64_t)rng() * (uint32_t)n;
+  uint32_t low = (uint32_t)m;
+  if (low < (uint32_t)n) {
+    const uint32_t threshold = (0u - (uint32_t)n) % (uint32_t)n;
+    while (low < threshold) {
+      m = (uint64_t)rng() * (uint32_t)n;
+      low = (uint32_t)m;
+    }
+  }
+  return (int)(m >> 32);
+}
+
+// Writes k distinct indices from [0, n) into sample without rejection or allocation: the j-th
+// draw is uniform over the n - j unused indices and is shifted past the used ones. sorted
+// needs room for k ints and holds the drawn indices in increasing order.
+template<typename Rng>
+inline void SampleDistinct(Rng& rng, int n, int k, int* sample, int* sorted) {
+  for (int j = 0; j < k; j++) {
+    int idx = UniformIndex(rng, n - j);
+    int pos = 0;
+    for (; pos < j && sorted[pos] <= idx; pos++)
+      idx++;
+    for (int m = j; m > pos; m--)
+      sorted[m] = sorted[m-1];
+    sorted[pos] = idx;
+    sample[j] = idx;
+  }
+}
+
+// The 3 point sample of the stereo RANSAC estimators.
+template<typename Rng>
+inline void SampleThree(Rng& rng, int n, int* sample) {
+  int sorted[3];
+  SampleDistinct(rng, n, 3, sample, sorted);
+}
+
+}
+
+#endif  // STEREO_EGOMOTION_BASE_COUNTER_RNG_H_
@@ -3,6 +3,7 @@
 
 #include "egomotion_base.h"
 #include "../../tracker/stereo/stereo_tracker_base.h"
+#include "../../tracker/base/deformation_field.h"
 
 namespace egomotion
 {
@@ -28,11 +29,17 @@ class EgomotionLibviso : public EgomotionBase {
     int32_t ransac_iters;     // number of RANSAC iterations
     double  inlier_threshold; // fundamental matrix inlier threshold
     bool    reweighting;      // lower border weights (more robust to calibration errors)
+    double  ransac_confidence; // stop RANSAC early once a good sample was drawn this likely
+    bool    use_prosac;       // sample older tracks first (PROSAC)
+    uint64_t random_seed;     // the samples only depend on the seed, frame and iteration
     parameters () {
-      base             = 1.0;
-      ransac_iters     = 200;
-      inlier_threshold = 1.5;
-      reweighting      = true;
+      base              = 1.0;
+      ransac_iters      = 200;
+      inlier_threshold  = 1.5;
+      reweighting       = true;
+      ransac_confidence = 0.999;
+      use_prosac        = false;
+      random_seed       = 0;
     }
   };
   // structure for storing matches
@@ -65,37 +72,6 @@ class EgomotionLibviso : public EgomotionBase {
   parameters params_;
 
 private:
-  enum ResultState { UPDATED, FAILED, CONVERGED };  
-
-  ResultState updateParameters(double* p_observe,
-                               double* p_predict,
-                               double* p_residual,
-                               double* J,
-                               std::vector<StereoMatch> &tracks,
-                               std::vector<int32_t>& active,
-                               std::vector<double>& tr,
-                               double step_size, double eps);
-
-  void computeObservations(double* p_observe,
-                           std::vector<StereoMatch>& tracks,
-                           std::vector<int> &active);
-
-  void computeResidualsAndJacobian(double* p_observe,
-                                   double* p_predict,
-                                   double* p_residual,
-                                   double* J,
-                                   std::vector<double>& tr,
-                                   std::vector<int>& active);
-
-
-  std::vector<int> getInliers(double* p_observe,
-                              double* p_predict,
-                              double* p_residual,
-                              double* J,
-                              std::vector<StereoMatch> &tracks,
-                              std::vector<double> &tr,
-                              std::vector<int>& active);
-
   void updateTrackerInliers(const std::vector<int>& active_tracks);
 
   
@@ -104,28 +80,15 @@ private:
                                   std::vector<int>& active_tracks);
   void GetPointCell(const core::Point& pt, int& row, int& col);
 
-  void InterpolateBilinear(const cv::Mat& mat, const int row, const int col,
-                           const double x, const double y, double& ival);
-  void InterpolateLinear(const double val1, const double val2, const double x,
-                         const double size, double& ival);
-
-  void GetPointDeformation(const core::Point& pt, const cv::Mat& def_x,
-                           const cv::Mat& def_y, double& dx, double& dy);
-
-  void ComputeCellCenters();
   int GetBinNum(const core::Point& pt);
 
-  double *X, *Y, *Z = nullptr;            // 3d points
-  double *W = nullptr;
-
   std::vector<int> inliers_;            // ransac inlier set
   std::vector<int> tracker_inliers_;    // tracker inlier set
   std::vector<int> tracker_outliers_;
+  std::vector<int> track_ages_;         // ages of the tracks, PROSAC quality
+  uint32_t frame_ = 0;                  // number of estimateMotion calls, keys the samples
 
-  cv::Mat left_dx_, left_dy_;
-  cv::Mat right_dx_, right_dy_;
-  cv::Mat cell_centers_x_;
-  cv::Mat cell_centers_y_;
+  track::DeformationField left_df_, right_df_;
   bool use_deformation_map_ = false;
 
   cv::Mat weights_mat_;
@@ -138,29 +101,6 @@ private:
   cv::Mat img_left_prev_;
 };
 
-inline
-void EgomotionLibviso::InterpolateBilinear(const cv::Mat& mat, const int row, const int col,
-                                               const double x, const double y, double& ival)
-{
-  double q1 = mat.at<double>(row, col);
-  double q2 = mat.at<double>(row, col+1);
-  double q3 = mat.at<double>(row+1, col);
-  double q4 = mat.at<double>(row+1, col+1);
-
-  double w = cell_width_;
-  double h = cell_height_;
-  double q12 = ((w-x) / w) * q1 + (x / w) * q2;
-  double q34 = ((w-x) / w) * q3 + (x / w) * q4;
-  ival = ((h-y) / h) * q12 + (y / h) * q34;
-}
-
-inline
-void EgomotionLibviso::InterpolateLinear(const double val1, const double val2, const double x,
-                                             const double size, double& ival)
-{
-  ival = ((size - x) / size) * val1 + (x / size) * val2;
-}
-
 inline
 void EgomotionLibviso::GetPointCell(const core::Point& pt, int& row, int& col)
 {
@@ -1,15 +1,19 @@
 #include "egomotion_ransac.h"
 
+#include <algorithm>
 #include <array>
-#include <random>
-#include <unordered_set>
 #include <omp.h>
 
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/core/eigen.hpp>
+#include <Eigen/Geometry>
+#include <Eigen/StdVector>
 
+#include "adaptive_ransac.h"
+#include "cost_functions.h"
 #include "egomotion_solver.h"
+#include "inlier_scorer.h"
 
 #define USE_OMP
 
@@ -19,22 +23,65 @@ namespace egomotion
 namespace
 {
 
-std::vector<int> GetRandomSample(std::uniform_int_distribution<int>& udist,
-                                 std::mt19937& rng, size_t N) {
-  std::unordered_set<int> set;
-  std::vector<int> sample;
-  while(sample.size() < N) {
-    int rnum = udist(rng);
-    if (set.find(rnum) == set.end()) {
-      set.insert(rnum);
-      sample.push_back(rnum);
+// fixed size vectorizable Eigen types need the aligned allocator before C++17
+typedef std::vector<Eigen::Vector4d, Eigen::aligned_allocator<Eigen::Vector4d>> Points4d;
+typedef std::vector<Eigen::Matrix4d, Eigen::aligned_allocator<Eigen::Matrix4d>> Motions;
+
+// Closed form rigid motion of the 3 point sample from the previous to the current frame
+// (Horn/Umeyama on the triangulated stereo points), the hypothesis is only refined by the
+// final Ceres solve on all inliers.
+bool GetClosedFormMotion(const int* sample,
+                         const Points4d& pts3d_prev,
+                         const Points4d& pts3d_curr,
+                         const std::vector<char>& valid_curr,
+                         Eigen::Matrix4d& Rt) {
+  Eigen::Matrix3d src, dst;
+  for (int j = 0; j < 3; j++) {
+    int idx = sample[j];
+    if (!valid_curr[idx])
+      return false;
+    src.col(j) = pts3d_prev[idx].head<3>();
+    dst.col(j) = pts3d_curr[idx].head<3>();
+  }
+  Rt = Eigen::umeyama(src, dst, false);
+  return true;
+}
+
+// Preemptive scoring (Nister 2003). The scorer points are in random order, so each block of
+// them is a random subset. All hypotheses are scored block by block and after block k only the
+// best M / 2^k survive, which bounds the work to about 2 M block points. Returns the index
+// of the best surviving hypothesis or -1 if there is no valid one.
+int SelectPreemptive(const InlierScorer& scorer, const Motions& hypotheses,
+                     const std::vector<char>& valid, int block) {
+  const int M = hypotheses.size();
+  std::vector<int> alive;
+  for (int i = 0; i < M; i++)
+    if (valid[i])
+      alive.push_back(i);
+  std::vector<int> score(M, 0);
+  auto better = [&score](int a, int b) {
+    return score[a] > score[b] || (score[a] == score[b] && a < b);
+  };
+  int blocks = 0;
+  for (int begin = 0; begin < scorer.size() && alive.size() > 1; begin += block) {
+    int end = std::min(scorer.size(), begin + block);
+    #pragma omp parallel for schedule(static)
+    for (int j = 0; j < (int)alive.size(); j++)
+      score[alive[j]] += scorer.Count(hypotheses[alive[j]], begin, end);
+    // preemption function f(i) = M 2^-floor(i/B)
+    size_t keep = std::max(1, M >> std::min(++blocks, 30));
+    if (keep < alive.size()) {
+      std::nth_element(alive.begin(), alive.begin() + keep, alive.end(), better);
+      alive.resize(keep);
     }
   }
-  return sample;
+  if (alive.empty())
+    return -1;
+  return *std::min_element(alive.begin(), alive.end(), better);
 }
 
 void AddPointsToSolver(const std::vector<int>& active,
-                       const std::vector<Eigen::Vector4d>& pts3d,
+                       const Points4d& pts3d,
                        const std::vector<core::Point>& left_curr,
                        const std::vector<core::Point>& right_curr,
                        EgomotionSolver& solver) {
@@ -48,43 +95,16 @@ void AddPointsToSolver(const std::vector<int>& active,
 
 }
 
-void EgomotionRansac::ProjectToStereo(const Eigen::Vector4d& pt3d,
-                                      core::Point& pt_left, core::Point& pt_right) {
-  double f = params_.calib.f;
-  double cx = params_.calib.cx;
-  double cy = params_.calib.cy;
-  double b = params_.calib.b;
-
-  double x = pt3d[0] / pt3d[2];
-  double y = pt3d[1] / pt3d[2];
-  pt_left.x_ = f * x + cx;
-  pt_left.y_ = f * y + cy;
-  // right camera
-  x = (pt3d[0] - b) / pt3d[2];
-  pt_right.x_ = f * x + cx;
-  pt_right.y_ = pt_left.y_;
-}
-
-std::vector<int> EgomotionRansac::GetInliers(const std::vector<Eigen::Vector4d>& pts3d,
-                                             const Eigen::Matrix4d Rt,
-                                             const std::vector<core::Point>& left_obs,
-                                             const std::vector<core::Point>& right_obs) {
-  // compute inliers
-  std::vector<int> inliers;
-  core::Point left_proj, right_proj;
-  double square_thr = params_.inlier_threshold * params_.inlier_threshold;
-  for (size_t i = 0; i < pts3d.size(); i++) {
-    ProjectToStereo(Rt * pts3d[i], left_proj, right_proj);
-    double xdiff1 = left_proj.x_ - left_obs[i].x_;
-    double ydiff1 = left_proj.y_ - left_obs[i].y_;
-    double xdiff2 = right_proj.x_ - right_obs[i].x_;
-    double ydiff2 = right_proj.y_ - right_obs[i].y_;
-    double square_error = xdiff1*xdiff1 + xdiff2*xdiff2 + ydiff1*ydiff1 + ydiff2*ydiff2;
-    //printf("%f < %f\n", square_error, square_thr);
-    if (square_error < square_thr)
-      inliers.push_back(i);
-  }
-  return inliers;
+EgomotionRansac::EgomotionRansac(Parameters& params)
+    : params_(params),
+      pose_solver_(params.calib.f, params.calib.cx, params.calib.cy, params.calib.b,
+                   GetRobustLoss(params.loss_function_type), params.robust_loss_scale) {
+  if (params_.use_ceres_refinement) {
+    double cam_params[] = { params_.calib.f, params_.calib.f, params_.calib.cx,
+                            params_.calib.cy, params_.calib.b };
+    solver_.reset(new EgomotionSolver(cam_params, params_.loss_function_type,
+                                      params_.robust_loss_scale, params_.use_weighting));
+  }
 }
 
 void EgomotionRansac::PrepareTracks(const track::StereoTrackerBase& tracker,
@@ -92,19 +112,22 @@ void EgomotionRansac::PrepareTracks(const track::StereoTrackerBase& tracker,
                                     std::vector<core::Point>& left_curr,
                                     std::vector<core::Point>& right_prev,
                                     std::vector<core::Point>& right_curr,
-                                    std::vector<int>& active_tracks)
+                                    std::vector<int>& active_tracks,
+                                    std::vector<int>& track_ages)
 {
-  int feats_num = tracker.countFeatures();
-  for (int i = 0; i < feats_num; i++) {
-    track::FeatureInfo feat_left = tracker.featureLeft(i);
-    if (feat_left.age_ > 0) {
-      track::FeatureInfo feat_right = tracker.featureRight(i);
-      left_prev.push_back(feat_left.prev_);
-      left_curr.push_back(feat_left.curr_);
-      right_prev.push_back(feat_right.prev_);
-      right_curr.push_back(feat_right.curr_);
-      active_tracks.push_back(i);
-    }
+  const track::TrackBatch tracks = tracker.GetTrackBatch();
+  left_prev.reserve(left_prev.size() + tracks.live_count);
+  left_curr.reserve(left_curr.size() + tracks.live_count);
+  right_prev.reserve(right_prev.size() + tracks.live_count);
+  right_curr.reserve(right_curr.size() + tracks.live_count);
+  for (int k = 0; k < tracks.live_count; k++) {
+    int i = tracks.live[k];
+    left_prev.push_back(tracks.leftPrev(i));
+    left_curr.push_back(tracks.leftCurr(i));
+    right_prev.push_back(tracks.rightPrev(i));
+    right_curr.push_back(tracks.rightCurr(i));
+    active_tracks.push_back(i);
+    track_ages.push_back(tracks.age[i]);
   }
 }
 
@@ -128,6 +151,7 @@ bool EgomotionRansac::EstimateMotion(const std::vector<core::Point>& left_prev,
                                      const std::vector<core::Point>& left_curr,
                                      const std::vector<core::Point>& right_prev,
                                      const std::vector<core::Point>& right_curr,
+                                     const std::vector<int>& track_ages,
                                      Eigen::Matrix4d& Rt) {
   // return value
   bool success = true;
@@ -135,12 +159,12 @@ bool EgomotionRansac::EstimateMotion(const std::vector<core::Point>& left_prev,
   int N  = left_prev.size();
   if (N < 6)
     return false;
-  double cam_params[] = { params_.calib.f, params_.calib.f, params_.calib.cx,
-                          params_.calib.cy, params_.calib.b };
+  const double cam_params[] = { params_.calib.f, params_.calib.f, params_.calib.cx,
+                                params_.calib.cy, params_.calib.b };
 
   // triangulate 3D points
   //pts3d_ = new double[3 * N];
-  std::vector<Eigen::Vector4d> pts3d;
+  Points4d pts3d;
   pts3d.resize(N);
   for (int32_t i = 0; i < N; i++) {
     if(left_prev[i].x_ - right_prev[i].x_ < 0.01) {
@@ -161,69 +185,165 @@ bool EgomotionRansac::EstimateMotion(const std::vector<core::Point>& left_prev,
     pts3d[i][2] = params_.calib.f * params_.calib.b / d;
     pts3d[i][3] = 1.0;
   }
-  
-  std::vector<std::vector<int>> active;
-  std::vector<std::vector<int>> iter_inliers;
-  std::vector<Eigen::Matrix4d> iter_motion;
-  active.resize(params_.ransac_iters);
-  iter_inliers.resize(params_.ransac_iters);
-  iter_motion.resize(params_.ransac_iters);
+  // points in the current frame are only needed for the hypotheses, a sample with
+  // a bad disparity in the current frame is skipped instead
+  Points4d pts3d_curr(N);
+  std::vector<char> valid_curr(N);
+  for (int32_t i = 0; i < N; i++) {
+    double d = left_curr[i].x_ - right_curr[i].x_;
+    valid_curr[i] = d >= 0.01;
+    d = std::max(d, 0.01);
+    pts3d_curr[i][0] = (left_curr[i].x_ - params_.calib.cx) * params_.calib.b / d;
+    pts3d_curr[i][1] = (left_curr[i].y_ - params_.calib.cy) * params_.calib.b / d;
+    pts3d_curr[i][2] = params_.calib.f * params_.calib.b / d;
+    pts3d_curr[i][3] = 1.0;
+  }
+
+  // every random draw is keyed by (seed, frame, iteration) so the result does not depend
+  // on the threads, the shuffle below uses the iteration index past the RANSAC ones
+  const uint64_t seed = params_.random_seed;
+  const uint32_t frame = frame_++;
+  // all tracks in SoA layout for the vectorized hypothesis scoring, shuffled for the
+  // preemptive scoring which needs random blocks
+  bool preemptive = params_.preemption_block > 0;
+  std::vector<int> score_order(N);
+  for (int32_t i = 0; i < N; i++)
+    score_order[i] = i;
+  if (preemptive) {
+    Philox4x32 rng(seed, frame, params_.ransac_iters);
+    for (int32_t i = N - 1; i > 0; i--)
+      std::swap(score_order[i], score_order[UniformIndex(rng, i + 1)]);
+  }
+  InlierScorer scorer(params_.calib.f, params_.calib.cx, params_.calib.cy, params_.calib.b,
+                      params_.inlier_threshold);
+  scorer.Resize(N);
+  for (int32_t k = 0; k < N; k++) {
+    int i = score_order[k];
+    scorer.SetPoint(k, pts3d[i][0], pts3d[i][1], pts3d[i][2], left_curr[i].x_, left_curr[i].y_,
+                    right_curr[i].x_, right_curr[i].y_);
+  }
+
   // get initial RANSAC estimate
   //omp_set_num_threads(1);
-  int ransac_pts = 3;
-  std::random_device rd;
-  size_t seed = rd();
-#ifdef USE_OMP
-  #pragma omp parallel
-  {
-  //std::mt19937 rng(int(time(NULL)) ^ omp_get_thread_num());
-  std::mt19937 rng(seed + omp_get_thread_num());
-#else
-  //std::mt19937 rng(rd());
-  std::mt19937 rng(0);
-#endif
-  std::uniform_int_distribution<int> udist(0, N-1);
-  //EgomotionSolver solver(cam_params, false, 1.0);
-  // the result is worse if we try robust loss here which makes sense as we really need
-  // all 3 points in 2 frames to describe the 3D rigid motion
-  EgomotionSolver solver(cam_params, "Squared", 0, params_.use_weighting);
-
+  const int ransac_pts = 3;
+  std::vector<int> prosac_order;
+  if (params_.use_prosac)
+    prosac_order = GetProsacOrder(track_ages);
+  ProsacSampler prosac(N, ransac_pts, params_.ransac_iters);
+  auto draw_sample = [&](int iter, int* sample) {
+    Philox4x32 rng(seed, frame, iter);
+    if (params_.use_prosac) {
+      prosac.Sample(iter, rng, sample);
+      for (int j = 0; j < ransac_pts; j++)
+        sample[j] = prosac_order[sample[j]];
+    }
+    else
+      SampleThree(rng, N, sample);
+  };
+  // the best hypothesis, on equal inlier counts the earlier iteration wins
+  int best_iter = -1;
+  int most_inliers = 0;
+  Eigen::Matrix4d best_motion = Eigen::Matrix4d::Identity();
+  std::vector<uint64_t> best_mask(scorer.mask_words(), 0);
+  // the iteration budget shrinks with the best inlier ratio
+  AdaptiveRansacCounter counter(N, ransac_pts, params_.ransac_confidence, params_.ransac_iters);
+  if (preemptive) {
+    // fixed budget: all ransac_iters hypotheses first, then preemptive scoring
+    Motions hypotheses(params_.ransac_iters);
+    std::vector<char> valid(params_.ransac_iters);
 #ifdef USE_OMP
-  #pragma omp for
+    #pragma omp parallel for
 #endif
-  for (int i = 0; i < params_.ransac_iters; i++) {
-    active[i] = GetRandomSample(udist, rng, ransac_pts);
-    // Add points to solver
-    AddPointsToSolver(active[i], pts3d, left_curr, right_curr, solver);
-    if (!solver.Solve(iter_motion[i])) {
-      printf("Solver failed!\n");
+    for (int i = 0; i < params_.ransac_iters; i++) {
+      int sample[ransac_pts];
+      draw_sample(i, sample);
+      valid[i] = GetClosedFormMotion(sample, pts3d, pts3d_curr, valid_curr, hypotheses[i]);
+    }
+    best_iter = SelectPreemptive(scorer, hypotheses, valid, params_.preemption_block);
+    if (best_iter >= 0) {
+      best_motion = hypotheses[best_iter];
+      most_inliers = scorer.Score(best_motion, &best_mask[0]);
     }
-    iter_inliers[i] = GetInliers(pts3d, iter_motion[i], left_curr, right_curr);
-    // std::cout << "\nInliers = " << iter_inliers[i].size() << "\n";
   }
+  else {
+    // Rounds of iterations are scored in parallel and then reported in iteration order up to
+    // the current budget, the rest of the last round is discarded.
 #ifdef USE_OMP
-  }
+    const int round = kRansacRoundPerThread * omp_get_max_threads();
+#else
+    const int round = kRansacRoundPerThread;
 #endif
-  // get the best solution
-  int best_iter = 0;
-  size_t most_inliers = iter_inliers[0].size();
-  for (int i = 1; i < (int)iter_inliers.size(); i++) {
-    if (iter_inliers[i].size() > most_inliers) {
-      best_iter = i;
-      most_inliers = iter_inliers[i].size();
+    const int words = scorer.mask_words();
+    std::vector<int> round_inliers(round);
+    Motions round_motions(round);
+    std::vector<uint64_t> round_masks(round * words);
+    for (int start = 0; start < counter.required(); start += round) {
+      const int end = std::min(start + round, counter.required());
+#ifdef USE_OMP
+      #pragma omp parallel for schedule(dynamic)
+#endif
+      for (int i = start; i < end; i++) {
+        int sample[ransac_pts];
+        draw_sample(i, sample);
+        Eigen::Matrix4d& motion = round_motions[i - start];
+        if (GetClosedFormMotion(sample, pts3d, pts3d_curr, valid_curr, motion))
+          round_inliers[i - start] = scorer.Score(motion, &round_masks[(i - start) * words]);
+        else
+          round_inliers[i - start] = -1;
+      }
+      for (int i = start; i < end && i < counter.required(); i++) {
+        int inliers = round_inliers[i - start];
+        if (inliers < 0)
+          continue;
+        // std::cout << "\nInliers = " << inliers << "\n";
+        if (inliers > most_inliers) {
+          best_iter = i;
+          most_inliers = inliers;
+          best_motion = round_motions[i - start];
+          std::copy(&round_masks[(i - start) * words], &round_masks[(i - start + 1) * words],
+                    best_mask.begin());
+        }
+        counter.Report(inliers);
+      }
     }
   }
-  inliers_ = std::move(iter_inliers[best_iter]);
+  // only the winning hypothesis gets its inlier list
+  scorer.GetInliers(&best_mask[0], inliers_);
+  if (preemptive) {
+    for (int& idx : inliers_)
+      idx = score_order[idx];
+    std::sort(inliers_.begin(), inliers_.end());
+  }
+  if (most_inliers < ransac_pts)
+    return false;
   //printf("[EgomotionRansac]: RANSAC found most inliers in iter %d / %d\n",
-  //       best_iter, params_.ransac_iters);
+  //       best_iter, counter.evaluated());
 
-  //std::cout << iter_motion[best_iter] << "\n";
+  //std::cout << best_motion << "\n";
   // final optimization on all inliers
-  EgomotionSolver final_solver(cam_params, params_.loss_function_type, params_.robust_loss_scale,
-                               params_.use_weighting);
-  final_solver.InitializeParams(iter_motion[best_iter]);
-  AddPointsToSolver(inliers_, pts3d, left_curr, right_curr, final_solver);
-  if (!final_solver.Solve(Rt)) {
+  if (params_.use_ceres_refinement) {
+    solver_->InitializeParams(best_motion);
+    AddPointsToSolver(inliers_, pts3d, left_curr, right_curr, *solver_);
+    if (!solver_->Solve(Rt)) {
+      printf("[EgomotionRansac]: Solver failed!\n");
+      return false;
+    }
+    return success;
+  }
+  // same iteration budget and tolerances as the Ceres solver
+  StereoPoseSolver<double>::Options options;
+  options.max_iterations = 10;
+  options.function_tolerance = 1e-6;
+  pose_solver_.Clear();
+  for (int idx : inliers_) {
+    double weight = params_.use_weighting ? GetReprojectionWeight(left_curr[idx], cam_params)
+                                          : 1.0;
+    pose_solver_.AddPoint(pts3d[idx][0], pts3d[idx][1], pts3d[idx][2],
+                          left_curr[idx].x_, left_curr[idx].y_,
+                          right_curr[idx].x_, right_curr[idx].y_, weight);
+  }
+  Rt = best_motion;
+  if (!pose_solver_.Solve(options, Rt)) {
     printf("[EgomotionRansac]: Solver failed!\n");
     return false;
   }
@@ -234,11 +354,11 @@ bool EgomotionRansac::EstimateMotion(const std::vector<core::Point>& left_prev,
 bool EgomotionRansac::GetMotion(track::StereoTrackerBase& tracker, Eigen::Matrix4d& Rt) {
   // estimate motion
   std::vector<core::Point> left_prev, left_curr, right_prev, right_curr;
-  std::vector<int> active_tracks;
-  PrepareTracks(tracker, left_prev, left_curr, right_prev, right_curr, active_tracks);
+  std::vector<int> active_tracks, track_ages;
+  PrepareTracks(tracker, left_prev, left_curr, right_prev, right_curr, active_tracks, track_ages);
 
   //Eigen::Matrix4d rt_motion;
-  int success = EstimateMotion(left_prev, left_curr, right_prev, right_curr, Rt);
+  int success = EstimateMotion(left_prev, left_curr, right_prev, right_curr, track_ages, Rt);
   UpdateTrackerInliers(active_tracks);
   //cv::eigen2cv(rt_motion, Rt);
 
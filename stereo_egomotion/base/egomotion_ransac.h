@@ -7,6 +7,8 @@
 
 #include "../../tracker/stereo/stereo_tracker_base.h"
 #include "egomotion_base.h"
+#include "egomotion_solver.h"
+#include "pose_solver.h"
 
 namespace egomotion
 {
@@ -27,9 +29,20 @@ class EgomotionRansac : public EgomotionBase
     double robust_loss_scale;
     CalibParams calib;
     bool use_weighting;
+    // RANSAC stops once ransac_iters or the iterations needed for this confidence are reached
+    double ransac_confidence = 0.999;
+    // sample older tracks first (PROSAC)
+    bool use_prosac = false;
+    // > 0 selects preemptive RANSAC with a fixed budget of ransac_iters hypotheses which are
+    // scored on blocks of this many tracks, halving the hypotheses after each block
+    int preemption_block = 0;
+    // refine the RANSAC motion with the Ceres EgomotionSolver instead of StereoPoseSolver
+    bool use_ceres_refinement = false;
+    // the samples of a frame only depend on this seed, the frame number and the iteration
+    uint64_t random_seed = 0;
   };
 
-  EgomotionRansac(Parameters& params) : params_(params) {}
+  EgomotionRansac(Parameters& params);
   bool GetMotion(track::StereoTrackerBase& tracker, Eigen::Matrix4d& Rt) override;
 
   virtual std::vector<int> GetTrackerInliers() { return tracker_inliers_; }
@@ -42,23 +55,24 @@ class EgomotionRansac : public EgomotionBase
                      std::vector<core::Point>& left_curr,
                      std::vector<core::Point>& right_prev,
                      std::vector<core::Point>& right_curr,
-                     std::vector<int>& active_tracks);
+                     std::vector<int>& active_tracks,
+                     std::vector<int>& track_ages);
   bool EstimateMotion(const std::vector<core::Point>& left_prev,
                       const std::vector<core::Point>& left_curr,
                       const std::vector<core::Point>& right_prev,
                       const std::vector<core::Point>& right_curr,
+                      const std::vector<int>& track_ages,
                       Eigen::Matrix4d& Rt);
-  std::vector<int> GetInliers(const std::vector<Eigen::Vector4d>& pts3d,
-                              const Eigen::Matrix4d Rt,
-                              const std::vector<core::Point>& left_obs,
-                              const std::vector<core::Point>& right_obs);
-  void ProjectToStereo(const Eigen::Vector4d& pt3d,
-                       core::Point& pt_left, core::Point& pt_right);
 
   std::vector<int> inliers_;
   std::vector<int> tracker_inliers_;
   std::vector<int> tracker_outliers_;
   Parameters params_;
+  // kept across frames so its ceres::Problem is built only once
+  std::unique_ptr<EgomotionSolver> solver_;
+  StereoPoseSolver<double> pose_solver_;
+  // number of EstimateMotion calls, keys the random samples
+  uint32_t frame_ = 0;
 };
 
 }
@@ -1,5 +1,7 @@
 #include "egomotion_solver.h"
 
+#include <algorithm>
+
 #include "cost_functions.h"
 #include "../../optimization/bundle_adjustment/ceres_helper.h"
 #include "../../core/math_helper.h"
@@ -7,9 +9,13 @@
 namespace egomotion {
 
 EgomotionSolver::EgomotionSolver(const double* cam_params, const std::string loss_function_type,
-                                 double robust_loss_scale, bool use_weighting) :
-  cam_params_(cam_params), loss_function_type_(loss_function_type),
-  robust_loss_scale_(robust_loss_scale), use_weighting_(use_weighting) {
+                                 double robust_loss_scale, bool use_weighting, int max_points) :
+  loss_function_type_(loss_function_type), robust_loss_scale_(robust_loss_scale),
+  use_weighting_(use_weighting) {
+  std::copy(cam_params, cam_params + 5, cam_params_.begin());
+  ResetParams();
+  if (max_points > 0)
+    BuildProblem(max_points);
 
   // Minimizer options_
   //options_.max_num_iterations = 5;
@@ -70,37 +76,70 @@ void EgomotionSolver::InitializeParams(const Eigen::Matrix4d& Rt) {
   params_initialized_ = true;
 }
 
-bool EgomotionSolver::Solve(Eigen::Matrix4d& Rt) {
-  if (pts3d_.size() < 3) {
-    std::cout << "Not enough points!1\n";
-    return false;
-  }
-  ceres::Problem problem;
-  if (!params_initialized_)
-    ResetParams();
+void EgomotionSolver::BuildProblem(int capacity) {
+  // the old problem deletes the cost functions, loss and parameterization it owns
+  problem_.reset(new ceres::Problem);
+  point_costs_.clear();
+  batch_cost_ = nullptr;
+  capacity_ = capacity;
 
   std::vector<double> params = { robust_loss_scale_ };
   ceres::LossFunction* loss_function = optim::CeresHelper::CreateLoss(loss_function_type_, params);
-  for (size_t i = 0; i < pts3d_.size(); i++) {
-    // Each Residual block takes a point and a camera as input and
-    // outputs a 2 dimensional residual.
-    if (!use_weighting_) {
-      ceres::CostFunction* cost_function = ReprojectionErrorWithQuaternion::
-          Create(pts3d_[i], left_projs_[i], right_projs_[i], cam_params_);
-      problem.AddResidualBlock(cost_function, loss_function, &rotation_[0], &translation_[0]);
-    }
-    else {
-      //std::cout << "ALALL";
-      ceres::CostFunction* cost_function = WeightedReprojectionError::
-          Create(pts3d_[i], left_projs_[i], right_projs_[i], cam_params_);
-      problem.AddResidualBlock(cost_function, loss_function, &rotation_[0], &translation_[0]);
+  if (loss_function == nullptr) {
+    // without a robust loss all points can share one residual block
+    batch_cost_ = new ReprojectionErrorBatch(capacity, cam_params_.data());
+    problem_->AddResidualBlock(batch_cost_, nullptr, &rotation_[0], &translation_[0]);
+  }
+  else {
+    point_costs_.reserve(capacity);
+    const Eigen::Vector3d pt3d(0.0, 0.0, 1.0);
+    const core::Point proj(0.0, 0.0);
+    for (int i = 0; i < capacity; i++) {
+      // Each Residual block takes a point and a camera as input and
+      // outputs a 4 dimensional residual.
+      ReprojectionErrorAnalytic* cost_function = new ReprojectionErrorAnalytic(
+          pt3d, proj, proj, cam_params_.data(), 0.0);
+      point_costs_.push_back(cost_function);
+      problem_->AddResidualBlock(cost_function, loss_function, &rotation_[0], &translation_[0]);
     }
   }
   ceres::LocalParameterization* quaternion_parameterization =
       new ceres::QuaternionParameterization;
-  problem.SetParameterization(&rotation_[0], quaternion_parameterization);
+  problem_->SetParameterization(&rotation_[0], quaternion_parameterization);
+}
+
+void EgomotionSolver::UpdateResiduals() {
+  if (batch_cost_ != nullptr) {
+    batch_cost_->SetPoints(pts3d_, left_projs_, right_projs_, use_weighting_);
+    return;
+  }
+  for (size_t i = 0; i < pts3d_.size(); i++) {
+    double weight = use_weighting_ ? GetReprojectionWeight(left_projs_[i], cam_params_.data())
+                                   : 1.0;
+    point_costs_[i]->SetObservation(pts3d_[i], left_projs_[i], right_projs_[i], weight);
+  }
+  for (size_t i = pts3d_.size(); i < point_costs_.size(); i++)
+    point_costs_[i]->SwitchOff();
+}
 
-  ceres::Solve(options_, &problem, &summary_);
+bool EgomotionSolver::Solve(Eigen::Matrix4d& Rt) {
+  if (pts3d_.size() < 3) {
+    std::cout << "Not enough points!1\n";
+    return false;
+  }
+  // warm start from the last solution, which is the motion of the previous frame
+  if (!params_initialized_ && !has_solution_)
+    ResetParams();
+  const int num_pts = pts3d_.size();
+  if (num_pts > capacity_)
+    BuildProblem(std::max(num_pts, 2 * capacity_));
+  // switched off blocks still add their rows to the dense Schur solve, so after a frame with
+  // many points the problem shrinks back once less than half of it is used
+  else if (num_pts < capacity_ / 2)
+    BuildProblem(num_pts);
+  UpdateResiduals();
+
+  ceres::Solve(options_, problem_.get(), &summary_);
   //std::cout << summary_.FullReport() << "\n";
   //std::cout << summary_.BriefReport() << "\n";
 
@@ -125,10 +164,12 @@ bool EgomotionSolver::Solve(Eigen::Matrix4d& Rt) {
   //std::cout << Rt << "\n";
   params_initialized_ = false;
 
-  if (summary_.IsSolutionUsable())
+  if (summary_.IsSolutionUsable()) {
+    has_solution_ = true;
     return true;
-  else
-    return false;
+  }
+  has_solution_ = false;
+  return false;
 }
 
 }
@@ -1,40 +1,65 @@
 #ifndef STEREO_EGOMOTION_BASE_EGOMOTION_SOLVER_H_
 #define STEREO_EGOMOTION_BASE_EGOMOTION_SOLVER_H_
 
+#include <array>
+#include <memory>
 #include <vector>
 #include <Eigen/Core>
 #include <ceres/ceres.h>
 
 #include "../../core/types.h"
 
+class ReprojectionErrorAnalytic;
+class ReprojectionErrorBatch;
+
 namespace egomotion {
 
+// Two-frame motion refinement. The solver keeps one ceres::Problem alive across Solve() calls,
+// its residual blocks are allocated for a capacity of points and only get new observations
+// before each solve, unused blocks are switched off. The capacity doubles when a solve gets
+// more points and shrinks to the point count when less than half of it is used, since the
+// switched off blocks still cost rows in the linear solve. Without InitializeParams() the
+// solve starts from the previous solution.
 class EgomotionSolver {
  public:
   EgomotionSolver(const double* cam_params, const std::string loss_function_type,
-                  double robust_loss_scale, bool use_weighting);
+                  double robust_loss_scale, bool use_weighting, int max_points = 0);
   ~EgomotionSolver();
+  EgomotionSolver(const EgomotionSolver&) = delete;
+  EgomotionSolver& operator=(const EgomotionSolver&) = delete;
   void InitializeParams(const Eigen::Matrix4d& Rt);
   void AddPoint(const Eigen::Vector3d& pt3d, const core::Point& left_proj,
                 const core::Point& right_proj);
   void ClearPoints();
   bool Solve(Eigen::Matrix4d& Rt);
+  int capacity() const { return capacity_; }
   //EgomotionSolver(int num_pts);
   //void Set3DPointsSparse(const std::vector<Eigen::Vector3d>& points, const std::vector<int>& active);
   //void SetProjectionsSparse(const std::vector<cv::Point>& left_curr, const std::vector<cv::Point>&right_curr,
   //                          const std::vector<int>& active);
  private:
   void ResetParams();
+  void BuildProblem(int capacity);
+  void UpdateResiduals();
   //int num_pts_;
   //double *rotation_, *translation_;
   std::array<double,4> rotation_;
   std::array<double,3> translation_;
-  const double* cam_params_;
+  std::array<double,5> cam_params_;
   const std::string loss_function_type_;
   double robust_loss_scale_;
   bool params_initialized_ = false;
+  // rotation_ and translation_ hold a usable solution of the last Solve()
+  bool has_solution_ = false;
   bool use_weighting_;
 
+  // owns the cost functions, the loss and the quaternion parameterization
+  std::unique_ptr<ceres::Problem> problem_;
+  int capacity_ = 0;
+  // one block per point with a robust loss, else a single batch block
+  std::vector<ReprojectionErrorAnalytic*> point_costs_;
+  ReprojectionErrorBatch* batch_cost_ = nullptr;
+
   std::vector<Eigen::Vector3d> pts3d_;
   std::vector<core::Point> left_projs_;
   std::vector<core::Point> right_projs_;
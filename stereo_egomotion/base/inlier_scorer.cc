@@ -0,0 +1,109 @@
+#include "inlier_scorer.h"
+
+#include <cassert>
+#include <cstring>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace egomotion
+{
+
+InlierScorer::InlierScorer(double f, double cu, double cv, double base, double inlier_threshold)
+    : f_(f), cu_(cu), cv_(cv), base_(base),
+      square_thr_(inlier_threshold * inlier_threshold) {}
+
+void InlierScorer::Resize(int n) {
+  n_ = n;
+  x_.resize(n); y_.resize(n); z_.resize(n);
+  ul_.resize(n); vl_.resize(n); ur_.resize(n); vr_.resize(n);
+}
+
+int InlierScorer::Score(const Eigen::Matrix4d& Rt, uint64_t* mask) const {
+  std::memset(mask, 0, mask_words() * sizeof(uint64_t));
+  return Evaluate<true>(Rt, 0, n_, mask);
+}
+
+int InlierScorer::Count(const Eigen::Matrix4d& Rt, int begin, int end) const {
+  return Evaluate<false>(Rt, begin, end, nullptr);
+}
+
+template<bool kMask>
+int InlierScorer::Evaluate(const Eigen::Matrix4d& Rt, int begin, int end, uint64_t* mask) const {
+  assert(!kMask || begin % 4 == 0);
+  const double r00 = Rt(0,0), r01 = Rt(0,1), r02 = Rt(0,2), tx = Rt(0,3);
+  const double r10 = Rt(1,0), r11 = Rt(1,1), r12 = Rt(1,2), ty = Rt(1,3);
+  const double r20 = Rt(2,0), r21 = Rt(2,1), r22 = Rt(2,2), tz = Rt(2,3);
+  int count = 0;
+  int i = begin;
+#ifdef __AVX2__
+  // plain mul/add keeps the lanes bit identical to the scalar tail below, which relies on
+  // the file being built with -ffp-contract=off (see CMakeLists.txt)
+  const __m256d vr00 = _mm256_set1_pd(r00), vr01 = _mm256_set1_pd(r01), vr02 = _mm256_set1_pd(r02);
+  const __m256d vr10 = _mm256_set1_pd(r10), vr11 = _mm256_set1_pd(r11), vr12 = _mm256_set1_pd(r12);
+  const __m256d vr20 = _mm256_set1_pd(r20), vr21 = _mm256_set1_pd(r21), vr22 = _mm256_set1_pd(r22);
+  const __m256d vtx = _mm256_set1_pd(tx), vty = _mm256_set1_pd(ty), vtz = _mm256_set1_pd(tz);
+  const __m256d vf = _mm256_set1_pd(f_), vcu = _mm256_set1_pd(cu_), vcv = _mm256_set1_pd(cv_);
+  const __m256d vbase = _mm256_set1_pd(base_), vthr = _mm256_set1_pd(square_thr_);
+  for (; i + 4 <= end; i += 4) {
+    __m256d x = _mm256_loadu_pd(&x_[i]);
+    __m256d y = _mm256_loadu_pd(&y_[i]);
+    __m256d z = _mm256_loadu_pd(&z_[i]);
+    __m256d xc = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vr00, x),
+                 _mm256_mul_pd(vr01, y)), _mm256_mul_pd(vr02, z)), vtx);
+    __m256d yc = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vr10, x),
+                 _mm256_mul_pd(vr11, y)), _mm256_mul_pd(vr12, z)), vty);
+    __m256d zc = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(vr20, x),
+                 _mm256_mul_pd(vr21, y)), _mm256_mul_pd(vr22, z)), vtz);
+    __m256d w = _mm256_div_pd(vf, zc);
+    __m256d dul = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(xc, w), vcu), _mm256_loadu_pd(&ul_[i]));
+    __m256d dvl = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(yc, w), vcv), _mm256_loadu_pd(&vl_[i]));
+    __m256d dur = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(_mm256_sub_pd(xc, vbase), w), vcu),
+                                _mm256_loadu_pd(&ur_[i]));
+    __m256d dvr = _mm256_sub_pd(_mm256_add_pd(_mm256_mul_pd(yc, w), vcv), _mm256_loadu_pd(&vr_[i]));
+    __m256d err = _mm256_add_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dul, dul),
+                  _mm256_mul_pd(dur, dur)), _mm256_mul_pd(dvl, dvl)), _mm256_mul_pd(dvr, dvr));
+    uint64_t bits = _mm256_movemask_pd(_mm256_cmp_pd(err, vthr, _CMP_LT_OQ));
+    // i is a multiple of 4, the 4 bits never straddle two words
+    if (kMask)
+      mask[i / 64] |= bits << (i % 64);
+    else
+      count += __builtin_popcountll(bits);
+  }
+#endif
+  for (; i < end; i++) {
+    double xc = r00*x_[i] + r01*y_[i] + r02*z_[i] + tx;
+    double yc = r10*x_[i] + r11*y_[i] + r12*z_[i] + ty;
+    double zc = r20*x_[i] + r21*y_[i] + r22*z_[i] + tz;
+    double w = f_ / zc;
+    double dul = xc*w + cu_ - ul_[i];
+    double dvl = yc*w + cv_ - vl_[i];
+    double dur = (xc - base_)*w + cu_ - ur_[i];
+    double dvr = yc*w + cv_ - vr_[i];
+    if (dul*dul + dur*dur + dvl*dvl + dvr*dvr < square_thr_) {
+      if (kMask)
+        mask[i / 64] |= uint64_t(1) << (i % 64);
+      else
+        count++;
+    }
+  }
+  if (kMask) {
+    for (int j = 0; j < mask_words(); j++)
+      count += __builtin_popcountll(mask[j]);
+  }
+  return count;
+}
+
+void InlierScorer::GetInliers(const uint64_t* mask, std::vector<int>& inliers) const {
+  inliers.clear();
+  for (int j = 0; j < mask_words(); j++) {
+    uint64_t bits = mask[j];
+    while (bits) {
+      inliers.push_back(j * 64 + __builtin_ctzll(bits));
+      bits &= bits - 1;
+    }
+  }
+}
+
+}
@@ -0,0 +1,54 @@
+#ifndef STEREO_EGOMOTION_BASE_INLIER_SCORER_H_
+#define STEREO_EGOMOTION_BASE_INLIER_SCORER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+
+namespace egomotion
+{
+
+// Scores RANSAC motion hypotheses against all tracks. The triangulated points of the
+// previous frame and the observations in the current stereo pair are kept in SoA arrays,
+// so with AVX2 four points are transformed, projected and tested per instruction.
+// A point is an inlier if the summed squared reprojection error of both cameras is below
+// the squared threshold. Scoring only counts and sets mask bits, the inlier list is
+// built once for the winning hypothesis.
+class InlierScorer {
+ public:
+  InlierScorer(double f, double cu, double cv, double base, double inlier_threshold);
+
+  void Resize(int n);
+  int size() const { return n_; }
+  // number of 64 bit words of an inlier mask
+  int mask_words() const { return (n_ + 63) / 64; }
+
+  void SetPoint(int i, double x, double y, double z,
+                double u_left, double v_left, double u_right, double v_right) {
+    x_[i] = x; y_[i] = y; z_[i] = z;
+    ul_[i] = u_left; vl_[i] = v_left; ur_[i] = u_right; vr_[i] = v_right;
+  }
+
+  // Returns the inlier count of the motion Rt (previous to current frame) and sets
+  // bit i % 64 of mask[i / 64] for every inlier i, mask needs mask_words() words.
+  int Score(const Eigen::Matrix4d& Rt, uint64_t* mask) const;
+  // Inlier count of Rt among the points begin .. end-1 only, for preemptive scoring.
+  int Count(const Eigen::Matrix4d& Rt, int begin, int end) const;
+  // Indices of the set mask bits in increasing order.
+  void GetInliers(const uint64_t* mask, std::vector<int>& inliers) const;
+
+ private:
+  template<bool kMask>
+  int Evaluate(const Eigen::Matrix4d& Rt, int begin, int end, uint64_t* mask) const;
+
+  const double f_, cu_, cv_, base_;
+  const double square_thr_;
+  int n_ = 0;
+  std::vector<double> x_, y_, z_;
+  std::vector<double> ul_, vl_, ur_, vr_;
+};
+
+}
+
+#endif  // STEREO_EGOMOTION_BASE_INLIER_SCORER_H_
@@ -0,0 +1,256 @@
+#ifndef STEREO_EGOMOTION_BASE_POSE_SOLVER_H_
+#define STEREO_EGOMOTION_BASE_POSE_SOLVER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Cholesky>
+#include <Eigen/Geometry>
+
+namespace egomotion
+{
+
+// Robust losses of optim::CeresHelper::CreateLoss with the same names and definitions,
+// rho(s) of the squared norm s of a point's 4 residuals with the scale a.
+enum class RobustLoss { kSquared, kHuber, kCauchy, kSoftLOne };
+
+inline RobustLoss GetRobustLoss(const std::string& loss_type) {
+  if (loss_type == "Cauchy")
+    return RobustLoss::kCauchy;
+  else if (loss_type == "Huber")
+    return RobustLoss::kHuber;
+  else if (loss_type == "SoftLOneLoss")
+    return RobustLoss::kSoftLOne;
+  else if (loss_type != "Squared")
+    std::cout << "Unknown loss type: " << loss_type << " - defaulting to Squared loss.\n";
+  return RobustLoss::kSquared;
+}
+
+// Levenberg-Marquardt refinement of the 6-DoF stereo motion (previous to current frame)
+// from triangulated points of the previous frame and their observations in the current
+// stereo pair. It minimizes the same cost as EgomotionSolver without Ceres: the rotation is
+// updated on the left with exp(w) R and the translation additively, J^T J and J^T r are
+// summed over the points in fixed-size 6x6 and 6x1 matrices, so a solve does no allocation.
+// Robust losses use the iteratively reweighted form with rho'(s) as the point weight.
+// Points are kept across Clear() calls, a solver reused between frames or RANSAC iterations
+// does not reallocate either.
+template<typename T>
+class StereoPoseSolver {
+ public:
+  typedef Eigen::Matrix<T,3,1> Vector3;
+  typedef Eigen::Matrix<T,6,1> Vector6;
+  typedef Eigen::Matrix<T,3,3> Matrix3;
+  typedef Eigen::Matrix<T,6,6> Matrix6;
+  typedef Eigen::Matrix<T,4,4> Matrix4;
+
+  struct Options {
+    int max_iterations = 20;
+    // converged once no parameter changes more than this in a step
+    T parameter_tolerance = T(1e-8);
+    // or once a step lowers the cost by less than this fraction
+    T function_tolerance = T(1e-12);
+    T initial_lambda = T(1e-4);
+  };
+
+  StereoPoseSolver(T f, T cu, T cv, T base, RobustLoss loss = RobustLoss::kSquared,
+                   T loss_scale = T(1))
+      : f_(f), cu_(cu), cv_(cv), base_(base), loss_(loss),
+        loss_b_(loss_scale * loss_scale) {}
+
+  void Reserve(int n) { points_.reserve(n); }
+  void Clear() { points_.clear(); }
+  int size() const { return points_.size(); }
+
+  // The residuals of a point are weight * (projection - observation).
+  void AddPoint(T x, T y, T z, T u_left, T v_left, T u_right, T v_right, T weight = T(1)) {
+    points_.push_back({ { x, y, z, u_left, v_left, u_right, v_right, weight } });
+  }
+
+  // Refines Rt in place starting from its current value. Returns false if the normal
+  // equations were degenerate or the cost not finite, converged() tells if the tolerances
+  // were reached within max_iterations.
+  bool Solve(const Options& options, Matrix4& Rt);
+
+  bool converged() const { return converged_; }
+  int iterations() const { return iterations_; }
+  // 1/2 sum rho(s) at the solution
+  T final_cost() const { return final_cost_; }
+
+ private:
+  struct Point {
+    // x, y, z, left u, left v, right u, right v, weight
+    T d[8];
+  };
+
+  // residuals of point p transformed to the current frame as pc
+  void Residuals(const Point& p, const Vector3& pc, T* res) const {
+    const T iz = T(1) / pc[2];
+    const T w = p.d[7];
+    res[0] = w * (f_ * pc[0] * iz + cu_ - p.d[3]);
+    res[1] = w * (f_ * pc[1] * iz + cv_ - p.d[4]);
+    res[2] = w * (f_ * (pc[0] - base_) * iz + cu_ - p.d[5]);
+    res[3] = w * (f_ * pc[1] * iz + cv_ - p.d[6]);
+  }
+  // rho(s) and rho'(s)
+  void Loss(T s, T& rho, T& rho1) const;
+  T Cost(const Matrix3& R, const Vector3& t) const;
+  // returns the cost and sets the normal equations at (R, t)
+  T Linearize(const Matrix3& R, const Vector3& t, Matrix6& H, Vector6& g) const;
+
+  const T f_, cu_, cv_, base_;
+  const RobustLoss loss_;
+  // squared loss scale
+  const T loss_b_;
+  std::vector<Point> points_;
+  bool converged_ = false;
+  int iterations_ = 0;
+  T final_cost_ = T(0);
+};
+
+template<typename T>
+inline void StereoPoseSolver<T>::Loss(T s, T& rho, T& rho1) const {
+  switch (loss_) {
+    case RobustLoss::kHuber:
+      if (s > loss_b_) {
+        const T r = std::sqrt(s);
+        rho = T(2) * r * std::sqrt(loss_b_) - loss_b_;
+        rho1 = std::sqrt(loss_b_) / r;
+      }
+      else {
+        rho = s;
+        rho1 = T(1);
+      }
+      break;
+    case RobustLoss::kCauchy:
+      rho = loss_b_ * std::log1p(s / loss_b_);
+      rho1 = T(1) / (T(1) + s / loss_b_);
+      break;
+    case RobustLoss::kSoftLOne: {
+      const T r = std::sqrt(T(1) + s / loss_b_);
+      rho = T(2) * loss_b_ * (r - T(1));
+      rho1 = T(1) / r;
+      break;
+    }
+    default:
+      rho = s;
+      rho1 = T(1);
+  }
+}
+
+template<typename T>
+T StereoPoseSolver<T>::Cost(const Matrix3& R, const Vector3& t) const {
+  T cost = T(0);
+  T res[4], rho, rho1;
+  for (const Point& p : points_) {
+    const Vector3 pc = R * Vector3(p.d[0], p.d[1], p.d[2]) + t;
+    Residuals(p, pc, res);
+    Loss(res[0]*res[0] + res[1]*res[1] + res[2]*res[2] + res[3]*res[3], rho, rho1);
+    cost += rho;
+  }
+  return T(0.5) * cost;
+}
+
+template<typename T>
+T StereoPoseSolver<T>::Linearize(const Matrix3& R, const Vector3& t, Matrix6& H,
+                                 Vector6& g) const {
+  H.setZero();
+  g.setZero();
+  T cost = T(0);
+  T res[4], rho, rho1;
+  Eigen::Matrix<T,4,6> J;
+  for (const Point& p : points_) {
+    const Vector3 rp = R * Vector3(p.d[0], p.d[1], p.d[2]);
+    const Vector3 pc = rp + t;
+    Residuals(p, pc, res);
+    Loss(res[0]*res[0] + res[1]*res[1] + res[2]*res[2] + res[3]*res[3], rho, rho1);
+    cost += rho;
+    // derivative of the projection wrt pc, then d pc / d(w, t) = [-[rp]_x | I]
+    const T iz = T(1) / pc[2];
+    const T wf = p.d[7] * f_ * iz;
+    const T dl = -wf * pc[0] * iz;
+    const T dr = -wf * (pc[0] - base_) * iz;
+    const T dv = -wf * pc[1] * iz;
+    const T jx[4][3] = { { wf, T(0), dl }, { T(0), wf, dv }, { wf, T(0), dr }, { T(0), wf, dv } };
+    for (int r = 0; r < 4; r++) {
+      J(r,0) = jx[r][2] * rp[1] - jx[r][1] * rp[2];
+      J(r,1) = jx[r][0] * rp[2] - jx[r][2] * rp[0];
+      J(r,2) = jx[r][1] * rp[0] - jx[r][0] * rp[1];
+      J(r,3) = jx[r][0];
+      J(r,4) = jx[r][1];
+      J(r,5) = jx[r][2];
+    }
+    const Eigen::Map<const Eigen::Matrix<T,4,1>> residuals(res);
+    H.noalias() += rho1 * (J.transpose() * J);
+    g.noalias() += rho1 * (J.transpose() * residuals);
+  }
+  return T(0.5) * cost;
+}
+
+template<typename T>
+bool StereoPoseSolver<T>::Solve(const Options& options, Matrix4& Rt) {
+  converged_ = false;
+  iterations_ = 0;
+  if (points_.size() < 3)
+    return false;
+  Matrix3 R = Rt.template block<3,3>(0,0);
+  Vector3 t = Rt.template block<3,1>(0,3);
+  Matrix6 H;
+  Vector6 g;
+  T cost = Linearize(R, t, H, g);
+  if (!std::isfinite(cost))
+    return false;
+  T lambda = options.initial_lambda;
+  while (iterations_ < options.max_iterations) {
+    iterations_++;
+    Matrix6 A = H;
+    A.diagonal() *= T(1) + lambda;
+    Eigen::LDLT<Matrix6> ldlt(A);
+    if (ldlt.info() != Eigen::Success)
+      return false;
+    const Vector6 step = -ldlt.solve(g);
+    if (!step.allFinite())
+      return false;
+    const bool small_step = step.template lpNorm<Eigen::Infinity>() <= options.parameter_tolerance;
+    const Vector3 w = step.template head<3>();
+    const T angle = w.norm();
+    Matrix3 R_new = R;
+    if (angle > T(0))
+      R_new = Eigen::AngleAxis<T>(angle, w / angle).toRotationMatrix() * R;
+    const Vector3 t_new = t + step.template tail<3>();
+    const T new_cost = Cost(R_new, t_new);
+    if (std::isfinite(new_cost) && new_cost < cost) {
+      const T decrease = (cost - new_cost) / cost;
+      R = R_new;
+      t = t_new;
+      cost = Linearize(R, t, H, g);
+      lambda = std::max(lambda / T(10), T(1e-12));
+      if (small_step || decrease <= options.function_tolerance) {
+        converged_ = true;
+        break;
+      }
+    }
+    else {
+      // a step this small that does not lower the cost means we are at the minimum
+      if (small_step) {
+        converged_ = true;
+        break;
+      }
+      lambda *= T(10);
+      if (lambda > T(1e12))
+        break;
+    }
+  }
+  final_cost_ = cost;
+  Rt.setIdentity();
+  Rt.template block<3,3>(0,0) = R;
+  Rt.template block<3,1>(0,3) = t;
+  return true;
+}
+
+}
+
+#endif  // STEREO_EGOMOTION_BASE_POSE_SOLVER_H_
@@ -278,6 +278,8 @@ void RunEgomotionExperiment(const std::string& source_folder,
       for (size_t j = 0; j < outliers.size(); j++)
         stereo_tracker->removeTrack(outliers[j]);
       std::cout << "Tracks after RANSAC: " << stereo_tracker->countActiveTracks() << "\n";
+      // constant velocity prior for the next frame, trackers without a prior window ignore it
+      stereo_tracker->SetMotionPrior(track::MotionPrior(Rt, cam_params));
       ////track::FeatureInfo data = stereo_tracker->featureLeft(54);
       ////std::cout << "After filtering Age = " << data.age_ << "\n";
 
@@ -0,0 +1,259 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <random>
+
+#include "../base/cost_functions.h"
+#include "../../optimization/bundle_adjustment/bundle_adjustment_solver.h"
+
+using optim::ReprojErrorStereo;
+using optim::ReprojErrorStereoAnalytic;
+
+namespace {
+
+const double kCamParams[] = { 718.856, 718.856, 607.1928, 185.2157, 0.5372 };
+
+// Evaluates both cost functions at the same parameters and compares residuals and Jacobians.
+void ExpectSameCost(const ceres::CostFunction& analytic, const ceres::CostFunction& autodiff,
+                    const std::vector<std::vector<double>>& params)
+{
+  ASSERT_EQ(analytic.num_residuals(), autodiff.num_residuals());
+  ASSERT_EQ(analytic.parameter_block_sizes(), autodiff.parameter_block_sizes());
+  const int num_residuals = analytic.num_residuals();
+  const std::vector<int32_t>& block_sizes = analytic.parameter_block_sizes();
+  std::vector<const double*> param_ptrs;
+  for (const auto& p : params)
+    param_ptrs.push_back(p.data());
+
+  std::vector<double> res1(num_residuals), res2(num_residuals);
+  std::vector<std::vector<double>> jac1(block_sizes.size()), jac2(block_sizes.size());
+  std::vector<double*> jac1_ptrs, jac2_ptrs;
+  for (size_t i = 0; i < block_sizes.size(); i++) {
+    jac1[i].resize(num_residuals * block_sizes[i]);
+    jac2[i].resize(num_residuals * block_sizes[i]);
+    jac1_ptrs.push_back(jac1[i].data());
+    jac2_ptrs.push_back(jac2[i].data());
+  }
+  ASSERT_TRUE(analytic.Evaluate(param_ptrs.data(), res1.data(), jac1_ptrs.data()));
+  ASSERT_TRUE(autodiff.Evaluate(param_ptrs.data(), res2.data(), jac2_ptrs.data()));
+  for (int i = 0; i < num_residuals; i++)
+    EXPECT_NEAR(res1[i], res2[i], 1e-9);
+  for (size_t b = 0; b < block_sizes.size(); b++)
+    for (size_t i = 0; i < jac1[b].size(); i++)
+      EXPECT_NEAR(jac1[b][i], jac2[b][i], 1e-7 * std::max(1.0, std::fabs(jac2[b][i])));
+}
+
+class CostFunctionsTest : public ::testing::Test
+{
+ protected:
+  CostFunctionsTest() : rng_(42), udist_(-1.0, 1.0) {}
+
+  std::vector<double> RandomQuaternion() {
+    Eigen::Vector4d q(1.0, 0.1 * udist_(rng_), 0.1 * udist_(rng_), 0.1 * udist_(rng_));
+    q.normalize();
+    return { q[0], q[1], q[2], q[3] };
+  }
+  std::vector<double> RandomTranslation() {
+    return { 0.1 * udist_(rng_), 0.1 * udist_(rng_), udist_(rng_) };
+  }
+  void RandomObservation(Eigen::Vector3d& pt3d, core::Point& left, core::Point& right) {
+    pt3d << 5.0 * udist_(rng_), 2.0 * udist_(rng_), 15.0 + 5.0 * udist_(rng_);
+    left.x_ = kCamParams[2] + 300.0 * udist_(rng_);
+    left.y_ = kCamParams[3] + 100.0 * udist_(rng_);
+    right.x_ = left.x_ - 20.0;
+    right.y_ = left.y_;
+  }
+
+  std::mt19937 rng_;
+  std::uniform_real_distribution<double> udist_;
+};
+
+TEST_F(CostFunctionsTest, EgomotionAnalyticMatchesAutoDiff)
+{
+  for (int t = 0; t < 50; t++) {
+    Eigen::Vector3d pt3d;
+    core::Point left, right;
+    RandomObservation(pt3d, left, right);
+    std::vector<std::vector<double>> params = { RandomQuaternion(), RandomTranslation() };
+
+    std::unique_ptr<ceres::CostFunction> autodiff(
+        ReprojectionErrorWithQuaternion::Create(pt3d, left, right, kCamParams));
+    ReprojectionErrorAnalytic analytic(pt3d, left, right, kCamParams, 1.0);
+    ExpectSameCost(analytic, *autodiff, params);
+
+    std::unique_ptr<ceres::CostFunction> weighted_autodiff(
+        WeightedReprojectionError::Create(pt3d, left, right, kCamParams));
+    ReprojectionErrorAnalytic weighted(pt3d, left, right, kCamParams,
+                                       GetReprojectionWeight(left, kCamParams));
+    ExpectSameCost(weighted, *weighted_autodiff, params);
+  }
+}
+
+TEST_F(CostFunctionsTest, EgomotionBatchMatchesSingleBlocks)
+{
+  const int num_pts = 20;
+  std::vector<Eigen::Vector3d> pts3d(num_pts);
+  std::vector<core::Point> left(num_pts), right(num_pts);
+  for (int i = 0; i < num_pts; i++)
+    RandomObservation(pts3d[i], left[i], right[i]);
+  std::vector<double> rot = RandomQuaternion();
+  std::vector<double> trans = RandomTranslation();
+  const double* params[] = { rot.data(), trans.data() };
+
+  ReprojectionErrorBatch batch(pts3d, left, right, kCamParams, true);
+  ASSERT_EQ(batch.num_residuals(), 4 * num_pts);
+  std::vector<double> res(4 * num_pts), jac_rot(16 * num_pts), jac_trans(12 * num_pts);
+  double* jacobians[] = { jac_rot.data(), jac_trans.data() };
+  ASSERT_TRUE(batch.Evaluate(params, res.data(), jacobians));
+  for (int i = 0; i < num_pts; i++) {
+    ReprojectionErrorAnalytic single(pts3d[i], left[i], right[i], kCamParams,
+                                     GetReprojectionWeight(left[i], kCamParams));
+    double res1[4], jac_rot1[16], jac_trans1[12];
+    double* jacobians1[] = { jac_rot1, jac_trans1 };
+    ASSERT_TRUE(single.Evaluate(params, res1, jacobians1));
+    for (int j = 0; j < 4; j++)
+      EXPECT_DOUBLE_EQ(res[4*i + j], res1[j]);
+    for (int j = 0; j < 16; j++)
+      EXPECT_DOUBLE_EQ(jac_rot[16*i + j], jac_rot1[j]);
+    for (int j = 0; j < 12; j++)
+      EXPECT_DOUBLE_EQ(jac_trans[12*i + j], jac_trans1[j]);
+  }
+}
+
+TEST_F(CostFunctionsTest, EgomotionBlocksRefilledInPlace)
+{
+  const int num_pts = 10;
+  std::vector<Eigen::Vector3d> pts3d(num_pts);
+  std::vector<core::Point> left(num_pts), right(num_pts);
+  for (int i = 0; i < num_pts; i++)
+    RandomObservation(pts3d[i], left[i], right[i]);
+  std::vector<double> rot = RandomQuaternion();
+  std::vector<double> trans = RandomTranslation();
+  const double* params[] = { rot.data(), trans.data() };
+
+  // a batch with spare capacity matches the exact size one and has zero rows after it
+  const int capacity = 16;
+  ReprojectionErrorBatch exact(pts3d, left, right, kCamParams, true);
+  ReprojectionErrorBatch reused(capacity, kCamParams);
+  ASSERT_EQ(reused.num_residuals(), 4 * capacity);
+  reused.SetPoints(pts3d, left, right, true);
+  std::vector<double> res1(4 * num_pts), jac_rot1(16 * num_pts), jac_trans1(12 * num_pts);
+  std::vector<double> res2(4 * capacity, 1.0), jac_rot2(16 * capacity, 1.0),
+                      jac_trans2(12 * capacity, 1.0);
+  double* jacobians1[] = { jac_rot1.data(), jac_trans1.data() };
+  double* jacobians2[] = { jac_rot2.data(), jac_trans2.data() };
+  ASSERT_TRUE(exact.Evaluate(params, res1.data(), jacobians1));
+  ASSERT_TRUE(reused.Evaluate(params, res2.data(), jacobians2));
+  for (int i = 0; i < 4 * capacity; i++)
+    EXPECT_DOUBLE_EQ(res2[i], i < 4 * num_pts ? res1[i] : 0.0);
+  for (int i = 0; i < 16 * capacity; i++)
+    EXPECT_DOUBLE_EQ(jac_rot2[i], i < 16 * num_pts ? jac_rot1[i] : 0.0);
+  for (int i = 0; i < 12 * capacity; i++)
+    EXPECT_DOUBLE_EQ(jac_trans2[i], i < 12 * num_pts ? jac_trans1[i] : 0.0);
+
+  // a single block moved to another observation and then switched off
+  ReprojectionErrorAnalytic single(pts3d[0], left[0], right[0], kCamParams, 1.0);
+  single.SetObservation(pts3d[1], left[1], right[1], 1.0);
+  ReprojectionErrorAnalytic expected(pts3d[1], left[1], right[1], kCamParams, 1.0);
+  std::vector<std::vector<double>> block_params = { rot, trans };
+  ExpectSameCost(single, expected, block_params);
+  single.SwitchOff();
+  EXPECT_FALSE(single.active());
+  double res[4], jac_rot[16], jac_trans[12];
+  double* jacobians[] = { jac_rot, jac_trans };
+  ASSERT_TRUE(single.Evaluate(params, res, jacobians));
+  for (int j = 0; j < 4; j++)
+    EXPECT_EQ(res[j], 0.0);
+  for (int j = 0; j < 12; j++)
+    EXPECT_EQ(jac_trans[j], 0.0);
+}
+
+TEST_F(CostFunctionsTest, BundleAdjustmentAnalyticMatchesAutoDiff)
+{
+  Eigen::VectorXd cam_intr(5);
+  for (int i = 0; i < 5; i++)
+    cam_intr[i] = kCamParams[i];
+  for (int t = 0; t < 20; t++) {
+    for (int use_weighting = 0; use_weighting < 2; use_weighting++) {
+      Eigen::Vector3d pt;
+      core::Point left, right;
+      RandomObservation(pt, left, right);
+      Eigen::Vector4d pt3d(pt[0], pt[1], pt[2], 1.0);
+      std::vector<std::vector<double>> params;
+      for (int num_poses = 1; num_poses <= 2; num_poses++) {
+        params.push_back(RandomTranslation());
+        params.push_back(RandomQuaternion());
+        ReprojErrorStereoAnalytic analytic(pt3d, left, right, cam_intr, use_weighting, num_poses);
+        ReprojErrorStereo* functor = new ReprojErrorStereo(pt3d, left, right, cam_intr,
+                                                           use_weighting);
+        std::unique_ptr<ceres::CostFunction> autodiff;
+        if (num_poses == 1)
+          autodiff.reset(new ceres::AutoDiffCostFunction<ReprojErrorStereo,4,3,4>(functor));
+        else
+          autodiff.reset(new ceres::AutoDiffCostFunction<ReprojErrorStereo,4,3,4,3,4>(functor));
+        ExpectSameCost(analytic, *autodiff, params);
+      }
+    }
+  }
+}
+
+// The absolute poses of a long window give the same residuals as chaining the relative motions
+// between the triangulation and the observing frame.
+TEST_F(CostFunctionsTest, BundleAdjustmentPosesMatchChainedMotions)
+{
+  Eigen::VectorXd cam_intr(5);
+  for (int i = 0; i < 5; i++)
+    cam_intr[i] = kCamParams[i];
+  const int num_motions = 15;
+  std::vector<Eigen::Matrix4d> poses(num_motions + 1, Eigen::Matrix4d::Identity());
+  std::vector<Eigen::Matrix4d> motions(num_motions, Eigen::Matrix4d::Identity());
+  std::vector<std::vector<double>> trans(num_motions + 1), rot(num_motions + 1);
+  for (int k = 0; k < num_motions; k++) {
+    std::vector<double> q = RandomQuaternion();
+    std::vector<double> tr = RandomTranslation();
+    motions[k].block<3,3>(0,0) = Eigen::Quaterniond(q[0], q[1], q[2], q[3]).toRotationMatrix();
+    motions[k].block<3,1>(0,3) = Eigen::Vector3d(tr[0], tr[1], tr[2]);
+    poses[k+1] = motions[k] * poses[k];
+    Eigen::Quaterniond pose_q(Eigen::Matrix3d(poses[k+1].block<3,3>(0,0)));
+    rot[k+1] = { pose_q.w(), pose_q.x(), pose_q.y(), pose_q.z() };
+    trans[k+1] = { poses[k+1](0,3), poses[k+1](1,3), poses[k+1](2,3) };
+  }
+  for (int use_weighting = 0; use_weighting < 2; use_weighting++) {
+    for (int first = 0; first < num_motions; first += 4) {
+      for (int last = first + 1; last <= num_motions; last++) {
+        Eigen::Vector3d pt;
+        core::Point left, right;
+        RandomObservation(pt, left, right);
+        Eigen::Vector4d pt3d(pt[0], pt[1], pt[2], 1.0);
+        Eigen::Vector4d pt_last = pt3d;
+        for (int k = first; k < last; k++)
+          pt_last = motions[k] * pt_last;
+        double expected[4];
+        ReprojErrorStereoAnalytic reference(pt_last, left, right, cam_intr, use_weighting, 1);
+        const double zero_trans[3] = { 0.0, 0.0, 0.0 }, unit_rot[4] = { 1.0, 0.0, 0.0, 0.0 };
+        const double* identity[] = { zero_trans, unit_rot };
+        ASSERT_TRUE(reference.Evaluate(identity, expected, nullptr));
+
+        int num_poses = first > 0 ? 2 : 1;
+        ReprojErrorStereoAnalytic cost(pt3d, left, right, cam_intr, use_weighting, num_poses);
+        std::vector<const double*> params;
+        if (first > 0) {
+          params.push_back(trans[first].data());
+          params.push_back(rot[first].data());
+        }
+        params.push_back(trans[last].data());
+        params.push_back(rot[last].data());
+        double res[4];
+        ASSERT_TRUE(cost.Evaluate(params.data(), res, nullptr));
+        for (int i = 0; i < 4; i++)
+          EXPECT_NEAR(res[i], expected[i], 1e-6 * std::max(1.0, std::fabs(expected[i])));
+      }
+    }
+  }
+}
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
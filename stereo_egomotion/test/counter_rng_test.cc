@@ -0,0 +1,71 @@
+#include <gtest/gtest.h>
+
+#include "../base/counter_rng.h"
+
+using egomotion::Philox4x32;
+
+namespace {
+
+// known answers of the Random123 reference implementation
+TEST(CounterRngTest, PhiloxKnownAnswers)
+{
+  const uint32_t zero_ctr[4] = { 0, 0, 0, 0 };
+  const uint32_t zero_key[2] = { 0, 0 };
+  const uint32_t zero_out[4] = { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 };
+  const uint32_t ones_ctr[4] = { ~0u, ~0u, ~0u, ~0u };
+  const uint32_t ones_key[2] = { ~0u, ~0u };
+  const uint32_t ones_out[4] = { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd };
+  const uint32_t pi_ctr[4] = { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 };
+  const uint32_t pi_key[2] = { 0xa4093822, 0x299f31d0 };
+  const uint32_t pi_out[4] = { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 };
+  uint32_t out[4];
+  Philox4x32::Block(zero_ctr, zero_key, out);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(out[i], zero_out[i]);
+  Philox4x32::Block(ones_ctr, ones_key, out);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(out[i], ones_out[i]);
+  Philox4x32::Block(pi_ctr, pi_key, out);
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(out[i], pi_out[i]);
+}
+
+TEST(CounterRngTest, StreamsDependOnlyOnTheKey)
+{
+  Philox4x32 a(7, 3, 11), b(7, 3, 11), c(7, 3, 12), d(7, 4, 11);
+  bool differs_iter = false, differs_frame = false;
+  for (int i = 0; i < 16; i++) {
+    uint32_t va = a(), vc = c(), vd = d();
+    EXPECT_EQ(va, b());
+    differs_iter |= va != vc;
+    differs_frame |= va != vd;
+  }
+  EXPECT_TRUE(differs_iter);
+  EXPECT_TRUE(differs_frame);
+}
+
+TEST(CounterRngTest, SamplesAreDistinctAndUniform)
+{
+  const int n = 5;
+  int counts[n] = { 0 };
+  for (int iter = 0; iter < 50000; iter++) {
+    Philox4x32 rng(1, 0, iter);
+    int sample[3];
+    egomotion::SampleThree(rng, n, sample);
+    for (int j = 0; j < 3; j++) {
+      ASSERT_TRUE(sample[j] >= 0 && sample[j] < n);
+      counts[sample[j]]++;
+    }
+    EXPECT_TRUE(sample[0] != sample[1] && sample[0] != sample[2] && sample[1] != sample[2]);
+  }
+  // each index is in 3/5 of the samples
+  for (int i = 0; i < n; i++)
+    EXPECT_NEAR(counts[i] / 50000.0, 0.6, 0.01);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
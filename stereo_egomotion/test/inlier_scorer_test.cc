@@ -0,0 +1,60 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "../base/inlier_scorer.h"
+
+using egomotion::InlierScorer;
+
+namespace {
+
+// Count over single points only runs the scalar code, over the whole range the vector
+// code, so both must classify every point the same even right at the threshold.
+TEST(InlierScorerTest, VectorAndScalarPathsAgree)
+{
+  const double f = 718.856, cu = 607.193, cv = 185.216, base = 0.537, thr = 1.5;
+  const int n = 1003;
+  Eigen::Matrix4d Rt = Eigen::Matrix4d::Identity();
+  const double angle = 0.02;
+  Rt(0,0) = std::cos(angle); Rt(0,2) = std::sin(angle);
+  Rt(2,0) = -std::sin(angle); Rt(2,2) = std::cos(angle);
+  Rt(0,3) = 0.05; Rt(1,3) = -0.01; Rt(2,3) = -0.9;
+
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<double> xy(-10.0, 10.0), depth(4.0, 40.0), dir(-1.0, 1.0);
+  InlierScorer scorer(f, cu, cv, base, thr);
+  scorer.Resize(n);
+  for (int i = 0; i < n; i++) {
+    double x = xy(rng), y = 0.2 * xy(rng), z = depth(rng);
+    double xc = Rt(0,0)*x + Rt(0,1)*y + Rt(0,2)*z + Rt(0,3);
+    double yc = Rt(1,0)*x + Rt(1,1)*y + Rt(1,2)*z + Rt(1,3);
+    double zc = Rt(2,0)*x + Rt(2,1)*y + Rt(2,2)*z + Rt(2,3);
+    // the reprojection error is spread over three coordinates and lies within a few ulps
+    // of the threshold, where a fused multiply-add in only one path flips the result
+    double err = thr * (1.0 + 1e-15 * dir(rng));
+    scorer.SetPoint(i, x, y, z, f*xc/zc + cu + 0.8*err, f*yc/zc + cv + 0.48*err,
+                    f*(xc - base)/zc + cu - 0.36*err, f*yc/zc + cv);
+  }
+
+  std::vector<uint64_t> mask(scorer.mask_words(), 0);
+  int count = scorer.Score(Rt, &mask[0]);
+  int scalar_count = 0;
+  for (int i = 0; i < n; i++) {
+    int inlier = scorer.Count(Rt, i, i + 1);
+    EXPECT_EQ(inlier, static_cast<int>((mask[i / 64] >> (i % 64)) & 1));
+    scalar_count += inlier;
+  }
+  EXPECT_EQ(count, scalar_count);
+  EXPECT_EQ(count, scorer.Count(Rt, 0, n));
+  EXPECT_GT(count, 0);
+  EXPECT_LT(count, n);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
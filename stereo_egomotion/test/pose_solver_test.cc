@@ -0,0 +1,111 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include <Eigen/Geometry>
+
+#include "../base/pose_solver.h"
+
+using egomotion::RobustLoss;
+using egomotion::StereoPoseSolver;
+
+namespace {
+
+const double kF = 718.856, kCu = 607.1928, kCv = 185.2157, kBase = 0.5372;
+
+class PoseSolverTest : public ::testing::Test
+{
+ protected:
+  PoseSolverTest() : rng_(42), udist_(-1.0, 1.0) {
+    Eigen::Vector3d axis(udist_(rng_), udist_(rng_), udist_(rng_));
+    Eigen::AngleAxisd rot(0.05, axis.normalized());
+    motion_.setIdentity();
+    motion_.block<3,3>(0,0) = rot.toRotationMatrix();
+    motion_.block<3,1>(0,3) << 0.05, -0.02, 0.9;
+  }
+
+  // Adds num_pts points seen under motion_, the observations of every outlier_step-th point
+  // are moved by 30 pixels.
+  template<typename T>
+  void AddPoints(StereoPoseSolver<T>& solver, int num_pts, int outlier_step = 0) {
+    for (int i = 0; i < num_pts; i++) {
+      Eigen::Vector3d pt(8.0 * udist_(rng_), 2.0 * udist_(rng_), 20.0 + 10.0 * udist_(rng_));
+      Eigen::Vector3d pc = motion_.block<3,3>(0,0) * pt + motion_.block<3,1>(0,3);
+      double ul = kF * pc[0] / pc[2] + kCu;
+      double v = kF * pc[1] / pc[2] + kCv;
+      double ur = kF * (pc[0] - kBase) / pc[2] + kCu;
+      if (outlier_step > 0 && i % outlier_step == 0) {
+        ul += 30.0;
+        ur += 30.0;
+      }
+      solver.AddPoint(pt[0], pt[1], pt[2], ul, v, ur, v);
+    }
+  }
+
+  std::mt19937 rng_;
+  std::uniform_real_distribution<double> udist_;
+  Eigen::Matrix4d motion_;
+};
+
+TEST_F(PoseSolverTest, RecoversMotionFromIdentity)
+{
+  StereoPoseSolver<double> solver(kF, kCu, kCv, kBase);
+  AddPoints(solver, 50);
+  StereoPoseSolver<double>::Options options;
+  Eigen::Matrix4d Rt = Eigen::Matrix4d::Identity();
+  ASSERT_TRUE(solver.Solve(options, Rt));
+  EXPECT_TRUE(solver.converged());
+  EXPECT_LT((Rt - motion_).norm(), 1e-8);
+  EXPECT_LT(solver.final_cost(), 1e-12);
+
+  // three points are enough for the minimal RANSAC sample
+  solver.Clear();
+  AddPoints(solver, 3);
+  Rt.setIdentity();
+  ASSERT_TRUE(solver.Solve(options, Rt));
+  EXPECT_LT((Rt - motion_).norm(), 1e-6);
+}
+
+TEST_F(PoseSolverTest, SinglePrecision)
+{
+  StereoPoseSolver<float> solver(kF, kCu, kCv, kBase);
+  AddPoints(solver, 50);
+  StereoPoseSolver<float>::Options options;
+  options.parameter_tolerance = 1e-5f;
+  options.function_tolerance = 1e-6f;
+  Eigen::Matrix4f Rt = Eigen::Matrix4f::Identity();
+  ASSERT_TRUE(solver.Solve(options, Rt));
+  EXPECT_LT((Rt.cast<double>() - motion_).norm(), 1e-3);
+}
+
+TEST_F(PoseSolverTest, RobustLossDownweightsOutliers)
+{
+  StereoPoseSolver<double> squared(kF, kCu, kCv, kBase, RobustLoss::kSquared);
+  StereoPoseSolver<double> cauchy(kF, kCu, kCv, kBase, RobustLoss::kCauchy, 1.0);
+  std::mt19937 rng = rng_;
+  AddPoints(squared, 100, 10);
+  rng_ = rng;
+  AddPoints(cauchy, 100, 10);
+  StereoPoseSolver<double>::Options options;
+  options.max_iterations = 50;
+  Eigen::Matrix4d Rt_squared = Eigen::Matrix4d::Identity();
+  Eigen::Matrix4d Rt_cauchy = Eigen::Matrix4d::Identity();
+  ASSERT_TRUE(squared.Solve(options, Rt_squared));
+  ASSERT_TRUE(cauchy.Solve(options, Rt_cauchy));
+  EXPECT_LT((Rt_cauchy - motion_).norm(), 0.1 * (Rt_squared - motion_).norm());
+}
+
+TEST(RobustLossTest, NamesOfCeresHelper)
+{
+  EXPECT_TRUE(egomotion::GetRobustLoss("Squared") == RobustLoss::kSquared);
+  EXPECT_TRUE(egomotion::GetRobustLoss("Huber") == RobustLoss::kHuber);
+  EXPECT_TRUE(egomotion::GetRobustLoss("Cauchy") == RobustLoss::kCauchy);
+  EXPECT_TRUE(egomotion::GetRobustLoss("SoftLOneLoss") == RobustLoss::kSoftLOne);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
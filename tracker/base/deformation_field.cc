@@ -0,0 +1,167 @@
+#include "deformation_field.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+namespace track {
+
+namespace {
+
+// linear position of the image coordinate pos between the centers of cells of size cell_size,
+// clamped to the first and the last of num_cells centers
+void GetCellPosition(double pos, double cell_size, int num_cells, int& cell, double& frac)
+{
+  double c = (pos - cell_size / 2.0) / cell_size;
+  c = std::max(0.0, std::min(c, static_cast<double>(num_cells - 1)));
+  cell = std::min(static_cast<int>(c), std::max(num_cells - 2, 0));
+  frac = c - cell;
+}
+
+#ifdef __AVX2__
+// bilinear lookup of 8 points at once, the same arithmetic as DeformationField::Get
+inline void Lookup8(const float* dx_table, const float* dy_table, int rows, int cols,
+                    __m256 x, __m256 y, __m256& dx, __m256& dy)
+{
+  const __m256 zero = _mm256_setzero_ps();
+  // max_ps returns its second operand for NaN lanes, like the ternaries of Get
+  x = _mm256_min_ps(_mm256_max_ps(x, zero), _mm256_set1_ps(cols - 1));
+  y = _mm256_min_ps(_mm256_max_ps(y, zero), _mm256_set1_ps(rows - 1));
+  const __m256 x0 = _mm256_min_ps(_mm256_floor_ps(x), _mm256_set1_ps(cols - 2));
+  const __m256 y0 = _mm256_min_ps(_mm256_floor_ps(y), _mm256_set1_ps(rows - 2));
+  const __m256 fx = _mm256_sub_ps(x, x0);
+  const __m256 fy = _mm256_sub_ps(y, y0);
+  const __m256i vcols = _mm256_set1_epi32(cols);
+  const __m256i one = _mm256_set1_epi32(1);
+  const __m256i i00 = _mm256_add_epi32(_mm256_mullo_epi32(_mm256_cvtps_epi32(y0), vcols),
+                                       _mm256_cvtps_epi32(x0));
+  const __m256i i01 = _mm256_add_epi32(i00, one);
+  const __m256i i10 = _mm256_add_epi32(i00, vcols);
+  const __m256i i11 = _mm256_add_epi32(i10, one);
+
+  __m256 q00 = _mm256_i32gather_ps(dx_table, i00, 4);
+  __m256 q01 = _mm256_i32gather_ps(dx_table, i01, 4);
+  __m256 q10 = _mm256_i32gather_ps(dx_table, i10, 4);
+  __m256 q11 = _mm256_i32gather_ps(dx_table, i11, 4);
+  __m256 top = _mm256_add_ps(q00, _mm256_mul_ps(fx, _mm256_sub_ps(q01, q00)));
+  __m256 bottom = _mm256_add_ps(q10, _mm256_mul_ps(fx, _mm256_sub_ps(q11, q10)));
+  dx = _mm256_add_ps(top, _mm256_mul_ps(fy, _mm256_sub_ps(bottom, top)));
+
+  q00 = _mm256_i32gather_ps(dy_table, i00, 4);
+  q01 = _mm256_i32gather_ps(dy_table, i01, 4);
+  q10 = _mm256_i32gather_ps(dy_table, i10, 4);
+  q11 = _mm256_i32gather_ps(dy_table, i11, 4);
+  top = _mm256_add_ps(q00, _mm256_mul_ps(fx, _mm256_sub_ps(q01, q00)));
+  bottom = _mm256_add_ps(q10, _mm256_mul_ps(fx, _mm256_sub_ps(q11, q10)));
+  dy = _mm256_add_ps(top, _mm256_mul_ps(fy, _mm256_sub_ps(bottom, top)));
+}
+
+// 8 strided doubles converted to float, out of range values become +-inf and are clamped
+inline __m256 GatherDoubles(const double* ptr, int stride)
+{
+  const __m128i offsets = _mm_setr_epi32(0, stride, 2*stride, 3*stride);
+  const __m128 lo = _mm256_cvtpd_ps(_mm256_i32gather_pd(ptr, offsets, 8));
+  const __m128 hi = _mm256_cvtpd_ps(_mm256_i32gather_pd(ptr + 4*stride, offsets, 8));
+  return _mm256_insertf128_ps(_mm256_castps128_ps256(lo), hi, 1);
+}
+#endif
+
+}
+
+DeformationField::DeformationField(const cv::Mat& def_x, const cv::Mat& def_y, int img_rows,
+                                   int img_cols) : rows_(img_rows), cols_(img_cols)
+{
+  assert(def_x.type() == CV_64F && def_y.type() == CV_64F);
+  assert(def_x.rows == def_y.rows && def_x.cols == def_y.cols);
+  assert(img_rows >= 2 && img_cols >= 2);
+  // the same cell size as DeformationFieldSolver
+  const double cell_width = static_cast<double>(img_cols) / def_x.cols;
+  const double cell_height = static_cast<double>(img_rows) / def_x.rows;
+  const int last_row = std::min(1, def_x.rows - 1);
+  const int last_col = std::min(1, def_x.cols - 1);
+  dx_.resize(rows_ * cols_);
+  dy_.resize(rows_ * cols_);
+  for (int r = 0; r < rows_; r++) {
+    int row;
+    double fy;
+    GetCellPosition(r, cell_height, def_x.rows, row, fy);
+    for (int c = 0; c < cols_; c++) {
+      int col;
+      double fx;
+      GetCellPosition(c, cell_width, def_x.cols, col, fx);
+      // last_row and last_col are 0 for a grid with a single row or column
+      const double w00 = (1.0 - fy) * (1.0 - fx), w01 = (1.0 - fy) * fx;
+      const double w10 = fy * (1.0 - fx), w11 = fy * fx;
+      dx_[r*cols_ + c] = w00 * def_x.at<double>(row, col) + w01 * def_x.at<double>(row, col + last_col)
+          + w10 * def_x.at<double>(row + last_row, col)
+          + w11 * def_x.at<double>(row + last_row, col + last_col);
+      dy_[r*cols_ + c] = w00 * def_y.at<double>(row, col) + w01 * def_y.at<double>(row, col + last_col)
+          + w10 * def_y.at<double>(row + last_row, col)
+          + w11 * def_y.at<double>(row + last_row, col + last_col);
+    }
+  }
+}
+
+void DeformationField::Apply(double* x, double* y, int stride, int n) const
+{
+  assert(!empty());
+  int i = 0;
+#ifdef __AVX2__
+  alignas(32) float dx[8], dy[8];
+  for (; i + 8 <= n; i += 8) {
+    double* px = x + i*stride;
+    double* py = y + i*stride;
+    __m256 vdx, vdy;
+    Lookup8(dx_.data(), dy_.data(), rows_, cols_, GatherDoubles(px, stride),
+            GatherDoubles(py, stride), vdx, vdy);
+    _mm256_store_ps(dx, vdx);
+    _mm256_store_ps(dy, vdy);
+    // AVX2 has no scatter
+    for (int k = 0; k < 8; k++) {
+      px[k*stride] += dx[k];
+      py[k*stride] += dy[k];
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    float dx, dy;
+    Get(x[i*stride], y[i*stride], dx, dy);
+    x[i*stride] += dx;
+    y[i*stride] += dy;
+  }
+}
+
+void DeformationField::Apply(float* x, float* y, int stride, int n) const
+{
+  assert(!empty());
+  int i = 0;
+#ifdef __AVX2__
+  alignas(32) float dx[8], dy[8];
+  const __m256i offsets = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+                                             _mm256_set1_epi32(stride));
+  for (; i + 8 <= n; i += 8) {
+    float* px = x + i*stride;
+    float* py = y + i*stride;
+    __m256 vdx, vdy;
+    Lookup8(dx_.data(), dy_.data(), rows_, cols_, _mm256_i32gather_ps(px, offsets, 4),
+            _mm256_i32gather_ps(py, offsets, 4), vdx, vdy);
+    _mm256_store_ps(dx, vdx);
+    _mm256_store_ps(dy, vdy);
+    for (int k = 0; k < 8; k++) {
+      px[k*stride] += dx[k];
+      py[k*stride] += dy[k];
+    }
+  }
+#endif
+  for (; i < n; i++) {
+    float dx, dy;
+    Get(x[i*stride], y[i*stride], dx, dy);
+    x[i*stride] += dx;
+    y[i*stride] += dy;
+  }
+}
+
+}
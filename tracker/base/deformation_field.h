@@ -0,0 +1,86 @@
+#ifndef TRACKER_BASE_DEFORMATION_FIELD_H_
+#define TRACKER_BASE_DEFORMATION_FIELD_H_
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+#include "../../core/types.h"
+
+namespace track {
+
+// Dense lookup table of a coarse deformation field (the left_dx, left_dy or right_dx, right_dy
+// grids of a DeformationFieldSolver calibration). The grid values belong to the cell centers and
+// are interpolated bilinearly between them, clamped to the outer centers so the field is linear
+// along the image border and constant in the corners. This is done once per pixel at load time
+// and stored as float, correcting a point is then a bilinear lookup in the table.
+class DeformationField {
+ public:
+  DeformationField() {}
+  // def_x and def_y are CV_64F grids of the same size covering an img_rows x img_cols image.
+  DeformationField(const cv::Mat& def_x, const cv::Mat& def_y, int img_rows, int img_cols);
+
+  bool empty() const { return dx_.empty(); }
+
+  // displacement at the point (x, y)
+  void Get(double x, double y, float& dx, float& dy) const;
+  // Adds the displacement to n points whose coordinates are x[i*stride] and y[i*stride],
+  // with AVX2 eight points per iteration.
+  void Apply(double* x, double* y, int stride, int n) const;
+  void Apply(float* x, float* y, int stride, int n) const;
+  void Apply(std::vector<core::Point>& pts) const {
+    if (!pts.empty())
+      Apply(&pts[0].x_, &pts[0].y_, sizeof(core::Point) / sizeof(double), pts.size());
+  }
+  void Apply(core::Point& pt) const {
+    float dx, dy;
+    Get(pt.x_, pt.y_, dx, dy);
+    pt.x_ += dx;
+    pt.y_ += dy;
+  }
+  // Inverse of Apply: finds the point which Apply maps to pt, by fixed point iteration on
+  // p = pt - d(p). The field is smooth and far from folding, so a few iterations are enough.
+  void ApplyInverse(core::Point& pt, int iters = 4) const {
+    const core::Point target = pt;
+    float dx, dy;
+    for (int k = 0; k < iters; k++) {
+      Get(pt.x_, pt.y_, dx, dy);
+      pt.x_ = target.x_ - dx;
+      pt.y_ = target.y_ - dy;
+    }
+  }
+
+ private:
+  int rows_ = 0, cols_ = 0;
+  // displacements of the pixels in row-major order
+  std::vector<float> dx_, dy_;
+};
+
+inline
+void DeformationField::Get(double x, double y, float& dx, float& dy) const
+{
+  assert(!empty());
+  // clamp in double so far away (or NaN) coordinates never overflow the float conversion
+  const double x_max = cols_ - 1, y_max = rows_ - 1;
+  x = x > 0.0 ? x : 0.0;
+  x = x < x_max ? x : x_max;
+  y = y > 0.0 ? y : 0.0;
+  y = y < y_max ? y : y_max;
+  const float xf = x, yf = y;
+  const int x0 = std::min(static_cast<int>(xf), cols_ - 2);
+  const int y0 = std::min(static_cast<int>(yf), rows_ - 2);
+  const float fx = xf - x0, fy = yf - y0;
+  const int idx = y0 * cols_ + x0;
+  float top = dx_[idx] + fx * (dx_[idx+1] - dx_[idx]);
+  float bottom = dx_[idx+cols_] + fx * (dx_[idx+cols_+1] - dx_[idx+cols_]);
+  dx = top + fy * (bottom - top);
+  top = dy_[idx] + fx * (dy_[idx+1] - dy_[idx]);
+  bottom = dy_[idx+cols_] + fx * (dy_[idx+cols_+1] - dy_[idx+cols_]);
+  dy = top + fy * (bottom - top);
+}
+
+}
+
+#endif  // TRACKER_BASE_DEFORMATION_FIELD_H_
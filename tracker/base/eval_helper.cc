@@ -16,6 +16,18 @@ using namespace cv;
 
 namespace {
 
+// points and age of track i from the batch view of a tracker
+void GetBatchTrack(const track::TrackBatch& batch, int i, track::FeatureInfo& left,
+                   track::FeatureInfo& right)
+{
+  left.prev_ = batch.leftPrev(i);
+  left.curr_ = batch.leftCurr(i);
+  left.age_ = batch.age[i];
+  right.prev_ = batch.rightPrev(i);
+  right.curr_ = batch.rightCurr(i);
+  right.age_ = batch.age[i];
+}
+
 double triangulateDepth(core::Point& left, core::Point& right, double f, double baseline)
 {
   double disp = left.x_ - right.x_;
@@ -82,10 +94,11 @@ bool EvalHelper::FilterOutliersWithGroundtruth(track::StereoTrackerBase& tracker
 
   std::vector<size_t> outliers;
   int active_tracks = 0;
-  for(int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo pt_left = tracker.featureLeft(i);
-    track::FeatureInfo pt_right = tracker.featureRight(i);
-    if(pt_left.age_ < 1) continue;
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for(int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    track::FeatureInfo pt_left, pt_right;
+    GetBatchTrack(batch, i, pt_left, pt_right);
 
     active_tracks++;
     GetStereoReprojErrors(pt_left.prev_, pt_right.prev_, pt_left.curr_, pt_right.curr_, Rt, cam_params,
@@ -189,10 +202,11 @@ void EvalHelper::SaveTrackerEvaluation(
   std::ofstream matching_file("errors_matching.txt", std::ios_base::app);
   std::ofstream disparity_file("errors_disparity.txt", std::ios_base::app);
 
-  for (int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo pt_left = tracker.featureLeft(i);
-    track::FeatureInfo pt_right = tracker.featureRight(i);
-    if (pt_left.age_ < 1) continue;
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for (int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    track::FeatureInfo pt_left, pt_right;
+    GetBatchTrack(batch, i, pt_left, pt_right);
 
     GetStereoReprojErrors(pt_left.prev_, pt_right.prev_, pt_left.curr_, pt_right.curr_, Rt, cam_params,
                           error_3d, left_reproj_error, right_reproj_error);
@@ -418,10 +432,11 @@ void EvalHelper::CalculateReprojectionErrors(track::StereoTrackerBase& tracker,
   cv::cv2eigen(cvRt, Rt);
   double left_reproj_error, right_reproj_error;
 
-  for(int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo pt_left = tracker.featureLeft(i);
-    track::FeatureInfo pt_right = tracker.featureRight(i);
-    if(pt_left.age_ < 1) continue;
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for(int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    track::FeatureInfo pt_left, pt_right;
+    GetBatchTrack(batch, i, pt_left, pt_right);
 
     Eigen::Vector2d left_vec_error, right_vec_error;
     GetStereoReprojErrors(pt_left.prev_, pt_right.prev_, pt_left.curr_, pt_right.curr_, Rt, cam_params,
@@ -822,10 +837,11 @@ int EvalHelper::CountFilterStoreBadTracks(track::StereoTrackerBase& tracker, con
 
   std::string save_folder;
   bool is_bad;
-  for(int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo pt_left = tracker.featureLeft(i);
-    track::FeatureInfo pt_right = tracker.featureRight(i);
-    if(pt_left.age_ < 1) continue;
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for(int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    track::FeatureInfo pt_left, pt_right;
+    GetBatchTrack(batch, i, pt_left, pt_right);
     GetStereoReprojErrors(pt_left.prev_, pt_right.prev_, pt_left.curr_, pt_right.curr_, Rt, cam_params,
                           error_3d, left_reproj_error, right_reproj_error);
 
@@ -962,10 +978,12 @@ void EvalHelper::DrawTracksAndErrors(track::StereoTrackerBase& tracker, const do
   }
   //bool has_big_errors = false;
 
-  for(int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo pt_left = tracker.featureLeft(i);
-    track::FeatureInfo pt_right = tracker.featureRight(i);
-    if(pt_left.age_ < 1) continue;
+  std::vector<size_t> bad_tracks;
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for(int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    track::FeatureInfo pt_left, pt_right;
+    GetBatchTrack(batch, i, pt_left, pt_right);
 
     GetStereoReprojErrors(pt_left.prev_, pt_right.prev_, pt_left.curr_, pt_right.curr_, Rt, cam_params,
                           error_3d, left_reproj_error, right_reproj_error);
@@ -1000,8 +1018,11 @@ void EvalHelper::DrawTracksAndErrors(track::StereoTrackerBase& tracker, const do
       }
     }
     else if(filter_bad)
-      tracker.removeTrack(i);
+      bad_tracks.push_back(i);
   }
+  // the batch is only valid until the next removeTrack
+  for(size_t i = 0; i < bad_tracks.size(); i++)
+    tracker.removeTrack(bad_tracks[i]);
   std::cout << "[EvalHelper]: Num of feats below error (" << thr << ") = " << num_feats << '\n';
 
   if(draw_on) {
@@ -1347,10 +1368,11 @@ double EvalHelper::getStereoDepthError(track::StereoTrackerBase& tracker, const
   double baseline = cam_params[4];
   double error_sum = 0.0;
   int track_cnt = 0;
-  for(int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo leftf = tracker.featureLeft(i);
-    track::FeatureInfo rightf = tracker.featureRight(i);
-    if(leftf.age_ <= 0) continue;
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for(int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    track::FeatureInfo leftf, rightf;
+    GetBatchTrack(batch, i, leftf, rightf);
     double lx = leftf.prev_.x_;
     double ly = leftf.prev_.y_;
     double depth = triangulateDepth(leftf.prev_, rightf.prev_, f, baseline);
@@ -1377,10 +1399,11 @@ double EvalHelper::getStereoDepthError(track::StereoTrackerBase& tracker, const
   double baseline = cam_params[4];
   double error_sum = 0.0;
   int track_cnt = 0;
-  for(int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo leftf = tracker.featureLeft(i);
-    track::FeatureInfo rightf = tracker.featureRight(i);
-    if(leftf.age_ <= 0) continue;
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for(int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    track::FeatureInfo leftf, rightf;
+    GetBatchTrack(batch, i, leftf, rightf);
     double lx = leftf.prev_.x_;
     double ly = leftf.prev_.y_;
     double depth = triangulateDepth(leftf.prev_, rightf.prev_, f, baseline);
@@ -1423,10 +1446,11 @@ double EvalHelper::getStereoRefinerDepthError(track::StereoTrackerBase& tracker_
   double baseline = cam_params[4];
   double error_sum = 0.0;
   int track_cnt = 0;
-  for(int i = 0; i < tracker.countFeatures(); i++) {
-    track::FeatureInfo leftf = tracker.featureLeft(i);
-    track::FeatureInfo rightf = tracker.featureRight(i);
-    if(leftf.age_ <= 0) continue;
+  const track::TrackBatch batch = tracker.GetTrackBatch();
+  for(int k = 0; k < batch.live_count; k++) {
+    int i = batch.live[k];
+    track::FeatureInfo leftf, rightf;
+    GetBatchTrack(batch, i, leftf, rightf);
     double depth = triangulateDepth(leftf.prev_, rightf.prev_, f, baseline);
     // take the depth gt from nearest pixel
     int col = (int)std::round(leftf.prev_.x_);
@@ -0,0 +1,113 @@
+#include "hamming_matcher.h"
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+
+namespace track {
+
+namespace hamming {
+
+namespace {
+
+template<typename Dist>
+void MatchBest(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates,
+               Dist dist, std::vector<cv::DMatch>& matches) {
+  const int n = candidates.queries();
+  std::vector<cv::DMatch> best(n);
+  #pragma omp parallel for schedule(dynamic, 64)
+  for (int i = 0; i < n; i++) {
+    const uint8_t* q = query.ptr<uint8_t>(i);
+    int best_dist = std::numeric_limits<int>::max();
+    int best_idx = -1;
+    for (const int* j = candidates.begin(i); j != candidates.end(i); ++j) {
+      int d = dist(q, train.ptr<uint8_t>(*j));
+      if (d < best_dist) {
+        best_dist = d;
+        best_idx = *j;
+      }
+    }
+    best[i] = cv::DMatch(i, best_idx, best_dist);
+  }
+  matches.clear();
+  for (const cv::DMatch& m : best)
+    if (m.trainIdx >= 0)
+      matches.push_back(m);
+}
+
+template<typename Dist>
+void MatchKnn(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates,
+              int k, Dist dist, std::vector<std::vector<cv::DMatch>>& matches) {
+  const int n = candidates.queries();
+  matches.assign(n, std::vector<cv::DMatch>());
+  #pragma omp parallel
+  {
+    std::vector<cv::DMatch> all;
+    #pragma omp for schedule(dynamic, 64)
+    for (int i = 0; i < n; i++) {
+      const uint8_t* q = query.ptr<uint8_t>(i);
+      all.clear();
+      for (const int* j = candidates.begin(i); j != candidates.end(i); ++j)
+        all.push_back(cv::DMatch(i, *j, dist(q, train.ptr<uint8_t>(*j))));
+      const size_t kept = std::min<size_t>(k, all.size());
+      std::partial_sort(all.begin(), all.begin() + kept, all.end(),
+                        [](const cv::DMatch& a, const cv::DMatch& b) {
+                          return a.distance < b.distance;
+                        });
+      matches[i].assign(all.begin(), all.begin() + kept);
+    }
+  }
+}
+
+}
+
+void SortInRows(const std::vector<cv::KeyPoint>& points, size_t img_rows,
+                std::vector<std::vector<size_t>>& row_indices) {
+  row_indices.resize(img_rows);
+  for (size_t i = 0; i < points.size(); i++) {
+    int row = static_cast<int>(points[i].pt.y);
+    assert(row >= 0 && row < (int)img_rows);
+    row_indices[row].push_back(i);
+  }
+  for (size_t i = 0; i < row_indices.size(); i++) {
+    if (row_indices[i].size() > 1)
+      std::sort(row_indices[i].begin(), row_indices[i].end(), [&points](size_t a, size_t b) {
+            return points[a].pt.x < points[b].pt.x;
+          });
+  }
+}
+
+void MatchCandidates(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates,
+                     std::vector<cv::DMatch>& matches) {
+  assert(query.type() == CV_8U && train.type() == CV_8U && query.cols == train.cols);
+  assert(candidates.queries() == query.rows);
+  const int nbytes = query.cols;
+  // fixed sizes of ORB and FREAK descriptors get the unrolled kernels
+  if (nbytes == 32)
+    MatchBest(query, train, candidates, Distance<32>, matches);
+  else if (nbytes == 64)
+    MatchBest(query, train, candidates, Distance<64>, matches);
+  else
+    MatchBest(query, train, candidates, [nbytes](const uint8_t* a, const uint8_t* b) {
+          return Distance(a, b, nbytes);
+        }, matches);
+}
+
+void KnnMatchCandidates(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates,
+                        int k, std::vector<std::vector<cv::DMatch>>& matches) {
+  assert(query.type() == CV_8U && train.type() == CV_8U && query.cols == train.cols);
+  assert(candidates.queries() == query.rows);
+  const int nbytes = query.cols;
+  if (nbytes == 32)
+    MatchKnn(query, train, candidates, k, Distance<32>, matches);
+  else if (nbytes == 64)
+    MatchKnn(query, train, candidates, k, Distance<64>, matches);
+  else
+    MatchKnn(query, train, candidates, k, [nbytes](const uint8_t* a, const uint8_t* b) {
+          return Distance(a, b, nbytes);
+        }, matches);
+}
+
+} // namespace hamming
+
+} // namespace track
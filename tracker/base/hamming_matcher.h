@@ -0,0 +1,156 @@
+#ifndef TRACKER_BASE_HAMMING_MATCHER_H_
+#define TRACKER_BASE_HAMMING_MATCHER_H_
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace track {
+
+namespace hamming {
+
+// Number of differing bits of two binary descriptors, nbytes has to be a multiple of 8.
+// With -march=native the 64 bit popcounts compile to the POPCNT instruction.
+inline int Distance(const uint8_t* a, const uint8_t* b, int nbytes) {
+  int dist = 0;
+  for (int i = 0; i < nbytes; i += 8) {
+    uint64_t x, y;
+    std::memcpy(&x, a + i, 8);
+    std::memcpy(&y, b + i, 8);
+    dist += __builtin_popcountll(x ^ y);
+  }
+  return dist;
+}
+
+template<int NBytes>
+inline int Distance(const uint8_t* a, const uint8_t* b) {
+  static_assert(NBytes % 8 == 0, "descriptor size must be a multiple of 8 bytes");
+#ifdef __AVX2__
+  // nibble lookup popcount of hammingseg.h on 256 bit registers (vpshufb)
+  if (NBytes % 32 == 0) {
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i acc = _mm256_setzero_si256();
+    for (int i = 0; i < NBytes; i += 32) {
+      __m256i x = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(a + i)),
+                                   _mm256_loadu_si256((const __m256i*)(b + i)));
+      __m256i lo = _mm256_and_si256(x, low_mask);
+      __m256i hi = _mm256_and_si256(_mm256_srli_epi16(x, 4), low_mask);
+      acc = _mm256_add_epi8(acc, _mm256_shuffle_epi8(lut, lo));
+      acc = _mm256_add_epi8(acc, _mm256_shuffle_epi8(lut, hi));
+    }
+    // at most 8 bits per byte and block, the byte sums cannot overflow for 31 blocks
+    acc = _mm256_sad_epu8(acc, _mm256_setzero_si256());
+    return _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+           _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+  }
+#endif
+  int dist = 0;
+  for (int i = 0; i < NBytes; i += 8) {
+    uint64_t x, y;
+    std::memcpy(&x, a + i, 8);
+    std::memcpy(&y, b + i, 8);
+    dist += __builtin_popcountll(x ^ y);
+  }
+  return dist;
+}
+
+// Distance accumulated in 32 byte blocks which stops as soon as it exceeds max_dist,
+// the result is then only a lower bound that is larger than max_dist.
+template<int NBytes>
+inline int DistanceBounded(const uint8_t* a, const uint8_t* b, int max_dist) {
+  static_assert(NBytes % 32 == 0, "descriptor size must be a multiple of 32 bytes");
+  int dist = 0;
+  for (int i = 0; i < NBytes; i += 32) {
+    dist += Distance<32>(a + i, b + i);
+    if (dist > max_dist)
+      return dist;
+  }
+  return dist;
+}
+
+inline int DistanceBounded(const uint8_t* a, const uint8_t* b, int nbytes, int max_dist) {
+  int dist = 0;
+  int i = 0;
+  for (; i + 32 <= nbytes; i += 32) {
+    dist += Distance<32>(a + i, b + i);
+    if (dist > max_dist)
+      return dist;
+  }
+  if (i < nbytes)
+    dist += Distance(a + i, b + i, nbytes - i);
+  return dist;
+}
+
+// Sparse candidate lists in CSR layout, the train candidates of query i are
+// indices[offsets[i]] .. indices[offsets[i+1]-1]. They replace dense matching masks.
+struct CandidateLists {
+  std::vector<int> offsets;
+  std::vector<int> indices;
+
+  int queries() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+  const int* begin(int i) const { return indices.data() + offsets[i]; }
+  const int* end(int i) const { return indices.data() + offsets[i+1]; }
+};
+
+// Builds the lists in one parallel pass, append(i, out) pushes the candidates of query i to out.
+// Static scheduling hands out contiguous query ranges in thread order, so the per thread
+// buffers only have to be concatenated.
+template<typename Append>
+void BuildCandidateLists(int nqueries, Append append, CandidateLists& lists) {
+  lists.offsets.assign(nqueries + 1, 0);
+  std::vector<std::vector<int>> chunks(1);
+  #pragma omp parallel
+  {
+#ifdef _OPENMP
+    #pragma omp single
+    chunks.resize(omp_get_num_threads());
+    std::vector<int>& chunk = chunks[omp_get_thread_num()];
+#else
+    std::vector<int>& chunk = chunks[0];
+#endif
+    #pragma omp for schedule(static)
+    for (int i = 0; i < nqueries; i++) {
+      size_t before = chunk.size();
+      append(i, chunk);
+      lists.offsets[i+1] = chunk.size() - before;
+    }
+  }
+  for (int i = 0; i < nqueries; i++)
+    lists.offsets[i+1] += lists.offsets[i];
+  lists.indices.clear();
+  lists.indices.reserve(lists.offsets[nqueries]);
+  for (const auto& chunk : chunks)
+    lists.indices.insert(lists.indices.end(), chunk.begin(), chunk.end());
+}
+
+// Bins the points by their integer row and sorts every bin by x, the bins are then walked
+// by the epipolar and temporal constraints that build the candidate lists.
+void SortInRows(const std::vector<cv::KeyPoint>& points, size_t img_rows,
+                std::vector<std::vector<size_t>>& row_indices);
+
+// Best candidate of every query that has candidates, like the compact output of a masked
+// cv::cuda::DescriptorMatcher::match. Descriptors are CV_8U rows.
+void MatchCandidates(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates,
+                     std::vector<cv::DMatch>& matches);
+
+// The k best candidates of every query sorted by distance, empty for queries without candidates.
+void KnnMatchCandidates(const cv::Mat& query, const cv::Mat& train, const CandidateLists& candidates,
+                        int k, std::vector<std::vector<cv::DMatch>>& matches);
+
+} // namespace hamming
+
+} // namespace track
+
+#endif  // TRACKER_BASE_HAMMING_MATCHER_H_
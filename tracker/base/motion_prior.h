@@ -0,0 +1,54 @@
+#ifndef TRACKER_BASE_MOTION_PRIOR_H_
+#define TRACKER_BASE_MOTION_PRIOR_H_
+
+#include <Eigen/Core>
+
+#include "../../core/types.h"
+
+namespace track {
+
+// Constant velocity motion prior for the temporal matching. Rt is the last egomotion estimate
+// (EgomotionBase::GetMotion, points of the previous frame to the current one) which is assumed
+// to repeat until the next frame, cam_params are f_x, f_y, c_u, c_v, baseline.
+// A default constructed prior is invalid and trackers fall back to their full search windows.
+class MotionPrior {
+ public:
+  MotionPrior() {}
+  MotionPrior(const Eigen::Matrix4d& Rt, const double* cam_params)
+      : Rt_(Rt.topRows<3>()), f_(cam_params[0]), cu_(cam_params[2]), cv_(cam_params[3]),
+        base_(cam_params[4]), valid_(true) {}
+
+  bool valid() const { return valid_; }
+
+  // Predicts the next frame projections of a point matched at left and right in the current
+  // stereo pair. Returns false if the point can not be triangulated or moves behind the camera.
+  bool Predict(const core::Point& left, const core::Point& right, core::Point& next_left,
+               core::Point& next_right) const {
+    const double disp = left.x_ - right.x_;
+    if (!valid_ || disp < kMinDisparity)
+      return false;
+    const double z = f_ * base_ / disp;
+    const Eigen::Vector4d pt((left.x_ - cu_) * base_ / disp, (left.y_ - cv_) * base_ / disp, z, 1.0);
+    const Eigen::Vector3d pn = Rt_ * pt;
+    if (pn[2] < kMinDepth)
+      return false;
+    next_left.x_ = f_ * pn[0] / pn[2] + cu_;
+    next_left.y_ = f_ * pn[1] / pn[2] + cv_;
+    next_right.x_ = f_ * (pn[0] - base_) / pn[2] + cu_;
+    next_right.y_ = next_left.y_;
+    return true;
+  }
+
+ private:
+  static constexpr double kMinDisparity = 0.1;
+  static constexpr double kMinDepth = 0.1;
+
+  // unaligned so trackers holding a prior need no aligned allocation
+  Eigen::Matrix<double,3,4,Eigen::DontAlign> Rt_;
+  double f_ = 0.0, cu_ = 0.0, cv_ = 0.0, base_ = 0.0;
+  bool valid_ = false;
+};
+
+}
+
+#endif  // TRACKER_BASE_MOTION_PRIOR_H_
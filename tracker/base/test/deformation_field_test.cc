@@ -0,0 +1,125 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include "../deformation_field.h"
+
+using track::DeformationField;
+
+namespace {
+
+const int kImgRows = 376, kImgCols = 1241;
+const int kGridRows = 5, kGridCols = 9;
+
+class DeformationFieldTest : public ::testing::Test
+{
+ protected:
+  DeformationFieldTest() : rng_(42), udist_(-1.0, 1.0) {
+    def_x_ = cv::Mat::zeros(kGridRows, kGridCols, CV_64F);
+    def_y_ = cv::Mat::zeros(kGridRows, kGridCols, CV_64F);
+    for (int i = 0; i < kGridRows; i++) {
+      for (int j = 0; j < kGridCols; j++) {
+        def_x_.at<double>(i,j) = udist_(rng_);
+        def_y_.at<double>(i,j) = 0.5 * udist_(rng_);
+      }
+    }
+  }
+
+  // bilinear interpolation between the cell centers of the coarse grid, clamped at the border
+  double Reference(const cv::Mat& grid, double x, double y) {
+    const double w = static_cast<double>(kImgCols) / kGridCols;
+    const double h = static_cast<double>(kImgRows) / kGridRows;
+    double u = std::max(0.0, std::min((x - w / 2.0) / w, kGridCols - 1.0));
+    double v = std::max(0.0, std::min((y - h / 2.0) / h, kGridRows - 1.0));
+    int col = std::min(static_cast<int>(u), kGridCols - 2);
+    int row = std::min(static_cast<int>(v), kGridRows - 2);
+    double fx = u - col, fy = v - row;
+    double top = (1.0 - fx) * grid.at<double>(row, col) + fx * grid.at<double>(row, col+1);
+    double bottom = (1.0 - fx) * grid.at<double>(row+1, col) + fx * grid.at<double>(row+1, col+1);
+    return (1.0 - fy) * top + fy * bottom;
+  }
+
+  std::mt19937 rng_;
+  std::uniform_real_distribution<double> udist_;
+  cv::Mat def_x_, def_y_;
+};
+
+TEST_F(DeformationFieldTest, MatchesCoarseInterpolation)
+{
+  DeformationField field(def_x_, def_y_, kImgRows, kImgCols);
+  std::uniform_real_distribution<double> xdist(0.0, kImgCols - 1.0), ydist(0.0, kImgRows - 1.0);
+  float dx, dy;
+  // exact on the pixels of the table
+  for (int t = 0; t < 1000; t++) {
+    double x = std::floor(xdist(rng_)), y = std::floor(ydist(rng_));
+    field.Get(x, y, dx, dy);
+    EXPECT_NEAR(dx, Reference(def_x_, x, y), 1e-5);
+    EXPECT_NEAR(dy, Reference(def_y_, x, y), 1e-5);
+  }
+  // between pixels only the kinks on the cell center lines are smoothed, by at most a quarter
+  // of the slope change over a pixel (about 0.03 / 4 for this grid)
+  for (int t = 0; t < 1000; t++) {
+    double x = xdist(rng_), y = ydist(rng_);
+    field.Get(x, y, dx, dy);
+    EXPECT_NEAR(dx, Reference(def_x_, x, y), 1e-2);
+    EXPECT_NEAR(dy, Reference(def_y_, x, y), 1e-2);
+  }
+  // clamped outside the image
+  field.Get(-20.0, -5.0, dx, dy);
+  EXPECT_NEAR(dx, def_x_.at<double>(0,0), 1e-5);
+  field.Get(kImgCols + 30.0, 0.5 * kImgRows, dx, dy);
+  EXPECT_NEAR(dy, Reference(def_y_, kImgCols - 1.0, 0.5 * kImgRows), 1e-5);
+}
+
+TEST_F(DeformationFieldTest, BatchMatchesSinglePoints)
+{
+  DeformationField field(def_x_, def_y_, kImgRows, kImgCols);
+  // interleaved like core::Point, with a tail that is not a multiple of 8 and far away points
+  const int n = 29;
+  std::vector<double> pts(2*n);
+  std::vector<float> pts_float(4*n);
+  for (int i = 0; i < n; i++) {
+    pts[2*i] = (0.5 + 0.6 * udist_(rng_)) * kImgCols;
+    pts[2*i + 1] = (0.5 + 0.6 * udist_(rng_)) * kImgRows;
+    pts_float[4*i] = pts[2*i];
+    pts_float[4*i + 1] = pts[2*i + 1];
+  }
+  pts[10] = std::numeric_limits<double>::max();
+  pts[11] = -std::numeric_limits<double>::max();
+  std::vector<double> orig = pts;
+  field.Apply(&pts[0], &pts[1], 2, n);
+  field.Apply(&pts_float[0], &pts_float[1], 4, n);
+  for (int i = 0; i < n; i++) {
+    float dx, dy;
+    field.Get(orig[2*i], orig[2*i + 1], dx, dy);
+    EXPECT_NEAR(pts[2*i], orig[2*i] + dx, 1e-5 * std::max(1.0, std::fabs(orig[2*i])));
+    EXPECT_NEAR(pts[2*i + 1], orig[2*i + 1] + dy, 1e-5 * std::max(1.0, std::fabs(orig[2*i + 1])));
+    if (i != 5) {
+      EXPECT_NEAR(pts_float[4*i], orig[2*i] + dx, 1e-3);
+      EXPECT_NEAR(pts_float[4*i + 1], orig[2*i + 1] + dy, 1e-3);
+    }
+  }
+}
+
+TEST_F(DeformationFieldTest, InverseUndoesApply)
+{
+  DeformationField field(def_x_, def_y_, kImgRows, kImgCols);
+  std::uniform_real_distribution<double> xdist(2.0, kImgCols - 3.0), ydist(2.0, kImgRows - 3.0);
+  for (int t = 0; t < 1000; t++) {
+    core::Point orig(xdist(rng_), ydist(rng_));
+    core::Point pt = orig;
+    field.Apply(pt);
+    field.ApplyInverse(pt);
+    EXPECT_NEAR(pt.x_, orig.x_, 1e-4);
+    EXPECT_NEAR(pt.y_, orig.y_, 1e-4);
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -1,12 +1,16 @@
 #ifndef TRACKER_FEATURE_DETECTOR_BASE_H_
 #define TRACKER_FEATURE_DETECTOR_BASE_H_
 
+#include <algorithm>
 #include <vector>
+#include <cassert>
+#include <cmath>
 #include <opencv2/core/core.hpp>
 #include <opencv2/features2d/features2d.hpp>
 
 #include "../../core/image.h"
 #include "../../core/types.h"
+#include "../base/hamming_matcher.h"
 
 namespace track {
 
@@ -29,7 +33,56 @@ class FeatureDetectorBase
   virtual double compare(cv::Mat desc1, cv::Mat desc2)
   { throw "[FeatureDetectorBase]: Empty function call!\n"; }
 
+  // Distances of all candidate pairs at once, distances[k] belongs to the pair
+  // (i, candidates.indices[k]) for k in [offsets[i], offsets[i+1]).
+  // Binary CV_8U descriptors are compared directly with the Hamming distance, which stops as
+  // soon as it exceeds max_dist and then reports some value above max_dist. Other descriptors
+  // fall back to the per pair compare.
+  virtual void compareBatch(const cv::Mat& desc1, const cv::Mat& desc2,
+                            const hamming::CandidateLists& candidates, double max_dist,
+                            std::vector<double>& distances)
+  {
+    distances.resize(candidates.indices.size());
+    if(desc1.type() == CV_8U && desc2.type() == CV_8U) {
+      assert(desc1.cols == desc2.cols);
+      // integer bound so that any distance above it is also above max_dist
+      const int bound = std::max(-1.0, std::min(std::floor(max_dist), 8.0 * desc1.cols));
+      if(desc1.cols == 32)
+        compareHamming<32>(desc1, desc2, candidates, bound, distances);
+      else if(desc1.cols == 64)
+        compareHamming<64>(desc1, desc2, candidates, bound, distances);
+      else
+        compareHamming<0>(desc1, desc2, candidates, bound, distances);
+      return;
+    }
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int i = 0; i < candidates.queries(); i++) {
+      for(int k = candidates.offsets[i]; k < candidates.offsets[i+1]; k++)
+        distances[k] = compare(desc1.row(i), desc2.row(candidates.indices[k]));
+    }
+  }
+
   //virtual void config(std::string config) = 0;
+
+ protected:
+  // bounded Hamming distances on the raw descriptor rows, NBytes = 0 for other sizes than the
+  // 32 byte ORB/BRIEF and 64 byte FREAK/BRISK descriptors
+  template<int NBytes>
+  static void compareHamming(const cv::Mat& desc1, const cv::Mat& desc2,
+                             const hamming::CandidateLists& candidates, int bound,
+                             std::vector<double>& distances)
+  {
+    const int nbytes = desc1.cols;
+    #pragma omp parallel for schedule(dynamic, 64)
+    for(int i = 0; i < candidates.queries(); i++) {
+      const uint8_t* query = desc1.ptr<uint8_t>(i);
+      for(int k = candidates.offsets[i]; k < candidates.offsets[i+1]; k++) {
+        const uint8_t* train = desc2.ptr<uint8_t>(candidates.indices[k]);
+        distances[k] = NBytes > 0 ? hamming::DistanceBounded<NBytes>(query, train, bound)
+                                  : hamming::DistanceBounded(query, train, nbytes, bound);
+      }
+    }
+  }
 };
 
 }
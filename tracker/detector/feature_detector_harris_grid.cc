@@ -0,0 +1,204 @@
+#include "feature_detector_harris_grid.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iostream>
+
+namespace {
+
+struct Corner {
+  float response;
+  int x, y;
+};
+
+bool strongerThan(const Corner& a, const Corner& b)
+{ return a.response > b.response; }
+
+// bounded heap with the weakest corner on top, it keeps the k strongest corners pushed into it
+void pushBounded(std::vector<Corner>& heap, const Corner& corner, int k)
+{
+  if((int)heap.size() < k) {
+    heap.push_back(corner);
+    std::push_heap(heap.begin(), heap.end(), strongerThan);
+  }
+  else if(corner.response > heap.front().response) {
+    std::pop_heap(heap.begin(), heap.end(), strongerThan);
+    heap.back() = corner;
+    std::push_heap(heap.begin(), heap.end(), strongerThan);
+  }
+}
+
+// candidate rows processed at once by one thread
+const int kStripRows = 32;
+
+// scaled gradient products of row y summed horizontally over the block, zero outside the support
+void blockProducts(const cv::Mat& img, int y, int ksize, int rb, float scale,
+                   float* dx, float* dy, float* sxx, float* syy, float* sxy)
+{
+  const int cols = img.cols;
+  const uchar* p0 = img.ptr<uchar>(y-1);
+  const uchar* p1 = img.ptr<uchar>(y);
+  const uchar* p2 = img.ptr<uchar>(y+1);
+  if(ksize == 1) {
+    for(int x = 1; x < cols-1; x++) {
+      dx[x] = scale * ((float)p1[x+1] - (float)p1[x-1]);
+      dy[x] = scale * ((float)p2[x] - (float)p0[x]);
+    }
+  }
+  else {
+    for(int x = 1; x < cols-1; x++) {
+      dx[x] = scale * (((float)p0[x+1] - (float)p0[x-1]) + 2.0f*((float)p1[x+1] - (float)p1[x-1]) +
+                       ((float)p2[x+1] - (float)p2[x-1]));
+      dy[x] = scale * (((float)p2[x-1] - (float)p0[x-1]) + 2.0f*((float)p2[x] - (float)p0[x]) +
+                       ((float)p2[x+1] - (float)p0[x+1]));
+    }
+  }
+
+  std::fill(sxx, sxx+cols, 0.0f);
+  std::fill(syy, syy+cols, 0.0f);
+  std::fill(sxy, sxy+cols, 0.0f);
+  for(int j = -rb; j <= rb; j++) {
+    for(int x = 1+rb; x < cols-1-rb; x++) {
+      const float gx = dx[x+j];
+      const float gy = dy[x+j];
+      sxx[x] += gx*gx;
+      syy[x] += gy*gy;
+      sxy[x] += gx*gy;
+    }
+  }
+}
+
+}
+
+namespace track {
+
+FeatureDetectorHarrisGrid::FeatureDetectorHarrisGrid(int block_size, int ksize, double k, double eig_thr,
+                                                     int margin_size, int h_bins, int v_bins, int fpb)
+{
+  block_size_ = block_size;
+  ksize_ = ksize;
+  k_ = k;
+  eig_thr_ = eig_thr;
+  margin_size_ = margin_size;
+  h_bins_ = h_bins;
+  v_bins_ = v_bins;
+  fpb_ = fpb;
+  if(ksize_ != 1 && ksize_ != 3)
+    throw "[FeatureDetectorHarrisGrid]: Only 1 and 3 sized derivative filters are supported!\n";
+  assert(block_size_ % 2 == 1);
+}
+
+void FeatureDetectorHarrisGrid::detect(const cv::Mat& img, std::vector<cv::KeyPoint>& features)
+{
+  assert(img.type() == CV_8UC1);
+  const int rows = img.rows;
+  const int cols = img.cols;
+  const int rb = block_size_ / 2;
+  // same scaling as cv::cornerHarris for 8 bit images
+  const float scale = 1.0 / ((1 << (ksize_-1)) * block_size_ * 255.0);
+  const float k = k_;
+  const float thr = eig_thr_;
+  // the response and its 3x3 neighbourhood need the full filter support
+  const int margin = std::max(margin_size_, rb + 2);
+  const int nbins = h_bins_ * v_bins_;
+  // FeatureDetectorUniform keeps fpb + 1 corners per bin, the same config gives the same count
+  const int per_bin = fpb_ + 1;
+  const int nstrips = std::max(0, (rows - 2*margin + kStripRows - 1) / kStripRows);
+
+  std::vector<std::vector<Corner>> bins(nbins);
+  #pragma omp parallel
+  {
+    std::vector<std::vector<Corner>> local_bins(nbins);
+    for(auto& heap : local_bins)
+      heap.reserve(per_bin);
+    // the strip plus the response rows above and below it and their block support
+    const int max_resp_rows = kStripRows + 2;
+    const int max_prod_rows = max_resp_rows + 2*rb;
+    std::vector<float> dx(cols), dy(cols);
+    std::vector<float> sxx(max_prod_rows*cols), syy(max_prod_rows*cols), sxy(max_prod_rows*cols);
+    std::vector<float> resp(max_resp_rows*cols, 0.0f);
+
+    #pragma omp for schedule(dynamic)
+    for(int s = 0; s < nstrips; s++) {
+      const int y0 = margin + s*kStripRows;
+      const int y1 = std::min(y0 + kStripRows, rows - margin);
+      const int resp_rows = y1 - y0 + 2;
+      const int prod_rows = resp_rows + 2*rb;
+      const int prod_y0 = y0 - 1 - rb;
+      for(int i = 0; i < prod_rows; i++)
+        blockProducts(img, prod_y0 + i, ksize_, rb, scale, &dx[0], &dy[0],
+                      &sxx[i*cols], &syy[i*cols], &sxy[i*cols]);
+
+      // Harris response of rows y0-1 .. y1, thresholded to zero like the opencv detector
+      for(int i = 0; i < resp_rows; i++) {
+        float* r = &resp[i*cols];
+        for(int x = 1+rb; x < cols-1-rb; x++) {
+          float a = 0.0f, b = 0.0f, c = 0.0f;
+          for(int j = 0; j <= 2*rb; j++) {
+            a += sxx[(i+j)*cols + x];
+            b += syy[(i+j)*cols + x];
+            c += sxy[(i+j)*cols + x];
+          }
+          const float v = a*b - c*c - k*(a+b)*(a+b);
+          r[x] = v > thr ? v : 0.0f;
+        }
+      }
+
+      // 3x3 non-max suppression straight into the bin heaps
+      for(int y = y0; y < y1; y++) {
+        const float* r0 = &resp[(y-y0)*cols];
+        const float* r1 = r0 + cols;
+        const float* r2 = r1 + cols;
+        const int by = y * v_bins_ / rows;
+        for(int x = margin; x < cols - margin; x++) {
+          const float v = r1[x];
+          if(v == 0.0f)
+            continue;
+          if(v < r1[x-1] || v < r1[x+1] || v < r0[x-1] || v < r0[x] || v < r0[x+1] ||
+             v < r2[x-1] || v < r2[x] || v < r2[x+1])
+            continue;
+          const int bx = x * h_bins_ / cols;
+          pushBounded(local_bins[by*h_bins_ + bx], Corner{v, x, y}, per_bin);
+        }
+      }
+    }
+
+    #pragma omp critical
+    {
+      for(int i = 0; i < nbins; i++)
+        for(const Corner& corner : local_bins[i])
+          pushBounded(bins[i], corner, per_bin);
+    }
+  }
+
+  // strongest first, like the other Harris detectors
+  std::vector<Corner> corners;
+  corners.reserve(nbins * per_bin);
+  for(const auto& heap : bins)
+    corners.insert(corners.end(), heap.begin(), heap.end());
+  std::sort(corners.begin(), corners.end(), strongerThan);
+
+  features.clear();
+  features.reserve(corners.size());
+  for(const Corner& corner : corners) {
+    cv::KeyPoint kpt;
+    kpt.pt.x = corner.x;
+    kpt.pt.y = corner.y;
+    kpt.size = block_size_;
+    kpt.response = corner.response;
+    features.push_back(kpt);
+  }
+  std::cout << "[FeatureDetectorHarrisGrid]: Detected features = " << features.size() << "\n";
+}
+
+void FeatureDetectorHarrisGrid::detect(const cv::Mat& img, std::vector<core::Point>& features)
+{
+  std::vector<cv::KeyPoint> keypoints;
+  detect(img, keypoints);
+  features.clear();
+  features.reserve(keypoints.size());
+  for(const cv::KeyPoint& kpt : keypoints)
+    features.push_back(core::Point(kpt.pt.x, kpt.pt.y));
+}
+
+}
@@ -0,0 +1,28 @@
+#ifndef TRACKER_FEATURE_DETECTOR_HARRIS_GRID_H_
+#define TRACKER_FEATURE_DETECTOR_HARRIS_GRID_H_
+
+#include "feature_detector_base.h"
+
+namespace track {
+
+// Harris corners kept uniformly over the image: the response, 3x3 non-max suppression and
+// the strongest fpb + 1 corners of every bin (as many as FeatureDetectorUniform keeps) are
+// computed in one pass over row strips.
+// The response is scaled like cv::cornerHarris so the thresholds of FeatureDetectorHarrisCV apply.
+class FeatureDetectorHarrisGrid : public FeatureDetectorBase
+{
+ public:
+  FeatureDetectorHarrisGrid(int block_size, int ksize, double k, double eig_thr, int margin_size,
+                            int h_bins, int v_bins, int fpb);
+  virtual void detect(const cv::Mat& img, std::vector<core::Point>& features);
+  virtual void detect(const cv::Mat& img, std::vector<cv::KeyPoint>& features);
+
+ private:
+  int block_size_, ksize_, margin_size_;
+  double k_, eig_thr_;
+  int h_bins_, v_bins_, fpb_;
+};
+
+}
+
+#endif
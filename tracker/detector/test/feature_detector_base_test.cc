@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+
+#include <bitset>
+#include <random>
+
+#include "../feature_detector_base.h"
+
+using track::FeatureDetectorBase;
+namespace hamming = track::hamming;
+
+namespace {
+
+int ReferenceDistance(const cv::Mat& desc1, int i, const cv::Mat& desc2, int j)
+{
+  int dist = 0;
+  for (int b = 0; b < desc1.cols; b++)
+    dist += std::bitset<8>(desc1.at<uint8_t>(i,b) ^ desc2.at<uint8_t>(j,b)).count();
+  return dist;
+}
+
+cv::Mat RandomDescriptors(int rows, int nbytes, std::mt19937& rng)
+{
+  cv::Mat desc(rows, nbytes, CV_8U);
+  std::uniform_int_distribution<int> byte(0, 255);
+  for (int i = 0; i < rows; i++)
+    for (int b = 0; b < nbytes; b++)
+      desc.at<uint8_t>(i,b) = byte(rng);
+  return desc;
+}
+
+// every query against every train descriptor
+hamming::CandidateLists AllPairs(int queries, int train)
+{
+  hamming::CandidateLists candidates;
+  auto append = [train](int i, std::vector<int>& out) {
+    for (int j = 0; j < train; j++)
+      out.push_back(j);
+  };
+  hamming::BuildCandidateLists(queries, append, candidates);
+  return candidates;
+}
+
+// the ORB/BRIEF, FREAK and an odd sized descriptor go through the three kernels
+TEST(FeatureDetectorBaseTest, BinaryBatchMatchesPopcount)
+{
+  std::mt19937 rng(42);
+  FeatureDetectorBase detector;
+  const int sizes[] = { 32, 64, 40 };
+  for (int nbytes : sizes) {
+    cv::Mat desc1 = RandomDescriptors(17, nbytes, rng);
+    cv::Mat desc2 = RandomDescriptors(23, nbytes, rng);
+    // a copy of a query has distance 0
+    for (int b = 0; b < nbytes; b++)
+      desc2.at<uint8_t>(5,b) = desc1.at<uint8_t>(3,b);
+    hamming::CandidateLists candidates = AllPairs(desc1.rows, desc2.rows);
+    std::vector<double> distances;
+    detector.compareBatch(desc1, desc2, candidates, 8.0 * nbytes, distances);
+    ASSERT_EQ(distances.size(), candidates.indices.size());
+    for (int i = 0; i < desc1.rows; i++) {
+      for (int k = candidates.offsets[i]; k < candidates.offsets[i+1]; k++)
+        EXPECT_EQ(distances[k], ReferenceDistance(desc1, i, desc2, candidates.indices[k]));
+    }
+    EXPECT_EQ(distances[candidates.offsets[3] + 5], 0.0);
+  }
+}
+
+// with a bound the distances up to it are exact and the others only stay above it
+TEST(FeatureDetectorBaseTest, BoundedBatchKeepsTheOrderBelowMaxDist)
+{
+  std::mt19937 rng(7);
+  FeatureDetectorBase detector;
+  const double max_dist = 120.5;
+  const int sizes[] = { 32, 64, 40 };
+  for (int nbytes : sizes) {
+    cv::Mat desc1 = RandomDescriptors(11, nbytes, rng);
+    cv::Mat desc2 = RandomDescriptors(13, nbytes, rng);
+    // close descriptors with a few flipped bits
+    for (int b = 0; b < nbytes; b++)
+      desc2.at<uint8_t>(2,b) = desc1.at<uint8_t>(4,b) ^ (b % 7 == 0 ? 0x11 : 0);
+    hamming::CandidateLists candidates = AllPairs(desc1.rows, desc2.rows);
+    std::vector<double> distances;
+    detector.compareBatch(desc1, desc2, candidates, max_dist, distances);
+    int below = 0;
+    for (int i = 0; i < desc1.rows; i++) {
+      for (int k = candidates.offsets[i]; k < candidates.offsets[i+1]; k++) {
+        int dist = ReferenceDistance(desc1, i, desc2, candidates.indices[k]);
+        if (dist <= max_dist) {
+          EXPECT_EQ(distances[k], dist);
+          below++;
+        }
+        else {
+          EXPECT_GT(distances[k], max_dist);
+          EXPECT_LE(distances[k], dist);
+        }
+      }
+    }
+    EXPECT_GT(below, 0);
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -2,6 +2,7 @@
 #define TRACKER_TRACKER_BASE_H_
 
 #include <string>
+#include <vector>
 
 #include "../../core/image.h"
 #include "../../core/types.h"
@@ -22,6 +23,11 @@ class TrackerBase {
   virtual int init(const cv::Mat& img) { throw "Error\n"; }
   virtual int track(const cv::Mat& img) { throw "Error\n"; }
 
+  // Predicted positions of the tracks in the next frame, used by the next track() call only.
+  // Tracks with has_prediction[i] false and trackers without support use the full search window.
+  virtual void setPrediction(const std::vector<core::Point>& predicted,
+                             const std::vector<bool>& has_prediction) {}
+
   virtual int countTracked() = 0;
   virtual int countFeatures() = 0;
   virtual FeatureInfo feature(int i) = 0;
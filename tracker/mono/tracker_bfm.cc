@@ -38,7 +38,7 @@ namespace track {
 
 
 TrackerBFM::TrackerBFM(FeatureDetectorBase& detector, int max_features, double min_ncc,
-                       int patch_size, int wsz, bool match_with_oldest) :
+                       int patch_size, int wsz, bool match_with_oldest, int prior_wsz) :
                               detector_(detector), max_feats_(max_features),
                               min_ncc_(min_ncc), match_with_oldest_(match_with_oldest)
 {
@@ -56,6 +56,7 @@ TrackerBFM::TrackerBFM(FeatureDetectorBase& detector, int max_features, double m
   max_dist_x_ = wsz / 2;
   max_dist_y_ = wsz / 5;
   //max_dist_y_ = wsz / 2;
+  prior_dist_ = prior_wsz / 2;
 }
 
 int TrackerBFM::init(const cv::Mat& img)
@@ -93,7 +94,11 @@ int TrackerBFM::track(const cv::Mat& img)
   // match temporal
   //std::cout << "[TrackerBFM] matching prev-curr\n";
   //match_features(matches_p_, feats, desc_prev_, desc, match_index, half_wsize_, age_, false);
-  match_features(matches_p_, feats, desc_ref_, desc, match_index, age_, false);
+  int candidates = match_features(matches_p_, feats, desc_ref_, desc, match_index, age_, false);
+  candidates_acc_ += candidates;
+  track_frames_++;
+  // the predictions hold only for this frame
+  has_prediction_.clear();
 
   std::vector<bool> unused_features;
   update_alive_tracks(feats, desc, match_index, unused_features);
@@ -101,6 +106,7 @@ int TrackerBFM::track(const cv::Mat& img)
   //std::cout << "[TrackerBFM] Replacing dead features\n";
   replace_dead_tracks(feats, desc, unused_features);
   std::cout << "[TrackerBFM]: Number of final matches: " << countTracked() << " / " << max_feats_ << "\n";
+  std::cout << "[TrackerBFM]: Temporal match candidates: " << candidates << "\n";
   save_unused_features(feats, desc, unused_features);
   return 0;
 }
@@ -243,12 +249,22 @@ int TrackerBFM::track(const cv::Mat& img)
 //  }
 //}
 
-void TrackerBFM::match_features(const std::vector<cv::KeyPoint>& feats1,
-                                const std::vector<cv::KeyPoint>& feats2,
-                                const std::vector<core::DescriptorNCC>& desc1,
-                                const std::vector<core::DescriptorNCC>& desc2,
-                                std::vector<int>& match_index,
-                                const std::vector<int>& ages, bool replacing_dead)
+void TrackerBFM::setPrediction(const std::vector<core::Point>& predicted,
+                               const std::vector<bool>& has_prediction)
+{
+  if(prior_dist_ <= 0.0)
+    return;
+  assert(predicted.size() == (size_t)max_feats_ && has_prediction.size() == (size_t)max_feats_);
+  predicted_ = predicted;
+  has_prediction_ = has_prediction;
+}
+
+int TrackerBFM::match_features(const std::vector<cv::KeyPoint>& feats1,
+                               const std::vector<cv::KeyPoint>& feats2,
+                               const std::vector<core::DescriptorNCC>& desc1,
+                               const std::vector<core::DescriptorNCC>& desc2,
+                               std::vector<int>& match_index,
+                               const std::vector<int>& ages, bool replacing_dead)
 {
   match_index.assign(feats1.size(), -1);
   std::vector<int> matches_1to2, matches_2to1;
@@ -256,10 +272,27 @@ void TrackerBFM::match_features(const std::vector<cv::KeyPoint>& feats1,
   matches_2to1.assign(feats2.size(), -1);
   //std::vector<double> distances;
   //distances.resize(feats1.size());
+  int candidates = 0;
+
+  // search window of each feature in feats1, the replaced dead tracks have no predictions
+  const bool use_prediction = !replacing_dead && !has_prediction_.empty();
+  std::vector<cv::Point2f> centers(feats1.size());
+  std::vector<double> dist_x(feats1.size()), dist_y(feats1.size());
+  for(size_t i = 0; i < feats1.size(); i++) {
+    if(use_prediction && has_prediction_[i]) {
+      centers[i] = cv::Point2f(predicted_[i].x_, predicted_[i].y_);
+      dist_x[i] = dist_y[i] = prior_dist_;
+    }
+    else {
+      centers[i] = feats1[i].pt;
+      dist_x[i] = max_dist_x_;
+      dist_y[i] = max_dist_y_;
+    }
+  }
 
   // match 1 to 2
 #ifndef DEBUG_ON
-  #pragma omp parallel for
+  #pragma omp parallel for reduction(+:candidates)
 #endif
   for(size_t i = 0; i < feats1.size(); i++) {
     double dist, dx, dy;
@@ -276,14 +309,15 @@ void TrackerBFM::match_features(const std::vector<cv::KeyPoint>& feats1,
     double dist_best = -1.0;
     //double dist_second_best = -1.0;
     for(size_t j = 0; j < feats2.size(); j++) {
-      dy = std::abs(feats1[i].pt.y - feats2[j].pt.y);
-      dx = std::abs(feats1[i].pt.x - feats2[j].pt.x);
+      dy = std::abs(centers[i].y - feats2[j].pt.y);
+      dx = std::abs(centers[i].x - feats2[j].pt.x);
       // ignore features outside search area
-      if(dx > max_dist_x_ || dy > max_dist_y_) continue;
+      if(dx > dist_x[i] || dy > dist_y[i]) continue;
 
       // TODO optimization: compare with SSE in blocks until the threshold is reached and then reject...
       //dist = detector_.compare(desc1.row(i), desc2.row(j));
       dist = recon::StereoCosts::get_cost_NCC(desc1[i], desc2[j]);
+      candidates++;
 
       if(dist > dist_best) {
         dist_best = dist;
@@ -303,7 +337,7 @@ void TrackerBFM::match_features(const std::vector<cv::KeyPoint>& feats1,
 
   // match 2 to 1
 #ifndef DEBUG_ON
-  #pragma omp parallel for
+  #pragma omp parallel for reduction(+:candidates)
 #endif
   for(size_t i = 0; i < feats2.size(); i++) {
     double dist, dx, dy;
@@ -319,15 +353,16 @@ void TrackerBFM::match_features(const std::vector<cv::KeyPoint>& feats1,
           continue;
       }
 
-      dy = std::abs(feats1[j].pt.y - feats2[i].pt.y);
-      dx = std::abs(feats1[j].pt.x - feats2[i].pt.x);
+      dy = std::abs(centers[j].y - feats2[i].pt.y);
+      dx = std::abs(centers[j].x - feats2[i].pt.x);
       // ignore features outside search area
-      if(dx > max_dist_x_ || dy > max_dist_y_) continue;
+      if(dx > dist_x[j] || dy > dist_y[j]) continue;
 
       //cout << "match 1-2: " << i << " - " << j << endl;
       // TODO optimization: compare with SSE in blocks until the threshold is reached and then reject...
       //dist = detector_.compare(desc1.row(i), desc2.row(j));
       dist = recon::StereoCosts::get_cost_NCC(desc1[j], desc2[i]);
+      candidates++;
 
       if(dist > dist_best) {
         //dist_second_best = dist_best;
@@ -353,6 +388,7 @@ void TrackerBFM::match_features(const std::vector<cv::KeyPoint>& feats1,
         match_index[i] = m_1to2;
     }
   }
+  return candidates;
 }
 
 // update all successfuly matched alive tracks
@@ -484,6 +520,8 @@ void TrackerBFM::printStats()
 {
   std::cout << "[TrackerBFM] Active tracks: " << countTracked() << "\n";
   std::cout << "[TrackerBFM] Average track age: " << (double) age_acc_ / death_count_ << "\n";
+  std::cout << "[TrackerBFM] Average temporal match candidates: "
+            << (double) candidates_acc_ / track_frames_ << "\n";
 }
 
 FeatureInfo TrackerBFM::feature(int i)
@@ -14,10 +14,12 @@ namespace track {
 class TrackerBFM : public TrackerBase {
 public:
   TrackerBFM(FeatureDetectorBase& detector, int max_features, double min_ncc, int patch_size,
-             int wsz, bool match_with_oldest = true);
+             int wsz, bool match_with_oldest = true, int prior_wsz = 0);
 
   virtual int init(const cv::Mat& img);
   virtual int track(const cv::Mat& img);
+  virtual void setPrediction(const std::vector<core::Point>& predicted,
+                             const std::vector<bool>& has_prediction);
   virtual int countTracked();
   virtual int countFeatures();
   virtual FeatureInfo feature(int i);
@@ -32,12 +34,14 @@ public:
   void printStats();
 
 private:
-  void match_features(const std::vector<cv::KeyPoint>& feats1,
-                      const std::vector<cv::KeyPoint>& feats2,
-                      const std::vector<core::DescriptorNCC>& desc1,
-                      const std::vector<core::DescriptorNCC>& desc2,
-                      std::vector<int>& match_index,
-                      const std::vector<int>& ages, bool replacing_dead);
+  // Returns the number of compared candidate pairs, in the temporal matching (not replacing_dead)
+  // the tracks with a prediction are searched for only around their predicted position.
+  int match_features(const std::vector<cv::KeyPoint>& feats1,
+                     const std::vector<cv::KeyPoint>& feats2,
+                     const std::vector<core::DescriptorNCC>& desc1,
+                     const std::vector<core::DescriptorNCC>& desc2,
+                     std::vector<int>& match_index,
+                     const std::vector<int>& ages, bool replacing_dead);
 
   void update_alive_tracks(const std::vector<cv::KeyPoint>& feats,
                            const std::vector<core::DescriptorNCC>& desc,
@@ -68,8 +72,14 @@ private:
   bool match_with_oldest_ = true;
   uint64_t age_acc_ = 0;
   uint64_t death_count_ = 0;
+  uint64_t candidates_acc_ = 0;
+  uint64_t track_frames_ = 0;
   int wsize_;
   double max_dist_x_, max_dist_y_;  
+  // half size of the search window around predicted positions, 0 ignores the predictions
+  double prior_dist_;
+  std::vector<core::Point> predicted_;
+  std::vector<bool> has_prediction_;
   std::vector<int> age_;
 };
 
@@ -112,52 +112,38 @@ void TrackerBFMcv::match_features(const std::vector<cv::KeyPoint>& feats1,
                                   const std::vector<int>& ages, bool replacing_dead)
 {
   match_index.assign(feats1.size(), -1);
-  //std::vector<int> matches_1to2, matches_2to1;
-  //matches_1to2.resize(feats1.size());
-  //matches_2to1.resize(feats2.size());
+  // candidates inside the search area, dont track if the reference feature is dead
+  hamming::CandidateLists candidates;
+  auto append = [&](int i, std::vector<int>& out) {
+    if(!replacing_dead && ages[i] < 0)
+      return;
+    for(size_t j = 0; j < feats2.size(); j++) {
+      double dy = std::abs(feats1[i].pt.y - feats2[j].pt.y);
+      double dx = std::abs(feats1[i].pt.x - feats2[j].pt.x);
+      if(dx > max_dist_x_ || dy > max_dist_y_) continue;
+      out.push_back(j);
+    }
+  };
+  hamming::BuildCandidateLists(feats1.size(), append, candidates);
+  // distances above max_distance_ are rejected anyway so the detector can stop early on them
   std::vector<double> distances;
-  distances.resize(feats1.size());
+  detector_.compareBatch(desc1, desc2, candidates, max_distance_, distances);
 
   // match 1 to 2
   #pragma omp parallel for
   for(size_t i = 0; i < feats1.size(); i++) {
-    double dist, dx, dy;
-    // dont track if the reference feature is dead
-    if(!replacing_dead) {
-      if(ages[i] < 0) {
-        match_index[i] = -1;
-        //matches_1to2[i] = -1;
-        continue;
-      }
-    }
-
     int ind_best = -1;
     double dist_best = std::numeric_limits<double>::max();
-    for(size_t j = 0; j < feats2.size(); j++) {
-      dy = std::abs(feats1[i].pt.y - feats2[j].pt.y);
-      dx = std::abs(feats1[i].pt.x - feats2[j].pt.x);
-      // ignore features outside search area
-      if(dx > max_dist_x_ || dy > max_dist_y_) continue;
-
-      //cout << "match 1-2: " << i << " - " << j << endl;
-      // TODO optimization: compare with SSE in blocks until the threshold is reached and then reject...
-      dist = detector_.compare(desc1.row(i), desc2.row(j));
-      //std::cout << "Distance = " << dist << "\n";
-
-      if(dist < dist_best) {
-        dist_best = dist;
-        ind_best = j;
+    for(int k = candidates.offsets[i]; k < candidates.offsets[i+1]; k++) {
+      if(distances[k] < dist_best) {
+        dist_best = distances[k];
+        ind_best = candidates.indices[k];
       }
     }
-
-    distances[i] = dist_best;
-    //std::cout << dist_best << " -- dist best\n";
     if(dist_best <= max_distance_)
       match_index[i] = ind_best;
-      //matches_1to2[i] = ind_best;
     else
       match_index[i] = -1;
-      //matches_1to2[i] = -1;
   }
 
   // match 2 to 1
@@ -1,5 +1,6 @@
 #include "tracker_stm.h"
 
+#include <algorithm>
 #include <bitset>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
@@ -26,14 +27,6 @@ void draw_descriptors(const cv::Mat& descriptors) {
   cv::destroyAllWindows();
 }
 
-double get_mean_dist(const std::vector<double>& weights, const std::vector<double>& distances) {
-  double mean_dist = 0.0;
-  for(size_t i = 0; i < distances.size(); i++) {
-    mean_dist += weights[i] * distances[i];
-  }
-  return mean_dist;
-}
-
 template<typename T>
 void get_binary_values(T val, int elem_sz, std::vector<double>& bin_values) {
   std::bitset<8> bits(val);
@@ -59,6 +52,13 @@ cv::Mat get_dense_vector(const cv::Mat& mat) {
   return ret;
 }
 
+// descriptor as a column of doubles written straight into dst
+void to_dense_column(const cv::Mat& desc, double* dst) {
+  cv::Mat col(desc.total(), 1, CV_64F, dst);
+  cv::Mat src = desc.isContinuous() ? desc : desc.clone();
+  src.reshape(0, col.rows).convertTo(col, CV_64F);
+}
+
 void round_mat(cv::Mat& mat) {
   for(int i = 0; i < mat.rows; i++) {
     for(int j = 0; j < mat.cols; j++)
@@ -71,8 +71,26 @@ void round_mat(cv::Mat& mat) {
 TrackerSTM::TrackerSTM(TrackerBase* tracker, double Q, double a) :
     tracker_(tracker), Q_(Q), a_(a) {
   int max_features = tracker->countFeatures();
-  stm_.resize(max_features);
-  stm_dists_.resize(max_features);
+  capacity_ = std::max(2, static_cast<int>(std::ceil(3.0 * a_)) + 1);
+  stm_dists_.resize(max_features * capacity_);
+  stm_head_.assign(max_features, 0);
+  stm_len_.assign(max_features, 0);
+  coeffs_.resize(capacity_);
+
+  // the weights only depend on the STM length so they are computed once
+  weights_.resize(capacity_ + 1);
+  for(int len = 1; len <= capacity_; len++) {
+    std::vector<double>& weights = weights_[len];
+    weights.resize(len);
+    double weights_sum = 0.0;
+    for(int j = 0; j < len; j++) {
+      int t = j + 1;
+      weights[j] = std::exp(static_cast<double>(-(t-len)*(t-len)) / (2.0*a_*a_));
+      weights_sum += weights[j];
+    }
+    for(int j = 0; j < len; j++)
+      weights[j] /= weights_sum;
+  }
 }
 
 TrackerSTM::~TrackerSTM() {
@@ -85,112 +103,71 @@ int TrackerSTM::init(const cv::Mat& img) {
   return 0;
 }
 
+// adds the sample at the ring head, the oldest one is overwritten when the ring is full
+void TrackerSTM::pushSample(int idx, const DistType* desc, DistType dist) {
+  int slot = stm_head_[idx];
+  std::copy(desc, desc + dim_, sample(idx, slot));
+  stm_dists_[idx*capacity_ + slot] = dist;
+  stm_head_[idx] = (slot + 1) % capacity_;
+  stm_len_[idx] = std::min(stm_len_[idx] + 1, capacity_);
+}
+
 int TrackerSTM::track(const cv::Mat& img) {
   tracker_->track(img);
   int alive_before = tracker_->countTracked();
-  cv::Mat st_desc;
-  cv::Mat double_stm;
   size_t num_outliers = 0;
   for(int i = 0; i < tracker_->countFeatures(); i++) {
     if(tracker_->isAlive(i)) {
       FeatureData fdata = tracker_->getFeatureData(i);
+      if(dim_ == 0) {
+        dim_ = fdata.desc_curr_.total();
+        stm_.resize(tracker_->countFeatures() * capacity_ * dim_);
+        st_desc_.resize(dim_);
+        curr_desc_.resize(dim_);
+        prev_desc_.resize(dim_);
+      }
+      assert(static_cast<int>(fdata.desc_curr_.total()) == dim_);
+      cv::Mat curr_desc(dim_, 1, CV_64F, &curr_desc_[0]);
+      to_dense_column(fdata.desc_curr_, &curr_desc_[0]);
+
       // If the feature is new then we need to clear the STM and then add
       // first two descriptors to STM
       if(fdata.feat_.age_ == 1) {
-        // for FREAK
-        //cv::Mat vec_prev = get_dense_vector(fdata.desc_prev_);
-        //cv::Mat vec_curr = get_dense_vector(fdata.desc_curr_);
-        // for NCC
-        //cv::Mat vec_prev = fdata.desc_prev_.clone();
-        //cv::Mat vec_curr = fdata.desc_curr_.clone();
-        //stm_[i] = vec_prev;
-
-        stm_dists_[i].clear();
-        //fdata.desc_prev_.convertTo(stm_[i], CV_64F);
-        int num_rows = fdata.desc_curr_.rows * fdata.desc_curr_.rows;
-        fdata.desc_prev_.clone().reshape(0, num_rows).convertTo(stm_[i], CV_64F);
-
-        cv::Mat vec_curr;
-        //fdata.desc_curr_.convertTo(vec_curr, CV_64F);
-        fdata.desc_curr_.clone().reshape(0, num_rows).convertTo(vec_curr, CV_64F);
-
-        //std::cout << fdata.desc_prev_ << "\n";
-        //cv::hconcat(stm_[i], vec_prev, stm_[i]);
-        cv::hconcat(stm_[i], vec_curr, stm_[i]);
+        cv::Mat prev_desc(dim_, 1, CV_64F, &prev_desc_[0]);
+        to_dense_column(fdata.desc_prev_, &prev_desc_[0]);
         // TODO: optimization: have both dense and compressed representations of
         // STM matrix and then can use hamm
-        //uint32_t dist = core::MathHelper::hammDist<uint32_t>(stm_[i].col(0), stm_[i].col(1));
-        // get Hamming distance
-        //double dist = core::MathHelper::GetDistanceL1<double>(stm_[i].col(0), stm_[i].col(1));
-        double dist = core::MathHelper::GetDistanceNCC<double>(stm_[i].col(0), stm_[i].col(1));
-        //double dist = core::MathHelper::
-        //    GetDistanceChiSq<double>(stm_[i].col(0), stm_[i].col(1));
+        //double dist = core::MathHelper::GetDistanceL1<double>(prev_desc, curr_desc);
+        double dist = core::MathHelper::GetDistanceNCC<double>(prev_desc, curr_desc);
+        //double dist = core::MathHelper::GetDistanceChiSq<double>(prev_desc, curr_desc);
         dist = std::max(0.00001, dist);
-        //printf("%f\n", dist);
         if(std::isnan(dist))
           throw "Error\n";
-        stm_dists_[i].push_back(dist);
-        stm_dists_[i].push_back(dist);
-
-        // add NCC descriptors also
-        //ncc_descriptors_.push_back(fdata.ncc_prev_);
-        //ncc_descriptors_.push_back(fdata.ncc_curr_);
+        resetMemory(i);
+        pushSample(i, &prev_desc_[0], dist);
+        pushSample(i, &curr_desc_[0], dist);
       }
       // else only add the descriptor in the current frame
       else {
-        int len = stm_[i].cols;
-        cv::Mat stm_coeffs_(len, 1, CV_64F);
-        std::vector<double> weights;
-        weights.resize(len);
-        double weights_sum = 0.0;
-        for(int j = 0; j < len; j++) {
-          int t = j + 1;
-          weights[j] = std::exp(static_cast<double>(-(t-len)*(t-len)) / (2.0*a_*a_));
-          weights_sum += weights[j];
-        }
+        const int len = stm_len_[i];
+        const std::vector<double>& weights = weights_[len];
+        const int oldest = (stm_head_[i] - len + capacity_) % capacity_;
+        // the weighted mean of the stored distances is also the norm of the coefficients
         double L1_norm = 0.0;
         for(int j = 0; j < len; j++) {
-          // normaize the weights
-          weights[j] /= weights_sum;
-          //printf("Weight %d = %f\n", j, weights[j]);
-          //double coeff = weights[j] / stm_dists_[i][j];
-          //if (distance_type == DistanceType::NCC)
-            double coeff = weights[j] * stm_dists_[i][j];
-          stm_coeffs_.at<double>(j) = coeff;
-          L1_norm += coeff;
+          int slot = (oldest + j) % capacity_;
+          coeffs_[j] = weights[j] * stm_dists_[i*capacity_ + slot];
+          L1_norm += coeffs_[j];
         }
-        // normalize the coeffs
+        // short-term descriptor as the normalized combination of the STM samples
+        std::fill(st_desc_.begin(), st_desc_.end(), 0.0);
         for(int j = 0; j < len; j++) {
-          stm_coeffs_.at<double>(j) /= L1_norm;
-          //printf("STM dist %d = %f\n", j, stm_dists_[i][j]);
-          //printf("STM coeff %d = %f\n", j, stm_coeffs_.at<double>(j));
+          const double coeff = coeffs_[j] / L1_norm;
+          const DistType* stm_sample = sample(i, (oldest + j) % capacity_);
+          for(int k = 0; k < dim_; k++)
+            st_desc_[k] += coeff * stm_sample[k];
         }
-
-        //stm_[i].convertTo(double_stm, CV_64F);
-        //st_desc = double_stm * stm_coeffs_;
-        //std::cout << "\n\nSTM coeffs:\n" << stm_coeffs_;
-        //std::cout << "STM:\n" << stm_[i];
-        st_desc = stm_[i] * stm_coeffs_;
-        //std::cout << stm_[i] << "\n\n" << stm_coeffs_ << "\n\n" << st_desc << "\n\n";
-        // do the rounding
-        //std::cout << "st_desc:\n" << st_desc;
-        //round_mat(st_desc);
-        //std::cout << "\n\n\nAfter round st_desc:\n" << st_desc;
-
-        // for FREAK
-        //cv::Mat curr_desc = get_dense_vector(fdata.desc_curr_);
-        // for NCC
-        //cv::Mat curr_desc;
-        //fdata.desc_curr_.convertTo(curr_desc, CV_64F);
-        int num_rows = fdata.desc_curr_.rows * fdata.desc_curr_.rows;
-        cv::Mat curr_desc;
-        fdata.desc_curr_.clone().reshape(0, num_rows).convertTo(curr_desc, CV_64F);
-
-        //for(int i = 0; i < stm_[i].rows; i++) {
-        //  printf("%f == %f\n", stm_[i].at<double>(i,0), st_desc.at<double>(i,0));
-        //  // TODO check the computation of st_desc here
-        //  //for(int j = 0; j < stm_[j]
-        //}
+        cv::Mat st_desc(dim_, 1, CV_64F, &st_desc_[0]);
 
         //double dist = core::MathHelper::GetDistanceL1<double>(st_desc, curr_desc);
         double dist = core::MathHelper::GetDistanceNCC<double>(st_desc, curr_desc);
@@ -198,28 +175,20 @@ int TrackerSTM::track(const cv::Mat& img) {
         dist = std::max(0.00001, dist);
         if(std::isnan(dist))
           throw "Error\n";
-        //uint32_t dist = core::MathHelper::hammDist<uint32_t>(st_desc_binary, fdata.desc_curr_);
-        double w_mean_dist = get_mean_dist(weights, stm_dists_[i]);
+        double w_mean_dist = L1_norm;
         double delta = dist / w_mean_dist;
 
         //printf("dist / mean_dist = %f / %f\n", dist, w_mean_dist);
         //printf("Desc size = %d -- %f < %f\n", len, delta, Q_);
-        //std::cout << delta << " < " << Q_ << "\n";
         if(delta < Q_) {
-          cv::hconcat(stm_[i], curr_desc, stm_[i]);
-          stm_dists_[i].push_back(dist);
-          //ncc_descriptors_.push_back(fdata.ncc_curr_);
+          pushSample(i, &curr_desc_[0], dist);
         }
         else {
           //tracker_->showTrack(i);
-          //if(stm_[i].cols > 1) {
-          //  draw_descriptors(stm_[i]);
-          //}
           // remove this track
           tracker_->removeTrack(i);
           num_outliers++;
         }
-        // TODO: clear descriptors in STM for which t < (n < 3a)
       }
     }
   }
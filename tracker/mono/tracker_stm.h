@@ -24,12 +24,24 @@ public:
   virtual void removeTrack(int idx) { tracker_->removeTrack(idx); }
 
 private:
+  DistType* sample(int idx, int slot) { return &stm_[(idx*capacity_ + slot) * dim_]; }
+  void resetMemory(int idx) { stm_head_[idx] = 0; stm_len_[idx] = 0; }
+  void pushSample(int idx, const DistType* desc, DistType dist);
+
   TrackerBase* tracker_ = nullptr;
   double Q_, a_;
-  std::vector<cv::Mat> stm_;
+  // STM of each track is a ring of the last capacity_ samples, all rings live in one buffer
+  // and older samples than 3a have negligible weight anyway
+  int capacity_;
+  int dim_ = 0;
+  std::vector<DistType> stm_;
   //std::vector<core::DescriptorNCC> ncc_descriptors_;
-  //std::vector<std::vector<uint32_t>> stm_dists_;
-  std::vector<std::vector<DistType>> stm_dists_;
+  // distance of each sample to the STM at the time it was added
+  std::vector<DistType> stm_dists_;
+  std::vector<int> stm_head_, stm_len_;
+  // normalized temporal weights for each STM length, oldest sample first
+  std::vector<std::vector<double>> weights_;
+  std::vector<DistType> st_desc_, curr_desc_, prev_desc_, coeffs_;
 };
 
 }
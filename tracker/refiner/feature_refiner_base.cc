@@ -1,45 +1,135 @@
 #include "feature_refiner_base.h"
 
+#include <algorithm>
+#include <cassert>
 #include <sstream>
 #include <stdexcept>
 
 namespace track {
 namespace refiner {
 
-FeatureRefinerBase::FeatureRefinerBase(){}
+namespace {
+// every feature image starts on a 64 byte boundary
+const int kAlignFloats=16;
+const int kInitialSlots=256;
+
+// floats per feature image, padded to keep the next image aligned
+int imageStride()
+{
+  const int sz=FeatureData::width()*FeatureData::height();
+  return (sz+kAlignFloats-1)/kAlignFloats*kAlignFloats;
+}
+
+float* alignFloats(float* p)
+{
+  const size_t mask=kAlignFloats*sizeof(float)-1;
+  return reinterpret_cast<float*>((reinterpret_cast<size_t>(p)+mask) & ~mask);
+}
+}
+
+FeatureRefinerBase::FeatureRefinerBase():
+  pixelsBase_(nullptr)
+{}
 FeatureRefinerBase::~FeatureRefinerBase(){}
 
-FeatureRefinerBase::Map::iterator
-FeatureRefinerBase::find(int id)
+FeatureData& FeatureRefinerBase::find(int id)
 {
-  auto it=map_.find(id);
-  if (it==map_.end()){
+  if (id<0 || id>=(int)slotOf_.size() || slotOf_[id]<0){
     std::ostringstream oss;
     oss <<"track::FeatureRefinerBase::find ";
     oss <<"- unknown id (" <<id <<")";
     throw std::runtime_error(oss.str());
   }
-  return it;
+  return slots_[slotOf_[id]];
+}
+
+FeatureData& FeatureRefinerBase::insert(int id)
+{
+  assert(id>=0);
+  if (id>=(int)slotOf_.size())
+    slotOf_.resize(id+1, -1);
+  int& slot=slotOf_[id];
+  if (slot<0){
+    if (freeSlots_.empty())
+      growSlots();
+    slot=freeSlots_.back();
+    freeSlots_.pop_back();
+  }
+  return slots_[slot];
+}
+
+void FeatureRefinerBase::reserveSlots(int count)
+{
+  while ((int)freeSlots_.size()<count)
+    growSlots();
+}
+
+int FeatureRefinerBase::slotFloats() const
+{
+  // warped_ and error_ plus ref_, refgx_, refgy_ on every level
+  return (2+3*levels())*imageStride();
+}
+
+void FeatureRefinerBase::growSlots()
+{
+  // the slot count doubles, existing pixels move over and all views are rebound
+  const int used=slots_.size();
+  const int capacity=std::max(kInitialSlots, 2*used);
+  std::vector<float> pixels(capacity*slotFloats()+kAlignFloats);
+  float* base=alignFloats(pixels.data());
+  if (used>0)
+    std::copy(pixelsBase_, pixelsBase_+used*slotFloats(), base);
+  pixels_.swap(pixels);
+  pixelsBase_=base;
+
+  slots_.resize(capacity);
+  for (int slot=0; slot<capacity; ++slot)
+    bindSlot(slot);
+  for (int slot=capacity-1; slot>=used; --slot)
+    freeSlots_.push_back(slot);
+}
+
+void FeatureRefinerBase::bindSlot(int slot)
+{
+  const int fw=FeatureData::width();
+  const int fh=FeatureData::height();
+  const int stride=imageStride();
+  float* p=pixelsBase_+slot*slotFloats();
+  auto bind=[&](core::Image& img){
+    img.attach(reinterpret_cast<uint8_t*>(p), fw, fh, sizeof(float));
+    p+=stride;
+  };
+
+  FeatureData& feature=slots_[slot];
+  if ((int)feature.octaves_.size()!=levels()-1)
+    feature.octaves_.resize(levels()-1, FeatureTemplate(fw, fh));
+  bind(feature.warped_);
+  bind(feature.error_);
+  bind(feature.ref_);
+  bind(feature.refgx_);
+  bind(feature.refgy_);
+  for (FeatureTemplate& tmpl : feature.octaves_){
+    bind(tmpl.ref_);
+    bind(tmpl.refgx_);
+    bind(tmpl.refgy_);
+  }
 }
 
 void FeatureRefinerBase::removeFeature(int id)
 {
-  auto it=find(id);
-  map_.erase(it);
+  find(id);
+  freeSlots_.push_back(slotOf_[id]);
+  slotOf_[id]=-1;
 }
 
 bool FeatureRefinerBase::featureExists(int id)
 {
-  auto it = map_.find(id);
-  if(it == map_.end())
-     return false;
-  return true;
+  return id>=0 && id<(int)slotOf_.size() && slotOf_[id]>=0;
 }
 
 const FeatureData& FeatureRefinerBase::getFeature(int id)
 {
-  auto it=find(id);
-  return it->second;
+  return find(id);
 }
 
 std::vector<core::Point> FeatureData::bbox() const
@@ -15,9 +15,22 @@ struct FeatureData;
 
 class FeatureRefinerBase{
 protected:
-  typedef std::map<int,FeatureData> Map;
-  Map map_;
-  Map::iterator find(int id);
+  // slot array store: slotOf_ maps track ids to slots, removed slots go back
+  // to the free list and the images of all slots are views into pixels_
+  std::vector<FeatureData> slots_;
+  std::vector<int> slotOf_;
+  std::vector<int> freeSlots_;
+  std::vector<float> pixels_;
+  float* pixelsBase_;
+  FeatureData& find(int id);
+  // slot of id, taken from the free list if id is new
+  FeatureData& insert(int id);
+  // makes sure count features can be inserted without invalidating references
+  void reserveSlots(int count);
+private:
+  int slotFloats() const;
+  void growSlots();
+  void bindSlot(int slot);
 public:
   FeatureRefinerBase();
   virtual ~FeatureRefinerBase();
@@ -25,6 +38,8 @@ public:
   bool featureExists(int id);
   void removeFeature(int id);
   const FeatureData& getFeature(int id);
+  // pyramid levels the refiner wants in the image sets it is given
+  virtual int levels() const { return 1; }
 public:
   // acquires feature appearance
   virtual void addFeatures(
@@ -39,25 +54,48 @@ public:
 };
 
 
-struct FeatureData
+// reference appearance of a feature on one pyramid level
+struct FeatureTemplate
 {
   core::Image ref_;    // reference appearance
+  core::Image refgx_;  // reference gradient x, inverse compositional only
+  core::Image refgy_;  // reference gradient y, inverse compositional only
+  double hinv_[64];    // inverse Hessian of the inverse compositional step, row major
+  bool invertible_;    // false if the Hessian is singular
+public:
+  FeatureTemplate(int width, int height):
+    ref_(width,height,4),
+    refgx_(width,height,4),
+    refgy_(width,height,4),
+    invertible_(false)
+  {}
+};
+
+struct FeatureData: public FeatureTemplate
+{
   core::Image warped_; // current warped appearance
   core::Image error_;  // difference betwee the two
   double residue_;          // squared L2 norm of error_
   double first_residue_;    // squared L2 norm of error_
   int status_;              // whether the feature is tracked
   double warp_[8];          // feature warp
+  std::vector<FeatureTemplate> octaves_; // references on the coarser pyramid levels
+  int levels_;              // valid levels, the finest plus the used octaves_
 public:
   enum StatusCodes{ LargeResidue=-5, OutOfBounds, MaxIterations, SmallDet, NotFound, OK=0 };
 public:
   FeatureData(double posx=0, double posy=0):
-    ref_(width(),height(),4),
+    FeatureTemplate(width(),height()),
     warped_(width(),height(),4),
-    error_(width(),height(),4),
-    residue_(0),
-    status_(OK)
+    error_(width(),height(),4)
   {
+    reset(posx, posy);
+  }
+  // identity warp at the given position, keeps the images
+  void reset(double posx, double posy) {
+    residue_=0;
+    status_=OK;
+    levels_=1;
     warp_[0]=posx;
     warp_[1]=posy;
     warp_[2]=1;
@@ -79,6 +117,8 @@ public:
   double ayy() const {return warp_[5];}
   double lambda() const {return warp_[6];}
   double delta() const {return warp_[7];}
+  int levels() const {return levels_;}
+  const FeatureTemplate& level(int level) const {return level==0 ? *this : octaves_[level-1];}
 public:
   core::Point pt() const {return core::Point(posx(),posy());}
   double mag() const {return (axx()+ayy())/2;}
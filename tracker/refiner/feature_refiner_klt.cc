@@ -7,6 +7,9 @@
 
 #include <cassert>
 
+#include <Eigen/Core>
+#include <Eigen/LU>
+
 namespace{
 
 /////////////////////////////////////////////////////////////
@@ -38,18 +41,32 @@ double interpolate(
 
 void getReferenceImages(
   const core::Image& src, /* source image */
-  track::refiner::FeatureData& fi) /* feature position, output */
+  double posx, double posy, /* feature position */
+  core::Image& ref)       /* reference appearance, output */
 {
   assert(src.szPixel_==4);
-  const int hw=fi.width()/2;
-  const int hh=fi.height()/2;
-  float* pmagdst=(float*)fi.ref_.data_;
+  const int hw=track::refiner::FeatureData::width()/2;
+  const int hh=track::refiner::FeatureData::height()/2;
+  float* pmagdst=(float*)ref.data_;
   for (int y=-hh; y<=hh; ++y){
     for (int x=-hw ; x<=hw; ++x)
-      *pmagdst++ = interpolate(fi.posx() + x, fi.posy() + y, src);
+      *pmagdst++ = interpolate(posx + x, posy + y, src);
   }
 }
 
+// position on the given pyramid level, the pixel centers map as x_half = (x - 0.5) / 2
+double toLevel(double pos, int level)
+{
+  if (level==0)
+    return pos;
+  return (pos+0.5) / (1<<level) - 0.5;
+}
+// position on the next finer pyramid level
+double toFinerLevel(double pos)
+{
+  return 2*pos + 0.5;
+}
+
 // old without subpixel references
 //void getReferenceImages(
 //  const core::Image& src, /* source image */
@@ -77,7 +94,8 @@ void getReferenceImages(
 //}
 
 void computeWarpedGradient(
-  const core::ImageSet& src,   /* source images */
+  const core::Image& gx,       /* source gradient x */
+  const core::Image& gy,       /* source gradient y */
   const track::refiner::FeatureData& fi,     /* feature position */
   const core::Image& gwgx,     /* geometrically warped gradient x */
   const core::Image& gwgy)     /* geometrically warped gradient y */
@@ -91,19 +109,20 @@ void computeWarpedGradient(
     for (int x=-hw ; x<=hw; ++x){
       double xsrc = fi.warpx(x,y);
       double ysrc = fi.warpy(x,y);
-      *pgwgx++ = interpolate(xsrc,ysrc, src.gx_);
-      *pgwgy++ = interpolate(xsrc,ysrc, src.gy_);
+      *pgwgx++ = interpolate(xsrc,ysrc, gx);
+      *pgwgy++ = interpolate(xsrc,ysrc, gy);
     }
   }
 }
 
 double computeError(
-  const core::ImageSet& src,   /* source images */
+  const core::Image& smooth,   /* source image */
+  const core::Image& ref,      /* reference appearance */
   track::refiner::FeatureData& fi,           /* feature position, some outputs */
   core::Image& gwimg)    /* geometrically warped image */
 {
   double residue=0;
-  float const* pref =(float const*)fi.ref_.data_; // reference
+  float const* pref =(float const*)ref.data_;     // reference
   float* pgwimg     =(float*)gwimg.data_;         // geometric warp
   float* pwarped    =(float*)fi.warped_.data_;    // geometric+photometric warp
   float* perror     =(float*)fi.error_.data_;
@@ -112,7 +131,7 @@ double computeError(
   const int hh=fi.height()/2;
   for (int y=-hh; y<=hh; ++y){
     for (int x=-hw ; x<=hw; ++x){
-      double gw_smooth=interpolate(fi.warpx(x,y),fi.warpy(x,y), src.smooth_);
+      double gw_smooth=interpolate(fi.warpx(x,y),fi.warpy(x,y), smooth);
       double warped = fi.lambda() * gw_smooth + fi.delta();
       double error = warped - *pref++;
       *pgwimg++ = gw_smooth;
@@ -388,6 +407,130 @@ LKTracker* createLKTracker(int hw, int hh, int model){
   assert(0);
   return nullptr;
 }
+/////////////////////////////////////////
+// inverse compositional steps
+
+// steepest descent row of one template pixel, ordered as in the forward trackers:
+// translation, the scale (model 5) or affine (model 8) part, gain and offset
+template <int N>
+void steepestDescent(double x, double y, double gx, double gy, double t, double* j);
+
+template <>
+void steepestDescent<2>(double, double, double gx, double gy, double, double* j)
+{
+  j[0]=gx;
+  j[1]=gy;
+}
+template <>
+void steepestDescent<5>(double x, double y, double gx, double gy, double t, double* j)
+{
+  j[0]=gx;
+  j[1]=gy;
+  j[2]=x*gx+y*gy;
+  j[3]=t;
+  j[4]=1;
+}
+template <>
+void steepestDescent<8>(double x, double y, double gx, double gy, double t, double* j)
+{
+  j[0]=gx;
+  j[1]=gy;
+  j[2]=x*gx;
+  j[3]=y*gx;
+  j[4]=x*gy;
+  j[5]=y*gy;
+  j[6]=t;
+  j[7]=1;
+}
+
+// the steepest descent images only depend on the template, so does the Hessian
+template <int N>
+void computeInverseHessian(
+  track::refiner::FeatureTemplate& tmpl)
+{
+  typedef Eigen::Matrix<double,N,N> MatrixN;
+  typedef Eigen::Matrix<double,N,1> VectorN;
+  float const* pref=tmpl.ref_.pcbits<float>();
+  float const* pgx=tmpl.refgx_.pcbits<float>();
+  float const* pgy=tmpl.refgy_.pcbits<float>();
+
+  const int hw=track::refiner::FeatureData::width()/2;
+  const int hh=track::refiner::FeatureData::height()/2;
+  MatrixN H=MatrixN::Zero();
+  VectorN j;
+  for (int y=-hh; y<=hh; ++y){
+    for (int x=-hw; x<=hw; ++x){
+      steepestDescent<N>(x, y, *pgx++, *pgy++, *pref++, j.data());
+      H.noalias() += j*j.transpose();
+    }
+  }
+  Eigen::FullPivLU<MatrixN> lu(H);
+  tmpl.invertible_=lu.isInvertible();
+  if (tmpl.invertible_){
+    Eigen::Map<Eigen::Matrix<double,N,N,Eigen::RowMajor>>(tmpl.hinv_)=lu.inverse();
+  }
+}
+
+void computeInverseHessian(
+  int model,
+  track::refiner::FeatureTemplate& tmpl)
+{
+  switch (model){
+  case 2:
+    computeInverseHessian<2>(tmpl);
+    return;
+  case 5:
+    computeInverseHessian<5>(tmpl);
+    return;
+  case 8:
+    computeInverseHessian<8>(tmpl);
+    return;
+  }
+  assert(0);
+}
+
+// p <- p o W(d)^-1, the warped template (1+gain)*T(W(x;d)) + offset
+// is moved over to the image side as well
+template <int N>
+void composeInverse(
+  const double* d,
+  track::refiner::FeatureData& fi)
+{
+  double dxx=0, dxy=0, dyx=0, dyy=0;
+  double gain=0, offset=0;
+  if (N==5){
+    dxx=dyy=d[2];
+    gain=d[3];
+    offset=d[4];
+  } else if (N==8){
+    dxx=d[2];
+    dxy=d[3];
+    dyx=d[4];
+    dyy=d[5];
+    gain=d[6];
+    offset=d[7];
+  }
+  // (I + dA)^-1
+  const double det=(1+dxx)*(1+dyy) - dxy*dyx;
+  const double ixx=(1+dyy)/det;
+  const double ixy=-dxy/det;
+  const double iyx=-dyx/det;
+  const double iyy=(1+dxx)/det;
+  // A' = A (I + dA)^-1,  t' = t - A' dt
+  const double axx=fi.axx()*ixx + fi.axy()*iyx;
+  const double axy=fi.axx()*ixy + fi.axy()*iyy;
+  const double ayx=fi.ayx()*ixx + fi.ayy()*iyx;
+  const double ayy=fi.ayx()*ixy + fi.ayy()*iyy;
+  fi.warp_[0] -= axx*d[0] + axy*d[1];
+  fi.warp_[1] -= ayx*d[0] + ayy*d[1];
+  fi.warp_[2]=axx;
+  fi.warp_[3]=axy;
+  fi.warp_[4]=ayx;
+  fi.warp_[5]=ayy;
+  fi.warp_[6]=fi.lambda() / (1+gain);
+  fi.warp_[7]=(fi.delta()-offset) / (1+gain);
+}
+
 /////////////////////////////////////////
 // convergence tests
 
@@ -486,6 +629,25 @@ void reportIteration(int fid, int iteration,
 namespace track {
 namespace refiner {
 
+// per feature scratch, reused across features
+struct FeatureRefinerKLT::Workspace
+{
+  Workspace(int fw, int fh, int model):
+    gwgx(fw,fh, 4), gwgy(fw,fh, 4), gwimg(fw,fh, 4),
+    lk(createLKTracker(fw/2,fh/2, model)) {}
+  core::Image gwgx;  // geometrically warped gradient x
+  core::Image gwgy;  // geometrically warped gradient y
+  core::Image gwimg; // geometrically warped image
+  std::unique_ptr<LKTracker> lk;
+};
+
+FeatureRefinerKLT::FeatureRefinerKLT(int levels, bool inverseCompositional):
+  inverseCompositional_(inverseCompositional),
+  levels_(levels)
+{
+  assert(levels_>=1);
+}
+
 void FeatureRefinerKLT::config(const std::string& conf)
 {
 }
@@ -494,23 +656,180 @@ void FeatureRefinerKLT::addFeatures(
   const core::ImageSet& src,
   const std::map<int, core::Point>& pts)
 {
-  // TODO
-  //#pragma omp parallel for
+  const int hw=FeatureData::width()/2;
+  const int hh=FeatureData::height()/2;
+  const int levels=std::min(levels_, src.levels());
+
+  // the store is only modified here, the references are sampled in parallel below
+  reserveSlots(pts.size());
+  std::vector<std::pair<core::Point, FeatureData*>> work;
+  work.reserve(pts.size());
   for (auto q : pts){
-  //for (auto iter = pts.begin(); iter != pts.end(); iter++) {
     // TODO - replace or not to replace?
-    //auto ret = map_.emplace(q.first, FeatureData(q.second.x_, q.second.y_));
-    map_[q.first] = FeatureData(q.second.x_, q.second.y_);
-    //auto ret = map_.emplace(iter->first, FeatureData(iter->second.x_, iter->second.y_));
-    //std::cout << "index: " << q.first << "\n";
-    //assert(ret.second == true);
+    FeatureData& feature = insert(q.first);
+    feature.reset(q.second.x_, q.second.y_);
+    work.push_back(std::make_pair(q.second, &feature));
+  }
 
-    FeatureData& feature = map_[q.first];
-    //FeatureData& feature = map_[iter->first];
+  #pragma omp parallel for
+  for (int i=0; i<(int)work.size(); ++i){
+    const core::Point& pt = work[i].first;
+    FeatureData& feature = *work[i].second;
+
+    // coarser references as long as the template fits into the level
+    for (int level=0; level<levels; ++level){
+      const core::Image& smooth=src.smooth(level);
+      double x=toLevel(pt.x_, level);
+      double y=toLevel(pt.y_, level);
+      if (level>0){
+        std::vector<core::Point> bbox={core::Point(x-hw, y-hh), core::Point(x+hw, y+hh)};
+        if (testOutOfBoundary(bbox, smooth.rows_, smooth.cols_))
+          break;
+      }
+      FeatureTemplate& tmpl = (level==0) ? feature : feature.octaves_[level-1];
+      getReferenceImages(smooth, x, y, tmpl.ref_);
+      if (inverseCompositional_){
+        getReferenceImages(src.gx(level), x, y, tmpl.refgx_);
+        getReferenceImages(src.gy(level), x, y, tmpl.refgy_);
+        computeInverseHessian(warpModel_, tmpl);
+      }
+      feature.levels_ = level+1;
+    }
+  }
+}
 
-    //std::cout << feature.pt() << "\n";
-    getReferenceImages(src.smooth_, feature);
+int FeatureRefinerKLT::refineLevel(
+  const core::ImageSet& src, int level, int fid,
+  FeatureData& feature, Workspace& ws) const
+{
+  if (inverseCompositional_){
+    switch (warpModel_){
+    case 2:
+      return refineLevelInverse<2>(src, level, fid, feature, ws);
+    case 5:
+      return refineLevelInverse<5>(src, level, fid, feature, ws);
+    case 8:
+      return refineLevelInverse<8>(src, level, fid, feature, ws);
+    }
+    assert(0);
+  }
+
+  const core::Image& smooth=src.smooth(level);
+  const core::Image& gx=src.gx(level);
+  const core::Image& gy=src.gy(level);
+  const core::Image& ref=feature.level(level).ref_;
+
+  // check bounding box
+  std::vector<core::Point> bboxCur=feature.bbox();
+  if (testOutOfBoundary(bboxCur, smooth.rows_, smooth.cols_)){
+    return FeatureData::OutOfBounds;
   }
+
+  // iterate until convergence or failure
+  for (int iteration=0; iteration<thMaxIterations_; ++iteration){
+    // compute error
+    computeWarpedGradient(gx, gy, feature, ws.gwgx, ws.gwgy);
+    feature.residue_=computeError(smooth, ref, feature, ws.gwimg);
+    if(iteration == 0)
+      feature.first_residue_ = feature.residue_;
+
+
+    // LK tracking
+    std::vector<double> improvement = ws.lk->track(
+       ws.gwgx.pcbits<float>(),
+       ws.gwgy.pcbits<float>(),
+       feature.error_.pcbits<float>(),
+       ws.gwimg.pcbits<float>(), feature.lambda());
+    if (improvement.size()==0){
+      return FeatureData::SmallDet;
+    }
+    if (verbose_){
+      reportIteration(fid, iteration, feature, improvement);
+    }
+    for (size_t i=0; i<improvement.size(); ++i){
+      feature.warp_[i]+=improvement[i]*optimizationFactor_;
+    }
+
+    // check bounding box
+    std::vector<core::Point> bboxPrev(std::move(bboxCur));
+    bboxCur=feature.bbox();
+    if (testOutOfBoundary(bboxCur, smooth.rows_, smooth.cols_)){
+      return FeatureData::OutOfBounds;
+    }
+
+    // check convergence
+    if (testConvergence(bboxCur, bboxPrev, thDisplacementConvergence_) &&
+        feature.residue_ < thMaxResidue_)
+    {
+      return FeatureData::OK;
+    }
+  }
+  return FeatureData::MaxIterations;
+}
+
+template <int N>
+int FeatureRefinerKLT::refineLevelInverse(
+  const core::ImageSet& src, int level, int fid,
+  FeatureData& feature, Workspace& ws) const
+{
+  typedef Eigen::Matrix<double,N,1> VectorN;
+  const core::Image& smooth=src.smooth(level);
+  const FeatureTemplate& tmpl=feature.level(level);
+  if (!tmpl.invertible_){
+    return FeatureData::SmallDet;
+  }
+  Eigen::Map<const Eigen::Matrix<double,N,N,Eigen::RowMajor>> hinv(tmpl.hinv_);
+
+  // check bounding box
+  std::vector<core::Point> bboxCur=feature.bbox();
+  if (testOutOfBoundary(bboxCur, smooth.rows_, smooth.cols_)){
+    return FeatureData::OutOfBounds;
+  }
+
+  const int hw=FeatureData::width()/2;
+  const int hh=FeatureData::height()/2;
+  // iterate until convergence or failure
+  for (int iteration=0; iteration<thMaxIterations_; ++iteration){
+    // the warped image is the only interpolation per iteration
+    feature.residue_=computeError(smooth, tmpl.ref_, feature, ws.gwimg);
+    if(iteration == 0)
+      feature.first_residue_ = feature.residue_;
+
+    // J^T e with the constant steepest descent images
+    float const* pref=tmpl.ref_.pcbits<float>();
+    float const* pgx=tmpl.refgx_.pcbits<float>();
+    float const* pgy=tmpl.refgy_.pcbits<float>();
+    float const* perror=feature.error_.pcbits<float>();
+    VectorN b=VectorN::Zero();
+    VectorN j;
+    for (int y=-hh; y<=hh; ++y){
+      for (int x=-hw; x<=hw; ++x){
+        steepestDescent<N>(x, y, *pgx++, *pgy++, *pref++, j.data());
+        b.noalias() += j * double(*perror++);
+      }
+    }
+    VectorN improvement=optimizationFactor_ * (hinv*b);
+    if (verbose_){
+      reportIteration(fid, iteration, feature,
+                      std::vector<double>(improvement.data(), improvement.data()+N));
+    }
+    composeInverse<N>(improvement.data(), feature);
+
+    // check bounding box
+    std::vector<core::Point> bboxPrev(std::move(bboxCur));
+    bboxCur=feature.bbox();
+    if (testOutOfBoundary(bboxCur, smooth.rows_, smooth.cols_)){
+      return FeatureData::OutOfBounds;
+    }
+
+    // check convergence
+    if (testConvergence(bboxCur, bboxPrev, thDisplacementConvergence_) &&
+        feature.residue_ < thMaxResidue_)
+    {
+      return FeatureData::OK;
+    }
+  }
+  return FeatureData::MaxIterations;
 }
 
 void FeatureRefinerKLT::refineFeatures(
@@ -523,102 +842,86 @@ void FeatureRefinerKLT::refineFeatures(
     core::savepgm("srcimg.pgm", core::equalize(src.smooth_, 0, 255));
   }
 
-  // local images
-  const int fw=FeatureData::width();
-  const int fh=FeatureData::height();
-  core::Image gwgx(fw,fh, 4);  // geometrically warped gradient x
-  core::Image gwgy(fw,fh, 4);  // geometrically warped gradient y
-  core::Image gwimg(fw,fh, 4); // geometrically warped image
-
-  std::unique_ptr<LKTracker> plk(createLKTracker(fw/2,fh/2, warpModel_));
-
-  // TODO this was removed coz of xeon phi gcc 4.7
-  //#pragma omp parallel for
+  // resolve the features before going parallel, the store must not be touched in the loop
+  struct WorkItem {
+    int fid;
+    core::Point pt;
+    FeatureData* feature;
+  };
+  std::vector<WorkItem> work;
+  work.reserve(pts.size());
   for (auto q : pts){
-    FeatureData& feature=map_[q.first];
-    feature.setpos(q.second.x_,q.second.y_);
+    work.push_back(WorkItem{q.first, q.second, &find(q.first)});
+  }
 
-    // check bounding box
-    std::vector<core::Point> bboxInitial=feature.bbox();
-    if (testOutOfBoundary(bboxInitial, src.rows(),src.cols())){
-      feature.status_=FeatureData::OutOfBounds;
-      continue;
+  // every thread refines with its own scratch images and tracker
+  const int fw=FeatureData::width();
+  const int fh=FeatureData::height();
+  #pragma omp parallel
+  {
+    Workspace ws(fw,fh, warpModel_);
+    #pragma omp for schedule(dynamic, 32)
+    for (int i=0; i<(int)work.size(); ++i){
+      refineFeature(src, work[i].fid, work[i].pt, *work[i].feature, ws);
     }
+  }
+}
 
-    // iterate until convergence or failure
-    feature.status_=FeatureData::MaxIterations;
-    std::vector<core::Point> bboxCur(bboxInitial);
-    for (int iteration=0; iteration<thMaxIterations_; ++iteration){
-      // compute error
-      computeWarpedGradient(src, feature, gwgx, gwgy);
-      feature.residue_=computeError(src, feature, gwimg);
-      if(iteration == 0)
-        feature.first_residue_ = feature.residue_;
-
-
-      // LK tracking
-      std::vector<double> improvement = plk->track(
-         gwgx.pcbits<float>(),
-         gwgy.pcbits<float>(),
-         feature.error_.pcbits<float>(),
-         gwimg.pcbits<float>(), feature.lambda());
-      if (improvement.size()==0){
-        feature.status_=FeatureData::SmallDet;
-        break;
-      }
-      if (verbose_){
-        reportIteration(q.first, iteration, feature, improvement);
-      }
-      for (size_t i=0; i<improvement.size(); ++i){
-        feature.warp_[i]+=improvement[i]*optimizationFactor_;
-      }
+void FeatureRefinerKLT::refineFeature(
+  const core::ImageSet& src, int fid, const core::Point& pt,
+  FeatureData& feature, Workspace& ws) const
+{
+  feature.setpos(pt.x_,pt.y_);
 
-      // check bounding box
-      std::vector<core::Point> bboxPrev(std::move(bboxCur));
-      bboxCur=feature.bbox();
-      if (testOutOfBoundary(bboxCur, src.rows(),src.cols())){
-        feature.status_=FeatureData::OutOfBounds;
-        break;
-      }
+  // check bounding box
+  std::vector<core::Point> bboxInitial=feature.bbox();
+  if (testOutOfBoundary(bboxInitial, src.rows(),src.cols())){
+    feature.status_=FeatureData::OutOfBounds;
+    return;
+  }
 
-      // check convergence
-      if (testConvergence(bboxCur, bboxPrev, thDisplacementConvergence_) &&
-          feature.residue_ < thMaxResidue_)
-      {
-        feature.status_ = FeatureData::OK;
-        break;
-      }
+  // coarse-to-fine, every level starts from the warp of the level above,
+  // a level that does not converge hands down the warp it was started with
+  const int levels=std::min(feature.levels(), src.levels());
+  feature.setpos(toLevel(pt.x_, levels-1), toLevel(pt.y_, levels-1));
+  for (int level=levels-1; level>0; --level){
+    double warp[8];
+    std::copy(feature.warp_, feature.warp_+8, warp);
+    int status=refineLevel(src, level, fid, feature, ws);
+    if (status!=FeatureData::OK){
+      std::copy(warp, warp+8, feature.warp_);
     }
+    feature.setpos(toFinerLevel(feature.posx()), toFinerLevel(feature.posy()));
+  }
+  feature.status_=refineLevel(src, 0, fid, feature, ws);
 
-    if (feature.status_ == FeatureData::OK){
-      // check divergence
-      if (testDivergence(bboxCur, bboxInitial, thDisplacementDivergence_)){
-        feature.status_=FeatureData::NotFound;
-      }
-      feature.residue_=computeError(src, feature, gwimg);
-      // check residue
-      if (feature.residue_>=thMaxResidue_){
-        feature.status_=FeatureData::LargeResidue;
-      }
+  if (feature.status_ == FeatureData::OK){
+    // check divergence, in full resolution pixels whatever the number of levels
+    std::vector<core::Point> bboxCur=feature.bbox();
+    if (testDivergence(bboxCur, bboxInitial, thDisplacementDivergence_)){
+      feature.status_=FeatureData::NotFound;
     }
-    // TODO
-    // check if the final residue is worse then initial
-    //if (feature.status_ == FeatureData::OK){
-    //  if(feature.residue_ > feature.first_residue_)
-    //    std::cout << "[FeatureRefinerKLT] First residue -> New residue: " << feature.first_residue_
-    //              << " -> " << feature.residue_ << "\n";
-    //}
-
-    if (verbose_){
-      std::ostringstream oss;
-      oss <<"F" <<q.first <<"S" <<feature.status_
-          <<"@" <<feature.pt() <<"R" <<feature.residue_ <<"\n";
-      std::cerr <<oss.str() <<"\n";
+    feature.residue_=computeError(src.smooth_, feature.ref_, feature, ws.gwimg);
+    // check residue
+    if (feature.residue_>=thMaxResidue_){
+      feature.status_=FeatureData::LargeResidue;
     }
   }
-  return;
+  // TODO
+  // check if the final residue is worse then initial
+  //if (feature.status_ == FeatureData::OK){
+  //  if(feature.residue_ > feature.first_residue_)
+  //    std::cout << "[FeatureRefinerKLT] First residue -> New residue: " << feature.first_residue_
+  //              << " -> " << feature.residue_ << "\n";
+  //}
+
+  if (verbose_){
+    std::ostringstream oss;
+    oss <<"F" <<fid <<"S" <<feature.status_
+        <<"@" <<feature.pt() <<"R" <<feature.residue_ <<"\n";
+    std::cerr <<oss.str() <<"\n";
+  }
 }
 
 }
 }
-
@@ -16,10 +16,15 @@ class FeatureRefinerKLT:
   const double thDisplacementConvergence_ = 0.01;   // try to decrease, default: 0.01
   const double thDisplacementDivergence_ = 5;
   const bool   verbose_=false;
+  const bool   inverseCompositional_;   // constant Hessian steps, forward additive if false
+  const int    levels_;                 // pyramid levels, 1 - single scale
 
 std::vector<core::Image> gwimg_;
 public:
+  explicit FeatureRefinerKLT(int levels=1, bool inverseCompositional=true);
+
   virtual void config(const std::string& conf);
+  virtual int levels() const { return levels_; }
 
   virtual void addFeatures(
     const core::ImageSet& src,
@@ -28,6 +33,22 @@ public:
   virtual void refineFeatures(
     const core::ImageSet& src,
     const std::map<int, core::Point>& pts);
+
+private:
+  struct Workspace;
+  // refines one feature from the predicted position pt
+  void refineFeature(
+    const core::ImageSet& src, int fid, const core::Point& pt,
+    FeatureData& feature, Workspace& ws) const;
+  // iterates the feature warp on one pyramid level, returns the status
+  int refineLevel(
+    const core::ImageSet& src, int level, int fid,
+    FeatureData& feature, Workspace& ws) const;
+  // inverse compositional iterations for a warp model with N parameters
+  template <int N>
+  int refineLevelInverse(
+    const core::ImageSet& src, int level, int fid,
+    FeatureData& feature, Workspace& ws) const;
 };
 
 }
@@ -13,7 +13,8 @@ void FeatureRefinerMock::addFeatures(
   const std::map<int, core::Point>& pts)
 {
   for (auto x : pts){
-    map_.insert(std::make_pair(x.first, FeatureData(x.second.x_, x.second.y_)));
+    if (!featureExists(x.first))
+      insert(x.first).reset(x.second.x_, x.second.y_);
   }
 }
 
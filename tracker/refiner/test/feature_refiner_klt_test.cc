@@ -0,0 +1,96 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <map>
+
+#include "../feature_refiner_klt.h"
+
+using track::refiner::FeatureData;
+using track::refiner::FeatureRefinerKLT;
+
+namespace {
+
+const int kRows = 160, kCols = 160;
+const double kPi = 3.14159265358979;
+
+// smooth texture with structure on several scales, shifted by (dx, dy)
+core::Image MakeTexture(double dx, double dy, double phase = 0.0)
+{
+  core::Image img(kRows, kCols, 1);
+  for (int r = 0; r < kRows; r++) {
+    for (int c = 0; c < kCols; c++) {
+      double x = c - dx, y = r - dy;
+      double val = 128.0 + 40.0 * std::sin(2*kPi*x/31.0 + 0.3 + phase) * std::cos(2*kPi*y/23.0)
+                   + 30.0 * std::sin(2*kPi*(x + y)/47.0 + phase)
+                   + 20.0 * std::cos(2*kPi*(x - 2*y)/37.0 - phase);
+      img(r, c) = static_cast<uint8_t>(std::round(val));
+    }
+  }
+  return img;
+}
+
+// refines the feature at (80, 80) of the unshifted texture in img, started at the old position
+FeatureData Refine(int levels, const core::Image& img, bool inverse_compositional = true)
+{
+  core::ImageSetExact ref_set, img_set;
+  ref_set.numLevels_ = levels;
+  img_set.numLevels_ = levels;
+  ref_set.compute(MakeTexture(0.0, 0.0));
+  img_set.compute(img);
+  FeatureRefinerKLT klt(levels, inverse_compositional);
+  std::map<int, core::Point> pts = {{0, core::Point(80.0, 80.0)}};
+  klt.addFeatures(ref_set, pts);
+  klt.refineFeatures(img_set, pts);
+  return klt.getFeature(0);
+}
+
+// a shift of several pixels is found through the coarse levels
+TEST(FeatureRefinerPyramidTest, LargeDisplacementConverges)
+{
+  const double dx = 2.6, dy = 1.7;
+  FeatureData feature = Refine(3, MakeTexture(dx, dy));
+  EXPECT_EQ(feature.status_, FeatureData::OK);
+  EXPECT_NEAR(feature.posx(), 80.0 + dx, 0.05);
+  EXPECT_NEAR(feature.posy(), 80.0 + dy, 0.05);
+}
+
+// the true match is found but it moved too far, the divergence test is in full resolution
+// pixels and the pyramid does not loosen it
+TEST(FeatureRefinerPyramidTest, FarMatchIsRejected)
+{
+  FeatureData feature = Refine(3, MakeTexture(6.5, 4.5));
+  EXPECT_NE(feature.status_, FeatureData::OK);
+}
+
+// a different texture is no match at all
+TEST(FeatureRefinerPyramidTest, WrongTextureIsRejected)
+{
+  FeatureData feature = Refine(3, MakeTexture(0.0, 0.0, 2.0));
+  EXPECT_NE(feature.status_, FeatureData::OK);
+}
+
+// the inverse compositional steps solve the same problem as the forward additive ones
+TEST(FeatureRefinerKLTTest, InverseCompositionalMatchesForwardAdditive)
+{
+  const double shifts[][2] = { {0.4, -0.3}, {1.2, 0.9}, {-2.3, 0.6}, {1.8, -2.1} };
+  for (const auto& shift : shifts) {
+    for (int levels = 1; levels <= 3; levels += 2) {
+      core::Image img = MakeTexture(shift[0], shift[1]);
+      FeatureData ic = Refine(levels, img, true);
+      FeatureData fa = Refine(levels, img, false);
+      EXPECT_EQ(ic.status_, FeatureData::OK);
+      EXPECT_EQ(fa.status_, FeatureData::OK);
+      EXPECT_NEAR(ic.posx(), fa.posx(), 0.02);
+      EXPECT_NEAR(ic.posy(), fa.posy(), 0.02);
+      EXPECT_NEAR(ic.posx(), 80.0 + shift[0], 0.05);
+      EXPECT_NEAR(ic.posy(), 80.0 + shift[1], 0.05);
+    }
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
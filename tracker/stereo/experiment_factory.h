@@ -26,7 +26,10 @@
 //#include "../stereo/stereo_tracker_libviso.h"
 #include "../stereo/stereo_tracker_bfm.h"
 #include "../stereo/stereo_tracker.h"
+#ifdef WITH_CUDA
 #include "../stereo/stereo_tracker_orb.h"
+#endif
+#include "../stereo/stereo_tracker_orb_cpu.h"
 #include "../stereo/stereo_tracker_freak.h"
 #include "../stereo/stereo_tracker_artificial.h"
 #include "../stereo/stereo_tracker_refiner.h"
@@ -34,6 +37,7 @@
 #include "../detector/feature_detector_harris_cv.h"
 //#include "../detector/feature_detector_harris_freak.h"
 #include "../detector/feature_detector_uniform.h"
+#include "../detector/feature_detector_harris_grid.h"
 #include "../detector/feature_detector_agast.h"
 //#include "../../stereo_egomotion/extern/libviso2/src/viso_stereo.h"
 #include "../../optimization/bundle_adjustment/bundle_adjuster.h"
@@ -111,6 +115,11 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
   std::string egomotion_method_name;
   int ransac_iters;
   double ransac_threshold;
+  double ransac_confidence;
+  bool use_prosac = false;
+  int preemption_block = 0;
+  bool use_ceres_refinement = false;
+  uint64_t ransac_seed = 0;
   std::string loss_function_type;
   double robust_loss_scale;
   bool use_weighting = false;
@@ -128,6 +137,7 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
   int freak_max_dist_stereo = 0;
 
   std::string refiner_tracker_name;
+  int refiner_pyramid_levels = 1;
   int stereo_wsz;
   double ncc_threshold_stereo;
   bool estimate_subpixel = true;
@@ -139,6 +149,7 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
   int hamming_threshold;
   int ncc_patch_size;
   int search_wsz;
+  int prior_search_wsz = 0;
   double stm_q;
   double stm_a;
   bool match_with_oldest = true;
@@ -169,6 +180,11 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
       ("egomotion_method", po::value<std::string>(&egomotion_method_name)->required())
       ("ransac_iters", po::value<int>(&ransac_iters)->required())
       ("ransac_threshold", po::value<double>(&ransac_threshold)->required())
+      ("ransac_confidence", po::value<double>(&ransac_confidence)->default_value(0.999))
+      ("use_prosac", po::value<bool>(&use_prosac)->default_value(false))
+      ("preemption_block", po::value<int>(&preemption_block)->default_value(0))
+      ("use_ceres_refinement", po::value<bool>(&use_ceres_refinement)->default_value(false))
+      ("ransac_seed", po::value<uint64_t>(&ransac_seed)->default_value(0))
       ("loss_function_type", po::value<std::string>(&loss_function_type))
       ("robust_loss_scale", po::value<double>(&robust_loss_scale))
       ("use_weighting", po::value<bool>(&use_weighting)->required())
@@ -186,6 +202,7 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
       ("orb_max_dist_mono", po::value<int>(&orb_max_dist_mono))
 
       ("refiner_tracker", po::value<std::string>(&refiner_tracker_name))
+      ("refiner_pyramid_levels", po::value<int>(&refiner_pyramid_levels)->default_value(1))
       ("stereo_wsz", po::value<int>(&stereo_wsz))
       ("ncc_threshold_s", po::value<double>(&ncc_threshold_stereo))
       ("estimate_subpixel", po::value<bool>(&estimate_subpixel)->default_value(false))
@@ -195,6 +212,7 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
       ("hamming_threshold", po::value<int>(&hamming_threshold)->default_value(0))
       ("ncc_patch_size", po::value<int>(&ncc_patch_size)->default_value(0))
       ("search_wsz", po::value<int>(&search_wsz)->default_value(0))
+      ("prior_search_wsz", po::value<int>(&prior_search_wsz)->default_value(0))
       ("tracker_stm", po::value<std::string>(&stm_tracker_name))
       ("stm_q", po::value<double>(&stm_q))
       ("stm_a", po::value<double>(&stm_a))
@@ -270,6 +288,9 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
     param.calib.cv = cam_params[3]; // principal point (v-coordinate) in pixels
     param.base = cam_params[4];
     param.ransac_iters = ransac_iters;           // def: 100
+    param.ransac_confidence = ransac_confidence;
+    param.use_prosac = use_prosac;
+    param.random_seed = ransac_seed;
     param.reweighting = use_weighting;
     std::cout << "Feature weighting = " << use_weighting << "\n";
     std::cout << "Deformation field = " << use_deformation_field << "\n";
@@ -293,6 +314,11 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
   else if (egomotion_method_name == "EgomotionRansac") {
     egomotion::EgomotionRansac::Parameters params;
     params.ransac_iters = ransac_iters;
+    params.ransac_confidence = ransac_confidence;
+    params.use_prosac = use_prosac;
+    params.preemption_block = preemption_block;
+    params.use_ceres_refinement = use_ceres_refinement;
+    params.random_seed = ransac_seed;
     params.inlier_threshold = ransac_threshold;
     params.loss_function_type = loss_function_type;
     params.robust_loss_scale = robust_loss_scale;
@@ -334,13 +360,19 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
     *feature_detector = new track::FeatureDetectorUniform(detector_base, horizontal_bins,
                                                           vertical_bins, features_per_bin);
   }
+  else if(detector_name == "FeatureDetectorHarrisGrid") {
+    *feature_detector = new track::FeatureDetectorHarrisGrid(harris_block_sz, harris_filter_sz,
+        harris_k, harris_thr, harris_margin, horizontal_bins,
+        vertical_bins, features_per_bin);
+  }
   else
     std::cout << "[ExperimentFactory]: No detector...\n";
 
   // create mono tracker
   if(mono_tracker_name == "TrackerBFM")
     *mono_tracker = new track::TrackerBFM(**feature_detector, max_features, ncc_threshold_mono,
-                                          ncc_patch_size, search_wsz, match_with_oldest);
+                                          ncc_patch_size, search_wsz, match_with_oldest,
+                                          prior_search_wsz);
   else if(mono_tracker_name == "TrackerBFMcv")
     *mono_tracker = new track::TrackerBFMcv(**feature_detector, max_features, search_wsz,
                                             hamming_threshold);
@@ -368,6 +400,7 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
     //                                                orb_num_levels, orb_max_dist_stereo,
     //                                                orb_max_dist_mono);
   }
+#ifdef WITH_CUDA
   else if(stereo_tracker_name == "StereoTrackerORB") {
     //*stereo_tracker = new track::StereoTrackerORB(max_features, 100, 1.0, 200, 40, 21, 1.1, 1, 30, 30);
     *stereo_tracker = new track::StereoTrackerORB(max_features, max_xdiff, 1.0, max_disparity,
@@ -375,6 +408,13 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
                                                   orb_num_levels, orb_max_dist_stereo,
                                                   orb_max_dist_mono);
   }
+#endif
+  else if(stereo_tracker_name == "StereoTrackerORBcpu") {
+    *stereo_tracker = new track::StereoTrackerORBcpu(max_features, max_xdiff, 1.0, max_disparity,
+                                                     40, orb_patch_size, orb_scale_factor,
+                                                     orb_num_levels, orb_max_dist_stereo,
+                                                     orb_max_dist_mono);
+  }
   else if(stereo_tracker_name == "StereoTracker") {
     *stereo_tracker = new track::StereoTracker(**mono_tracker, max_disparity, stereo_wsz,
                                                ncc_threshold_stereo, estimate_subpixel,
@@ -388,11 +428,13 @@ bool ExperimentFactory::create_experiment(const std::string config_file,
                                                  use_deformation_field, deformation_field_path);
     else return false;
     *stereo_tracker = new track::StereoTrackerRefiner(refiner_tracker,
-                                                      new track::refiner::FeatureRefinerKLT, true);
+                                                      new track::refiner::FeatureRefinerKLT(refiner_pyramid_levels),
+                                                      true);
   } 
   else if(stereo_tracker_name == "StereoTrackerBFM") {
     *stereo_tracker = new track::StereoTrackerBFM(*feature_detector, max_features,
-                                                  ncc_threshold_stereo, ncc_patch_size, search_wsz);
+                                                  ncc_threshold_stereo, ncc_patch_size, search_wsz,
+                                                  prior_search_wsz);
   }
   else if(stereo_tracker_name == "StereoTrackerLibviso") {
     throw 1;
@@ -501,8 +543,13 @@ bool ExperimentFactory::CreateValidationORB(int patch_size, int num_levels,
   int max_features = 4096;
   int max_xdiff = 100;
   int max_disparity = 120;
+#ifdef WITH_CUDA
   *stereo_tracker = std::make_shared<track::StereoTrackerORB>(max_features, max_xdiff, 0,
       max_disparity, 40, patch_size, scale_factor, num_levels, max_dist_stereo, max_dist_mono);
+#else
+  *stereo_tracker = std::make_shared<track::StereoTrackerORBcpu>(max_features, max_xdiff, 0,
+      max_disparity, 40, patch_size, scale_factor, num_levels, max_dist_stereo, max_dist_mono);
+#endif
 
   return true;
 }
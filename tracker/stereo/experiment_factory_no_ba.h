@@ -27,6 +27,7 @@
 #include "../detector/feature_detector_harris_cv.h"
 #include "../detector/feature_detector_harris_freak.h"
 #include "../detector/feature_detector_uniform.h"
+#include "../detector/feature_detector_harris_grid.h"
 
 namespace track
 {
@@ -65,6 +66,7 @@ static void ExperimentFactory::create_experiment(const std::string& config_file,
 
   std::string stereo_tracker_name;
   std::string refiner_tracker_name;
+  int refiner_pyramid_levels = 1;
   int max_disparity;
   int stereo_wsz;
   double ncc_threshold_stereo;
@@ -108,6 +110,7 @@ static void ExperimentFactory::create_experiment(const std::string& config_file,
 
       ("tracker", po::value<std::string>(&stereo_tracker_name))
       ("refiner_tracker", po::value<std::string>(&refiner_tracker_name))
+      ("refiner_pyramid_levels", po::value<int>(&refiner_pyramid_levels)->default_value(1))
       ("max_disparity", po::value<int>(&max_disparity))
       ("stereo_wsz", po::value<int>(&stereo_wsz))
       ("ncc_threshold_s", po::value<double>(&ncc_threshold_stereo))
@@ -206,6 +209,10 @@ static void ExperimentFactory::create_experiment(const std::string& config_file,
                                                            harris_k, harris_thr, harris_margin);
     *feature_detector = new track::FeatureDetectorUniform(detector_base, 15, 5, 15);
   }
+  else if(detector_name == "FeatureDetectorHarrisGrid") {
+    *feature_detector = new track::FeatureDetectorHarrisGrid(harris_block_sz, harris_filter_sz,
+        harris_k, harris_thr, harris_margin, 15, 5, 15);
+  }
   else
     std::cout << "[ExperimentFactory]: No detector...\n";
 
@@ -244,7 +251,8 @@ static void ExperimentFactory::create_experiment(const std::string& config_file,
                                                   ncc_threshold_stereo, estimate_subpixel);
     else throw "Error";
     *stereo_tracker = new track::StereoTrackerRefiner(refiner_tracker,
-                                                      new track::refiner::FeatureRefinerKLT, true);
+                                                      new track::refiner::FeatureRefinerKLT(refiner_pyramid_levels),
+                                                      true);
   } 
   else if(stereo_tracker_name == "StereoTrackerBFM") {
     *stereo_tracker = new track::StereoTrackerBFM(*feature_detector, max_features, ncc_threshold_stereo, 
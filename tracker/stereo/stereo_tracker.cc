@@ -52,17 +52,16 @@ StereoTracker::StereoTracker(TrackerBase& tracker, int max_disparity, int stereo
       std::cout << "Deformation file missing!\n";
       throw 1;
     }
-    mat_file["left_dx"] >> left_dx_;
-    mat_file["left_dy"] >> left_dy_;
-    mat_file["right_dx"] >> right_dx_;
-    mat_file["right_dy"] >> right_dy_;
-    mat_file["img_rows"] >> img_rows_;
-    mat_file["img_cols"] >> img_cols_;
-
-    cell_width_ = (double)img_cols_ / left_dx_.cols;
-    cell_height_ = (double)img_rows_ / left_dx_.rows;
-
-    ComputeCellCenters();
+    cv::Mat left_dx, left_dy, right_dx, right_dy;
+    int img_rows, img_cols;
+    mat_file["left_dx"] >> left_dx;
+    mat_file["left_dy"] >> left_dy;
+    mat_file["right_dx"] >> right_dx;
+    mat_file["right_dy"] >> right_dy;
+    mat_file["img_rows"] >> img_rows;
+    mat_file["img_cols"] >> img_cols;
+    left_df_ = DeformationField(left_dx, left_dy, img_rows, img_cols);
+    right_df_ = DeformationField(right_dx, right_dy, img_rows, img_cols);
   }
 }
 
@@ -79,8 +78,6 @@ void StereoTracker::init(const cv::Mat& img_left, const cv::Mat& img_right) {
   //recon::StereoCosts::census_transform(img_right, stereo_wsz_, census_rcurr_);
   //recon::StereoCosts::compute_image_ncc_descriptors(img_rc_, stereo_wsz_, descriptors_rcurr_);
   img_size_ = img_left.rows * img_left.cols;
-  descriptors_rprev_.assign(img_size_, std::make_pair(false, core::DescriptorNCC()));
-  descriptors_rcurr_.assign(img_size_, std::make_pair(false, core::DescriptorNCC()));
   tracker_.init(img_lc_);
 }
 
@@ -111,32 +108,8 @@ void StereoTracker::track(const cv::Mat& img_left, const cv::Mat& img_right) {
   //  df_right_prev_ = df_right_curr_;
   //}
 
-  std::swap(descriptors_rprev_, descriptors_rcurr_);
-  #pragma omp parallel for
-  for (size_t i = 0; i <  descriptors_rcurr_.size(); i++)
-    descriptors_rcurr_[i].first = false;
-
-  // precompute the descriptors for all image pixels
-  //recon::StereoCosts::census_transform(img_right, stereo_wsz_, census_rcurr_);
-  //recon::StereoCosts::compute_image_ncc_descriptors(img_rc_, stereo_wsz_, descriptors_rcurr_);
   int alive_before = tracker_.countTracked();
 
-  // precompute NCC plain patch descriptors in current right image
-  //std::cout << "COMPUTE NCC begin\n";
-  for (int i = 0; i < tracker_.countFeatures(); i++) {
-    if (tracker_.isAlive(i)) {
-      FeatureInfo pts = tracker_.feature(i);
-      // if new only compute descriptors in previous image
-      if (pts.age_ == 1) {
-        // precompute any missing NCC plain patch descriptors in previous right image
-        AddMissingDescriptors(img_rp_, pts.prev_, stereo_wsz_, descriptors_rprev_);
-      }
-      // compute descriptors in current image
-      AddMissingDescriptors(img_rc_, pts.curr_, stereo_wsz_, descriptors_rcurr_);
-    }
-  }
-  //std::cout << "COMPUTE NCC end\n";
-
 #ifndef DEBUG_ON
   #pragma omp parallel for
 #endif
@@ -165,7 +138,7 @@ void StereoTracker::track(const cv::Mat& img_left, const cv::Mat& img_right) {
         }
         recon::StereoCosts::compute_ncc_descriptor<PixelType>(img_lp_, left_feat.prev_, stereo_wsz_,
                                                               kPixelTypeOpenCV, ncc_desc);
-        ok = stereo_match_ncc(ncc_desc, descriptors_rprev_, left_feat.prev_, img_rp_, debug,
+        ok = stereo_match_ncc(ncc_desc, left_feat.prev_, img_rp_, debug,
                               pts_right_prev_[i]);
         if(!ok) {
           tracker_.removeTrack(i);
@@ -181,7 +154,7 @@ void StereoTracker::track(const cv::Mat& img_left, const cv::Mat& img_right) {
       // find disparity for in current
       recon::StereoCosts::compute_ncc_descriptor<PixelType>(img_lc_, left_feat.curr_, stereo_wsz_,
                                                             kPixelTypeOpenCV, ncc_desc);
-      ok = stereo_match_ncc(ncc_desc, descriptors_rcurr_, left_feat.curr_, img_rc_, debug,
+      ok = stereo_match_ncc(ncc_desc, left_feat.curr_, img_rc_, debug,
                             pts_right_curr_[i]);
       if(!ok)
         tracker_.removeTrack(i);
@@ -190,19 +163,6 @@ void StereoTracker::track(const cv::Mat& img_left, const cv::Mat& img_right) {
         if (left_feat.age_ == 1)
           pts_left_prev_[i] = left_feat.prev_;
         pts_left_curr_[i] = left_feat.curr_;
-        // Apply deformation field
-        if (use_deformation_field_) {
-          if (left_feat.age_ == 1) {
-            df_left_prev_[i] = pts_left_prev_[i];
-            df_right_prev_[i] = pts_right_prev_[i];
-            ApplyDeformationField(left_dx_, left_dy_, df_left_prev_[i]);
-            ApplyDeformationField(right_dx_, right_dy_, df_right_prev_[i]);
-          }
-          df_left_curr_[i] = pts_left_curr_[i];
-          df_right_curr_[i] = pts_right_curr_[i];
-          ApplyDeformationField(left_dx_, left_dy_, df_left_curr_[i]);
-          ApplyDeformationField(right_dx_, right_dy_, df_right_curr_[i]);
-        }
       }
     }
   }
@@ -214,9 +174,47 @@ void StereoTracker::track(const cv::Mat& img_left, const cv::Mat& img_right) {
       alive_after++;
   }
   assert(alive_after <= alive_before);
+
+  // Apply deformation field to all current points at once, the previous points of the older
+  // tracks were corrected in the last frame and only the new tracks need it
+  if (use_deformation_field_) {
+    df_left_curr_ = pts_left_curr_;
+    df_right_curr_ = pts_right_curr_;
+    left_df_.Apply(df_left_curr_);
+    right_df_.Apply(df_right_curr_);
+    for (int i = 0; i < max_feats_; i++) {
+      if (age_[i] == 1) {
+        df_left_prev_[i] = pts_left_prev_[i];
+        df_right_prev_[i] = pts_right_prev_[i];
+        left_df_.Apply(df_left_prev_[i]);
+        right_df_.Apply(df_right_prev_[i]);
+      }
+    }
+  }
   std::cout << "[StereoTracker]: Matched = " << alive_after << " / " << alive_before << "\n";
 }
 
+void StereoTracker::SetMotionPrior(const MotionPrior& prior) {
+  if (!prior.valid())
+    return;
+  std::vector<core::Point> predicted(max_feats_);
+  std::vector<bool> has_prediction(max_feats_, false);
+  core::Point predicted_right;
+  // the prior motion was estimated from the corrected points, so it is applied to them and
+  // the prediction is mapped back to the raw image where the tracker searches
+  const std::vector<core::Point>& left = use_deformation_field_ ? df_left_curr_ : pts_left_curr_;
+  const std::vector<core::Point>& right = use_deformation_field_ ? df_right_curr_ : pts_right_curr_;
+  for (int i = 0; i < max_feats_; i++) {
+    // the current stereo matches are known only for the live tracks
+    if (age_[i] > 0) {
+      has_prediction[i] = prior.Predict(left[i], right[i], predicted[i], predicted_right);
+      if (has_prediction[i] && use_deformation_field_)
+        left_df_.ApplyInverse(predicted[i]);
+    }
+  }
+  tracker_.setPrediction(predicted, has_prediction);
+}
+
 int StereoTracker::countFeatures() const {
    return max_feats_;
 }
@@ -258,6 +256,25 @@ FeatureInfo StereoTracker::featureRight(int i) const {
   return feat;
 }
 
+TrackBatch StereoTracker::GetTrackBatch() const {
+  const std::vector<core::Point>& lp = use_deformation_field_ ? df_left_prev_ : pts_left_prev_;
+  const std::vector<core::Point>& lc = use_deformation_field_ ? df_left_curr_ : pts_left_curr_;
+  const std::vector<core::Point>& rp = use_deformation_field_ ? df_right_prev_ : pts_right_prev_;
+  const std::vector<core::Point>& rc = use_deformation_field_ ? df_right_curr_ : pts_right_curr_;
+  TrackBatch batch;
+  batch.size = max_feats_;
+  batch.lp_x = ViewX(lp);
+  batch.lp_y = ViewY(lp);
+  batch.lc_x = ViewX(lc);
+  batch.lc_y = ViewY(lc);
+  batch.rp_x = ViewX(rp);
+  batch.rp_y = ViewY(rp);
+  batch.rc_x = ViewX(rc);
+  batch.rc_y = ViewY(rc);
+  batch.age = StridedView<int>(age_.data(), 1);
+  return FinishBatch(batch);
+}
+
 void StereoTracker::removeTrack(int id) {
   //if(age_[id] > 0) {
   //  age_acc_ += age_[id];
@@ -267,97 +284,6 @@ void StereoTracker::removeTrack(int id) {
   tracker_.removeTrack(id);
 }
 
-void StereoTracker::ComputeCellCenters() {
-  int rows = left_dx_.rows;
-  int cols = left_dx_.cols;
-  cell_centers_x_ = cv::Mat::zeros(rows, cols, CV_64F);
-  cell_centers_y_ = cv::Mat::zeros(rows, cols, CV_64F);
-  for (int i = 0; i < rows; i++) {
-    for (int j = 0; j < cols; j++) {
-      cell_centers_x_.at<double>(i,j) = (j * cell_width_) + (cell_width_ / 2.0);
-      cell_centers_y_.at<double>(i,j) = (i * cell_height_) + (cell_height_ / 2.0);
-    }
-  }
-  //std::cout << cell_centers_x_ << "\n\n" << cell_centers_y_ << "\n";
-}
-
-void StereoTracker::ApplyDeformationField(const cv::Mat& def_x, const cv::Mat& def_y,
-                                          core::Point& pt)
-{
-  double dx, dy;
-  // number of rows/cols in interpolation grid is smaller by 1
-  int rows = left_dx_.rows - 1;
-  int cols = left_dx_.cols - 1;
-  double half_width = cell_width_ / 2.0;
-  double half_height = cell_height_ / 2.0;
-  int real_row = static_cast<int>(pt.y_ / cell_height_);
-  int real_col = static_cast<int>(pt.x_ / cell_width_);
-  int row = static_cast<int>(std::floor((pt.y_ - half_height) / cell_height_));
-  int col = static_cast<int>(std::floor((pt.x_ - half_width) / cell_width_));
-  double cell_x = 0.0, cell_y = 0.0;
-  if (row >= 0)
-    cell_x = (pt.x_ - half_width) - (col * cell_width_);
-  if (col >= 0)
-    cell_y = (pt.y_ - half_height) - (row * cell_height_);
-
-  // compute bilinear interpolation
-  if (row >= 0 && row < rows && col >= 0 && col < cols) {
-    assert(cell_x >= 0.0 && cell_x <= cell_width_);
-    assert(cell_y >= 0.0 && cell_y <= cell_height_);
-    InterpolateBilinear(def_x, row, col, cell_x, cell_y, dx);
-    InterpolateBilinear(def_y, row, col, cell_x, cell_y, dy);
-  }
-  // compute left-right liner interpolation on horizontal edges
-  else if ((row < 0 || row >= rows) && (col >= 0 || col < cols)) {
-    assert(cell_x >= 0.0 && cell_x <= cell_width_);
-    double q1 = def_x.at<double>(real_row, col);
-    double q2 = def_x.at<double>(real_row, col+1);
-    InterpolateLinear(q1, q2, cell_x, cell_width_, dx);
-    q1 = def_y.at<double>(real_row, col);
-    q2 = def_y.at<double>(real_row, col+1);
-    InterpolateLinear(q1, q2, cell_x, cell_width_, dy);
-  }
-  // compute up-down linear interpolation on vertical edges
-  else if ((row >= 0 || row < rows) && (col < 0 || col >= cols)) {
-    assert(cell_y >= 0.0 && cell_y <= cell_height_);
-    double q1 = def_x.at<double>(row, real_col);
-    double q2 = def_x.at<double>(row+1, real_col);
-    InterpolateLinear(q1, q2, cell_y, cell_height_, dx);
-    q1 = def_y.at<double>(row, real_col);
-    q2 = def_y.at<double>(row+1, real_col);
-    InterpolateLinear(q1, q2, cell_y, cell_height_, dy);
-  }
-  // we can't interpolate on corners
-  else {
-    dx = left_dx_.at<double>(real_row, real_col);
-    dy = left_dy_.at<double>(real_row, real_col);
-  }
-  pt.x_ += dx;
-  pt.y_ += dy;
-}
-
-void StereoTracker::AddMissingDescriptors(const cv::Mat& img, const core::Point& point,
-    int window_size, std::vector<std::pair<bool, core::DescriptorNCC>>& descriptors) {
-  int y = int(point.y_);
-  //int min_x = std::max(margin_sz_, int(point.x_) - max_disparity);
-  int max_disp = std::min(max_disparity_, static_cast<int>(point.x_) - margin_sz_);
-  int row_start = y * img.cols;
-  int pt_x = static_cast<int>(point.x_);
-  //for (int x = pt_x; x >= min_x; x--) {
-  #pragma omp parallel for
-  for (int d = 0; d <= max_disp; d++) {
-    int x = pt_x - d;
-    //printf("%d\n", x);
-    int key = row_start + x;
-    // if descriptor is not already extracted do it
-    if (descriptors[key].first == false) {
-      descriptors[key].first = true;
-      recon::StereoCosts::compute_ncc_descriptor<PixelType>(img, x, y, window_size, kPixelTypeOpenCV,
-                                                            descriptors[key].second);
-    }
-  }
-}
-
 void StereoTracker::showTrack(int i) const
 {
   cv::Mat img_lp, img_lc, img_rp, img_rc;
@@ -16,6 +16,7 @@
 #include "stereo_tracker_base.h"
 #include "debug_helper.h"
 #include "../base/helper_opencv.h"
+#include "../base/deformation_field.h"
 #include "../mono/tracker_base.h"
 #include "../../core/image.h"
 #include "../../core/types.h"
@@ -32,9 +33,11 @@ class StereoTracker : public StereoTrackerBase
                 bool use_df, const std::string& deformation_field_path);
   virtual void init(const cv::Mat& img_left, const cv::Mat& img_right);
   virtual void track(const cv::Mat& img_left, const cv::Mat& img_right);
+  virtual void SetMotionPrior(const MotionPrior& prior);
   virtual int countFeatures() const;
   virtual FeatureInfo featureLeft(int i) const;
   virtual FeatureInfo featureRight(int i) const;
+  virtual TrackBatch GetTrackBatch() const;
   virtual void removeTrack(int id);
   virtual int countActiveTracks() const;
 
@@ -66,23 +69,10 @@ private:
       ar & pts_right_curr_;
   }
 
-  void AddMissingDescriptors(const cv::Mat& img, const core::Point& point, int window_size,
-                             std::vector<std::pair<bool, core::DescriptorNCC>>& descriptors_rprev_);
-
   bool stereo_match_ncc(const core::DescriptorNCC& desc_left,
-                        const std::vector<std::pair<bool, core::DescriptorNCC>>& descriptors_right,
                         const core::Point& left_pt, const cv::Mat& img_right,
                         bool debug, core::Point& right_pt);
 
-  // deformation field functions
-  void ComputeCellCenters();
-  void GetPointCell(const core::Point& pt, int& row, int& col);
-  void InterpolateBilinear(const cv::Mat& mat, const int row, const int col,
-                           const double x, const double y, double& ival);
-  void InterpolateLinear(const double val1, const double val2, const double x,
-                         const double size, double& ival);
-  void ApplyDeformationField(const cv::Mat& def_x, const cv::Mat& def_y, core::Point& pt);
-
   track::TrackerBase& tracker_;
   int max_feats_;
   int img_size_;
@@ -91,7 +81,6 @@ private:
   double ncc_thresh_;
   bool estimate_subpixel_;
   cv::Mat img_lp_, img_rp_, img_lc_, img_rc_;
-  std::vector<std::pair<bool, core::DescriptorNCC>> descriptors_rprev_, descriptors_rcurr_;
   //cv::Mat desc_rprev_, desc_rcurr_;
   //std::vector<double> distances_prev_, distances_curr_;
 
@@ -102,13 +91,7 @@ private:
   std::vector<core::Point> df_right_prev_, df_right_curr_;
 
   bool use_deformation_field_ = false; 
-  cv::Mat left_dx_, left_dy_;
-  cv::Mat right_dx_, right_dy_;
-  cv::Mat cell_centers_x_;
-  cv::Mat cell_centers_y_;
-  int img_rows_;
-  int img_cols_;
-  int cell_width_, cell_height_;
+  DeformationField left_df_, right_df_;
 };
 
 inline
@@ -130,28 +113,24 @@ FeatureData StereoTracker::getRightFeatureData(int i)
 
 inline
 bool StereoTracker::stereo_match_ncc(const core::DescriptorNCC& desc_left,
-                                     const std::vector<std::pair<bool, core::DescriptorNCC>>& descriptors_right,
                                      const core::Point& left_pt, const cv::Mat& img_right,
                                      bool debug, core::Point& right_pt)
 {
   bool success = false;
-  std::vector<double> costs;
-  costs.assign(max_disparity_, std::numeric_limits<double>::max());
   int x = static_cast<int>(left_pt.x_);
   int y = static_cast<int>(left_pt.y_);
-  //int min_x = std::max(margin_sz_, int(left_pt.x_) - max_disparity_);
   int max_disp = std::min(max_disparity_, static_cast<int>(left_pt.x_) - margin_sz_);
   int best_d = -1;
   double best_cost = 0.0;
-  //for (; x >= min_x; x--, d++) {
-  int row_start = y * img_right.cols;
-  #pragma omp parallel for
+  // NCC for the whole disparity range on the right scanline in one pass
+  std::vector<double> costs;
+  recon::StereoCosts::compute_ncc_scanline<PixelType>(desc_left, img_right, x, y, stereo_wsz_,
+                                                      max_disp, costs);
   for (int d = 0; d <= max_disp; d++) {
-    int key = row_start + x - d;
-    assert(descriptors_right[key].first == true);
-    const core::DescriptorNCC& desc_right = descriptors_right[key].second;
-    costs[d] = recon::StereoCosts::get_cost_NCC(desc_left, desc_right);
     if (debug) {
+      core::DescriptorNCC desc_right;
+      recon::StereoCosts::compute_ncc_descriptor<PixelType>(img_right, x - d, y, stereo_wsz_,
+                                                            kPixelTypeOpenCV, desc_right);
       printf("d = %d\nNCC = %f\n\b", d, costs[d]);
       HelperOpencv::DrawPoint(core::Point(left_pt.x_ - d, left_pt.y_), img_right, "right_point");
       HelperOpencv::DrawPoint(core::Point(left_pt.x_ - best_d, left_pt.y_), img_right, "best_right_point");
@@ -214,34 +193,6 @@ bool StereoTracker::stereo_match_ncc(const core::DescriptorNCC& desc_left,
   return success;
 }
 
-inline
-void StereoTracker::InterpolateBilinear(const cv::Mat& mat, const int row, const int col,
-                                               const double x, const double y, double& ival) {
-  double q1 = mat.at<double>(row, col);
-  double q2 = mat.at<double>(row, col+1);
-  double q3 = mat.at<double>(row+1, col);
-  double q4 = mat.at<double>(row+1, col+1);
-
-  double w = cell_width_;
-  double h = cell_height_;
-  double q12 = ((w-x) / w) * q1 + (x / w) * q2;
-  double q34 = ((w-x) / w) * q3 + (x / w) * q4;
-  ival = ((h-y) / h) * q12 + (y / h) * q34;
-}
-
-inline
-void StereoTracker::InterpolateLinear(const double val1, const double val2, const double x,
-                                             const double size, double& ival) {
-  ival = ((size - x) / size) * val1 + (x / size) * val2;
-}
-
-inline
-void StereoTracker::GetPointCell(const core::Point& pt, int& row, int& col) {
-  col = pt.x_ / cell_width_;
-  row = pt.y_ / cell_height_;
-  //int bin_num = row * bin_cols_ + col;
-}
-
 //inline
 //bool StereoTracker::stereo_match_census(int max_disparity, int margin_sz, uint32_t census,
 //                                        const cv::Mat& census_img,
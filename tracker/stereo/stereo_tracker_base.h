@@ -1,12 +1,45 @@
 #ifndef STEREO_TRACKER_BASE_
 #define STEREO_TRACKER_BASE_
 
+#include <vector>
+
 #include "../base/types.h"
+#include "../base/motion_prior.h"
 #include "../../core/image.h"
 #include "../../core/types.h"
 
 namespace track {
 
+// Read-only view with a stride over a field of the tracker's own arrays, so point storage
+// like std::vector<core::Point> or std::vector<FeatureInfo> can be exposed without copies.
+template<typename T>
+struct StridedView {
+  const T* data = nullptr;
+  int stride = 1;
+
+  StridedView() {}
+  StridedView(const T* ptr, int step) : data(ptr), stride(step) {}
+  const T& operator[](int i) const { return data[i*stride]; }
+};
+
+// Columnar view of all tracks: point coordinates in the left/right previous/current frame,
+// the ages and the indices of live tracks (age > 0) in increasing order.
+// It points into memory owned by the tracker and is valid until its next init, track or
+// removeTrack call.
+struct TrackBatch {
+  int size = 0;
+  StridedView<double> lp_x, lp_y, lc_x, lc_y;
+  StridedView<double> rp_x, rp_y, rc_x, rc_y;
+  StridedView<int> age;
+  const int* live = nullptr;
+  int live_count = 0;
+
+  core::Point leftPrev(int i) const { return core::Point(lp_x[i], lp_y[i]); }
+  core::Point leftCurr(int i) const { return core::Point(lc_x[i], lc_y[i]); }
+  core::Point rightPrev(int i) const { return core::Point(rp_x[i], rp_y[i]); }
+  core::Point rightCurr(int i) const { return core::Point(rc_x[i], rc_y[i]); }
+};
+
 class StereoTrackerBase {
  public:
   virtual void init(core::Image& img_left, core::Image& img_right) {
@@ -29,6 +62,9 @@ class StereoTrackerBase {
     (void)img_right;
     throw 1;
   }
+  // Motion prior for the next track() call only, trackers which support it search for each
+  // live track in a small window around its predicted position, the others ignore it.
+  virtual void SetMotionPrior(const MotionPrior& prior) { (void)prior; }
   virtual int countFeatures() const = 0;
   virtual FeatureInfo featureLeft(int i) const = 0;
   virtual FeatureInfo featureRight(int i) const = 0;
@@ -40,14 +76,87 @@ class StereoTrackerBase {
   virtual const FeatureInfo& LeftTrack(int i) const { throw 1; }
   virtual const FeatureInfo& RightTrack(int i) const { throw 1; }
 
+  // Batch access to all tracks, trackers which keep their points in core::Point or
+  // FeatureInfo arrays expose them directly, the default gathers them once per call.
+  virtual TrackBatch GetTrackBatch() const;
+
   virtual FeatureData getLeftFeatureData(int) { throw "Error"; }
   virtual FeatureData getRightFeatureData(int) { throw "Error"; }
   virtual void showTrack(int) const { throw 1; }
   virtual int countActiveTracks() const { throw 1; }
 
   virtual ~StereoTrackerBase() {}
+
+ protected:
+  static StridedView<double> ViewX(const std::vector<core::Point>& pts) {
+    return StridedView<double>(pts.empty() ? nullptr : &pts[0].x_, kPointStride);
+  }
+  static StridedView<double> ViewY(const std::vector<core::Point>& pts) {
+    return StridedView<double>(pts.empty() ? nullptr : &pts[0].y_, kPointStride);
+  }
+  static StridedView<double> ViewX(const std::vector<FeatureInfo>& feats, core::Point FeatureInfo::*pt) {
+    return StridedView<double>(feats.empty() ? nullptr : &(feats[0].*pt).x_, kFeatureStride);
+  }
+  static StridedView<double> ViewY(const std::vector<FeatureInfo>& feats, core::Point FeatureInfo::*pt) {
+    return StridedView<double>(feats.empty() ? nullptr : &(feats[0].*pt).y_, kFeatureStride);
+  }
+  static StridedView<int> ViewAge(const std::vector<FeatureInfo>& feats) {
+    return StridedView<int>(feats.empty() ? nullptr : &feats[0].age_, sizeof(FeatureInfo) / sizeof(int));
+  }
+  // collects the live tracks of a batch whose views are already set
+  TrackBatch FinishBatch(TrackBatch& batch) const {
+    batch_live_.clear();
+    for (int i = 0; i < batch.size; i++)
+      if (batch.age[i] > 0)
+        batch_live_.push_back(i);
+    batch.live = batch_live_.data();
+    batch.live_count = batch_live_.size();
+    return batch;
+  }
+
+  static constexpr int kPointStride = sizeof(core::Point) / sizeof(double);
+  static constexpr int kFeatureStride = sizeof(FeatureInfo) / sizeof(double);
+  static_assert(sizeof(core::Point) % sizeof(double) == 0 && sizeof(FeatureInfo) % sizeof(double) == 0,
+                "point arrays need a whole number of doubles per element");
+
+  // storage of the gathered batch and the live list
+  mutable std::vector<double> batch_coords_;
+  mutable std::vector<int> batch_ages_, batch_live_;
 };
 
+inline
+TrackBatch StereoTrackerBase::GetTrackBatch() const {
+  const int n = countFeatures();
+  batch_coords_.resize(8*n);
+  batch_ages_.resize(n);
+  double* coords = batch_coords_.data();
+  for (int i = 0; i < n; i++) {
+    FeatureInfo left = featureLeft(i);
+    FeatureInfo right = featureRight(i);
+    coords[0*n + i] = left.prev_.x_;
+    coords[1*n + i] = left.prev_.y_;
+    coords[2*n + i] = left.curr_.x_;
+    coords[3*n + i] = left.curr_.y_;
+    coords[4*n + i] = right.prev_.x_;
+    coords[5*n + i] = right.prev_.y_;
+    coords[6*n + i] = right.curr_.x_;
+    coords[7*n + i] = right.curr_.y_;
+    batch_ages_[i] = left.age_;
+  }
+  TrackBatch batch;
+  batch.size = n;
+  batch.lp_x = StridedView<double>(coords + 0*n, 1);
+  batch.lp_y = StridedView<double>(coords + 1*n, 1);
+  batch.lc_x = StridedView<double>(coords + 2*n, 1);
+  batch.lc_y = StridedView<double>(coords + 3*n, 1);
+  batch.rp_x = StridedView<double>(coords + 4*n, 1);
+  batch.rp_y = StridedView<double>(coords + 5*n, 1);
+  batch.rc_x = StridedView<double>(coords + 6*n, 1);
+  batch.rc_y = StridedView<double>(coords + 7*n, 1);
+  batch.age = StridedView<int>(batch_ages_.data(), 1);
+  return FinishBatch(batch);
+}
+
 }
 
 #endif
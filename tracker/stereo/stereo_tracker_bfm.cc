@@ -45,7 +45,7 @@ using namespace std;
 using namespace cv;
 
 StereoTrackerBFM::StereoTrackerBFM(FeatureDetectorBase* detector, int max_features, double min_crosscorr,
-                                   int patch_size, int window_size) :
+                                   int patch_size, int window_size, int prior_window_size) :
                                    detector_(detector), max_feats_(max_features),
                                    min_crosscorr_(min_crosscorr)
 {
@@ -67,6 +67,7 @@ StereoTrackerBFM::StereoTrackerBFM(FeatureDetectorBase* detector, int max_featur
   wsize_right_ = window_size / 2;
   wsize_up_ = window_size / 2;
   wsize_down_ = window_size / 2;
+  prior_wsize_ = prior_window_size / 2;
   use_smoothing_ = true;
 }
 
@@ -101,7 +102,8 @@ void StereoTrackerBFM::init(const cv::Mat& img_left, const cv::Mat& img_right)
   //vector<core::Point> mbest_left, mbest_right;
   cout << "matching init left-right:\n";
   matchFeatures(cvimg_lc_, cvimg_rc_, feats_left, feats_right, patches_left, patches_right, match_index,
-               EPIMATCH_LEFT, EPIMATCH_RIGHT, EPIMATCH_UP, EPIMATCH_DOWN, false, vector<int>(), false);
+               EPIMATCH_LEFT, EPIMATCH_RIGHT, EPIMATCH_UP, EPIMATCH_DOWN, false, vector<int>(), false,
+               vector<core::Point>(), vector<bool>());
   // initialize matches
   initMatches(feats_left, feats_right, patches_left, patches_right, match_index,
              matches_lc_, matches_rc_, patches_lc_, patches_rc_);
@@ -158,6 +160,7 @@ void StereoTrackerBFM::track(const cv::Mat& img_left, const cv::Mat& img_right)
    matches_rp_ = matches_rc_;
    patches_lp_ = patches_lc_;
    patches_rp_ = patches_rc_;
+   predictTracks();
 
    std::vector<core::Point> feats_left, feats_right;
    detector_->detect(cvimg_lc_, feats_left);
@@ -174,7 +177,8 @@ void StereoTrackerBFM::track(const cv::Mat& img_left, const cv::Mat& img_right)
    // match spatial
    //cout << "matching current left-right\n";
    matchFeatures(cvimg_lc_, cvimg_rc_, feats_left, feats_right, patches_left, patches_right, match_index_epi,
-                 EPIMATCH_LEFT, EPIMATCH_RIGHT, EPIMATCH_UP, EPIMATCH_DOWN, false, vector<int>(), false);
+                 EPIMATCH_LEFT, EPIMATCH_RIGHT, EPIMATCH_UP, EPIMATCH_DOWN, false, vector<int>(), false,
+                 vector<core::Point>(), vector<bool>());
    // filter unmatched features so that they are not used again in temporal matching unnecesseary - wrong, this is biased
    // we wont filter anything so that the temporal reference patch would never lose his real match in current set
    //filterUnmatched(feats_left_, feats_right_, patches_left, patches_right, match_index);
@@ -193,17 +197,44 @@ void StereoTrackerBFM::track(const cv::Mat& img_left, const cv::Mat& img_right)
 
    // match temporal
    //cout << "matching left prev-curr\n";
-   matchFeatures(cvimg_lp_, cvimg_lc_, matches_lp_, feats_left, patches_lp_, patches_left, match_index_left,
-                 wsize_left_, wsize_right_, wsize_up_, wsize_down_, true, age_, false);
+   int candidates = matchFeatures(cvimg_lp_, cvimg_lc_, matches_lp_, feats_left, patches_lp_, patches_left,
+                                  match_index_left, wsize_left_, wsize_right_, wsize_up_, wsize_down_,
+                                  true, age_, false, predicted_left_, has_prediction_);
    //cout << "matching right prev-curr\n";
-   matchFeatures(cvimg_rp_, cvimg_rc_, matches_rp_, feats_right, patches_rp_, patches_right, match_index_right,
-                 wsize_left_, wsize_right_, wsize_up_, wsize_down_, true, age_, false);
+   candidates += matchFeatures(cvimg_rp_, cvimg_rc_, matches_rp_, feats_right, patches_rp_, patches_right,
+                               match_index_right, wsize_left_, wsize_right_, wsize_up_, wsize_down_,
+                               true, age_, false, predicted_right_, has_prediction_);
+   candidates_acc_ += candidates;
+   track_frames_++;
+   cout << "[StereoTrackerBFM] Temporal match candidates: " << candidates << "\n";
    updateMatches(feats_left, feats_right, patches_left, patches_right, match_index_left, match_index_right,
                  match_index_epi, unused_features);
 
    replaceDeadFeatures(feats_left, feats_right, patches_left, patches_right, match_index_epi, unused_features);
 }
 
+void StereoTrackerBFM::SetMotionPrior(const MotionPrior& prior)
+{
+  prior_ = prior;
+}
+
+void StereoTrackerBFM::predictTracks()
+{
+  has_prediction_.assign(matches_lp_.size(), false);
+  if(prior_wsize_ > 0 && prior_.valid()) {
+    predicted_left_.resize(matches_lp_.size());
+    predicted_right_.resize(matches_rp_.size());
+    // new features (age 0) have a stereo match too
+    for(size_t i = 0; i < matches_lp_.size(); i++) {
+      if(age_[i] >= 0)
+        has_prediction_[i] = prior_.Predict(matches_lp_[i], matches_rp_[i], predicted_left_[i],
+                                            predicted_right_[i]);
+    }
+  }
+  // the prior holds only for the frame pair it was set for
+  prior_ = MotionPrior();
+}
+
 void StereoTrackerBFM::replaceDeadFeatures(const std::vector<core::Point>& feats_left,
                                            const std::vector<core::Point>& feats_right,
                                            const std::vector<FeaturePatch>& patches_left,
@@ -283,16 +314,20 @@ void StereoTrackerBFM::printStats()
 {
   std::cout << "[StereoTrackerBFM] Active tracks: " << countActiveTracks() << "\n";
   std::cout << "[StereoTrackerBFM] Average track age: " << (double) age_acc_ / death_count_ << "\n";
+  std::cout << "[StereoTrackerBFM] Average temporal match candidates: "
+            << (double) candidates_acc_ / track_frames_ << "\n";
 }
 
-void StereoTrackerBFM::matchFeatures(const cv::Mat& cvimg_1, const cv::Mat& cvimg_2,
+int StereoTrackerBFM::matchFeatures(const cv::Mat& cvimg_1, const cv::Mat& cvimg_2,
                                      const std::vector<core::Point>& feats1,
                                      const std::vector<core::Point>& feats2,
                                      const std::vector<FeaturePatch>& patches1,
                                      const std::vector<FeaturePatch>& patches2,
                                      std::vector<int>& match_index, double dxl,
                                      double dxr, double dyu, double dyd, bool is_temporal,
-                                     const std::vector<int>& ages, bool debug)
+                                     const std::vector<int>& ages, bool debug,
+                                     const std::vector<core::Point>& predicted,
+                                     const std::vector<bool>& has_prediction)
 {
    // debug:
    Mat disp_1_track, disp_2_track;
@@ -306,6 +341,21 @@ void StereoTrackerBFM::matchFeatures(const cv::Mat& cvimg_1, const cv::Mat& cvim
    vector<double> crosscorrs;
    crosscorrs.resize(feats1.size());
    double corr, dx, dy;
+   int candidates = 0;
+
+   // search window of each feature in feats1, centered on the predicted position if it has one
+   struct Window {
+      double x, y, left, right, up, down;
+   };
+   vector<Window> windows(feats1.size());
+   for(size_t i = 0; i < feats1.size(); i++) {
+      if(!has_prediction.empty() && has_prediction[i])
+         windows[i] = { predicted[i].x_, predicted[i].y_, (double)prior_wsize_, (double)prior_wsize_,
+                        (double)prior_wsize_, (double)prior_wsize_ };
+      else
+         windows[i] = { feats1[i].x_, feats1[i].y_, dxl, dxr, dyu, dyd };
+   }
+
    // match 1 to 2
    for(size_t i = 0; i < feats1.size(); i++) {
       // dont track if the temporal reference feature is dead
@@ -319,17 +369,19 @@ void StereoTrackerBFM::matchFeatures(const cv::Mat& cvimg_1, const cv::Mat& cvim
       //}
       int ind_best = -1;
       double corr_best = 0.0;
+      const Window& win = windows[i];
       for(size_t j = 0; j < feats2.size(); j++) {
-         dy = feats1[i].y_ - feats2[j].y_;
-         dx = feats1[i].x_ - feats2[j].x_;
+         dy = win.y - feats2[j].y_;
+         dx = win.x - feats2[j].x_;
          // ignore features outside
-         if(dy < 0.0 && dy < -dyd) continue;
-         if(dy > 0.0 && dy > dyu) continue;
-         if(dx < 0.0 && dx < -dxr) continue;
-         if(dx > 0.0 && dx > dxl) continue;
+         if(dy < 0.0 && dy < -win.down) continue;
+         if(dy > 0.0 && dy > win.up) continue;
+         if(dx < 0.0 && dx < -win.right) continue;
+         if(dx > 0.0 && dx > win.left) continue;
 
          //cout << "match 1-2: " << i << " - " << j << endl;
          corr = getCorrelation(patches1[i], patches2[j]);
+         candidates++;
 
          // debug: draw on images
          //if(debug) {
@@ -343,10 +395,10 @@ void StereoTrackerBFM::matchFeatures(const cv::Mat& cvimg_1, const cv::Mat& cvim
             cv::circle(disp_1_track, pt, 2, Scalar(255,0,0), 2, 8);
             Point pt_rec1, pt_rec2;
             Rect rect;
-            rect.x = pt.x - dxl;
-            rect.y = pt.y - dyd;
-            rect.width = dxl + dxr + 1;
-            rect.height = dyd + dyu + 1;
+            rect.x = win.x - win.left;
+            rect.y = win.y - win.down;
+            rect.width = win.left + win.right + 1;
+            rect.height = win.down + win.up + 1;
             //pt_rec1.x_ = pt.x - dxl;
             //pt_rec1.y_ = pt.y - dyd;
             //pt_rec2.x_ = pt.x + dxr;
@@ -411,16 +463,18 @@ void StereoTrackerBFM::matchFeatures(const cv::Mat& cvimg_1, const cv::Mat& cvim
          if(is_temporal && ages[j] < 0) {
             continue;
          }
-         dy = feats1[j].y_ - feats2[i].y_;
-         dx = feats1[j].x_ - feats2[i].x_;
-         if(dy < 0.0 && dy < -dyd) continue;
-         if(dy > 0.0 && dy > dyu) continue;
-         if(dx < 0.0 && dx < -dxr) continue;
-         if(dx > 0.0 && dx > dxl) continue;
+         const Window& win = windows[j];
+         dy = win.y - feats2[i].y_;
+         dx = win.x - feats2[i].x_;
+         if(dy < 0.0 && dy < -win.down) continue;
+         if(dy > 0.0 && dy > win.up) continue;
+         if(dx < 0.0 && dx < -win.right) continue;
+         if(dx > 0.0 && dx > win.left) continue;
 
          // TODO - we can optimize this and put corrs in a map during the first match
          //cout << "match 2-1: " << i << " - " << j << endl;
          corr = getCorrelation(patches1[j], patches2[i]);
+         candidates++;
          if(corr > corr_best) {
             corr_best = corr;
             ind_best = j;
@@ -444,6 +498,7 @@ void StereoTrackerBFM::matchFeatures(const cv::Mat& cvimg_1, const cv::Mat& cvim
             match_index[i] = m_1to2;
       }
    }
+   return candidates;
 }
 
 std::vector<size_t> StereoTrackerBFM::getSortedIndices(std::vector<double> const& values) {
@@ -531,6 +586,22 @@ FeatureInfo StereoTrackerBFM::featureRight(int i) const
    return std::move(feat);
 }
 
+TrackBatch StereoTrackerBFM::GetTrackBatch() const
+{
+   TrackBatch batch;
+   batch.size = matches_lp_.size();
+   batch.lp_x = ViewX(matches_lp_);
+   batch.lp_y = ViewY(matches_lp_);
+   batch.lc_x = ViewX(matches_lc_);
+   batch.lc_y = ViewY(matches_lc_);
+   batch.rp_x = ViewX(matches_rp_);
+   batch.rp_y = ViewY(matches_rp_);
+   batch.rc_x = ViewX(matches_rc_);
+   batch.rc_y = ViewY(matches_rc_);
+   batch.age = StridedView<int>(age_.data(), 1);
+   return FinishBatch(batch);
+}
+
 void StereoTrackerBFM::removeTrack(int id)
 {
   if(age_[id] > 0) {
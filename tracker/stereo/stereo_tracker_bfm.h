@@ -19,13 +19,15 @@ class StereoTrackerBFM : public StereoTrackerBase
 {
  public:
   StereoTrackerBFM(FeatureDetectorBase* detector, int max_features, double min_crosscorr,
-                   int patch_size, int window_size);
+                   int patch_size, int window_size, int prior_window_size = 0);
   ~StereoTrackerBFM();
   virtual void init(const cv::Mat& img_left, const cv::Mat& img_right);
   virtual void track(const cv::Mat& img_left, const cv::Mat& img_right);
+  virtual void SetMotionPrior(const MotionPrior& prior);
   virtual int countFeatures() const;
   virtual FeatureInfo featureLeft(int i) const;
   virtual FeatureInfo featureRight(int i) const;
+  virtual TrackBatch GetTrackBatch() const;
   virtual void removeTrack(int id);
   virtual int countActiveTracks() const;
 
@@ -56,11 +58,17 @@ class StereoTrackerBFM : public StereoTrackerBase
                            const std::vector<int>& match_index_epi,
                            std::vector<bool>& unused_features);
 
-  void matchFeatures(const cv::Mat& img_1, const cv::Mat& img_2,
+  // Returns the number of compared candidate pairs. Features of feats1 with has_prediction set
+  // are searched for only in the prior window around their predicted position.
+  int matchFeatures(const cv::Mat& img_1, const cv::Mat& img_2,
       const std::vector<core::Point>& feats1, const std::vector<core::Point>& feats2,
       const std::vector<FeaturePatch>& patches1, const std::vector<FeaturePatch>& patches2,
       std::vector<int>& match_index, double dxl, double dxr, double dyu, double dyd, bool is_temporal,
-      const std::vector<int>& ages, bool debug);
+      const std::vector<int>& ages, bool debug, const std::vector<core::Point>& predicted,
+      const std::vector<bool>& has_prediction);
+
+  // predicts the positions of all tracks in the next frame pair from the motion prior
+  void predictTracks();
 
   void initMatches(const std::vector<core::Point>& feats1, const std::vector<core::Point>& feats2,
       const std::vector<FeaturePatch>& in_patches1, const std::vector<FeaturePatch>& in_patches2,
@@ -84,9 +92,16 @@ class StereoTrackerBFM : public StereoTrackerBase
   bool use_smoothing_;
   uint64_t age_acc_ = 0;
   uint64_t death_count_ = 0;
+  uint64_t candidates_acc_ = 0;
+  uint64_t track_frames_ = 0;
   double min_crosscorr_;
   double max_disp_change_;
   int wsize_left_, wsize_right_, wsize_up_, wsize_down_;
+  // half size of the search window around predicted positions, 0 disables the motion prior
+  int prior_wsize_;
+  MotionPrior prior_;
+  std::vector<core::Point> predicted_left_, predicted_right_;
+  std::vector<bool> has_prediction_;
   std::vector<core::Point> matches_lp_, matches_rp_, matches_lc_, matches_rc_;
   std::vector<int> age_;
   std::vector<int> status_;
@@ -2,15 +2,14 @@
 #define TRACKER_STEREO_STEREO_TRACKER_FREAK_
 
 #include "stereo_tracker_base.h"
+#include "../base/hamming_matcher.h"
 #include "../detector/feature_detector_base.h"
 
 #include <opencv2/core/core.hpp>
-#include <opencv2/core/cuda.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <opencv2/highgui/highgui.hpp>
 #include <opencv2/imgcodecs/imgcodecs.hpp>
-#include <opencv2/cudafeatures2d.hpp>
 
 namespace track {
 
@@ -50,8 +49,10 @@ class StereoTrackerFREAK : public StereoTrackerBase {
   void ApplyEpipolarConstraint(const std::vector<cv::KeyPoint>& points_left,
                                const std::vector<cv::KeyPoint>& points_right,
                                const std::vector<std::vector<size_t>>& row_indices,
-                               cv::Mat& mask) const;
-  void ApplyTemporalConstraint(const std::vector<cv::KeyPoint>& points_curr, cv::Mat& mask) const;
+                               hamming::CandidateLists& candidates) const;
+  void ApplyTemporalConstraint(const std::vector<cv::KeyPoint>& points_curr,
+                               const std::vector<std::vector<size_t>>& row_indices,
+                               hamming::CandidateLists& candidates) const;
 
   size_t max_tracks_;
   int max_xdiff_, max_ydiff_;
@@ -60,12 +61,9 @@ class StereoTrackerFREAK : public StereoTrackerBase {
   int maxdist_temp_, maxdist_stereo_;
   int agast_threshold_;
 
-  cv::Ptr<cv::cuda::DescriptorMatcher> matcher_;
   cv::Ptr<cv::Feature2D> descriptor_;
 
-  //cv::cuda::GpuMat gpuimg_left_, gpuimg_right_;
-  cv::cuda::GpuMat descriptors_lp_;
-  cv::cuda::Stream cuda_stream_;
+  cv::Mat descriptors_lp_;
 
   //cv::Ptr<cv::Feature2D> left_detector_, right_detector_;
   std::shared_ptr<FeatureDetectorBase> left_detector_, right_detector_;
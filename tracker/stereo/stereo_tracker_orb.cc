@@ -6,23 +6,6 @@ namespace track {
 
 namespace {
 
-void SortInRows(const std::vector<cv::KeyPoint>& points, size_t img_rows,
-                std::vector<std::vector<size_t>>& row_indices) {
-  row_indices.resize(img_rows);
-  for (size_t i = 0; i < points.size(); i++) {
-    int row = static_cast<int>(points[i].pt.y);
-    assert(row >= 0 && row < img_rows);
-    row_indices[row].push_back(i);
-  }
-  for (size_t i = 0; i < row_indices.size(); i++) {
-    if (row_indices[i].size() > 1)
-      std::sort(row_indices[i].begin(), row_indices[i].end(), [&points](size_t a, size_t b) {
-            return points[a].pt.x < points[b].pt.x;
-            //return points[a].pt.x <= points[b].pt.x;
-          });
-  }
-}
-
 void DrawStereoMatches(const std::vector<cv::KeyPoint>& left,
                 const std::vector<cv::KeyPoint>& right,
                 const std::vector<std::vector<cv::DMatch>>& matches,
@@ -127,7 +110,6 @@ StereoTrackerORB::StereoTrackerORB(size_t max_tracks, size_t max_xdiff, double m
   cv::cuda::setDevice(0);
   detector_ = cv::cuda::ORB::create(2*max_tracks_, scale_factor, num_levels, patch_size, 0, 2,
                                     cv::cuda::ORB::HARRIS_SCORE, patch_size);
-  matcher_ = cv::cuda::DescriptorMatcher::createBFMatcher(cv::NORM_HAMMING);
 }
 
 void StereoTrackerORB::init(const cv::Mat& img_left, const cv::Mat& img_right) {
@@ -156,34 +138,26 @@ void StereoTrackerORB::init(const cv::Mat& img_left, const cv::Mat& img_right) {
   cuda_stream_.waitForCompletion();
   detector_->convert(gpu_points_left, points_left);
   detector_->convert(gpu_points_right, points_right);
+  // the descriptors are much smaller than the dense masks, match them on the CPU
+  cv::Mat cpu_desc_left, cpu_desc_right;
+  desc_left.download(cpu_desc_left);
+  desc_right.download(cpu_desc_right);
   std::vector<std::vector<size_t>> row_indices;
-  SortInRows(points_right, img_rows_, row_indices);
-  // TODO: faster if we split features in rows and then run maching for each row in async mode
-  cv::Mat cpu_mask;
-  ApplyEpipolarConstraint(points_left, points_right, row_indices, cpu_mask);
-  cv::cuda::GpuMat mask;
-  mask.upload(cpu_mask);
-  //std::vector<std::vector<cv::DMatch>> matches;
-  //matcher_->radiusMatch(desc_left, desc_right, matches, maxdist_stereo_, mask);
-  std::vector<std::vector<cv::DMatch>> matches;
-  matcher_->radiusMatch(desc_left, desc_right, matches, maxdist_stereo_, mask);
-  //std::vector<cv::DMatch> final_matches;
-  // use epipolar constraint to filter the matches
+  hamming::SortInRows(points_right, img_rows_, row_indices);
+  hamming::CandidateLists candidates;
+  ApplyEpipolarConstraint(points_left, points_right, row_indices, candidates);
+  std::vector<cv::DMatch> matches;
+  hamming::MatchCandidates(cpu_desc_left, cpu_desc_right, candidates, matches);
   // store them as unused matches
-  //cv::Mat cpu_desc_left;
-  //desc_left.download(cpu_desc_left);
-  assert(matches.size() == points_left.size());
   size_t i = 0;
-  for (size_t j = 0; j < matches.size(); j++) {
-    assert(i < max_tracks_);
+  for (const auto& m : matches) {
     if (i >= max_tracks_)
       break;
-    if (matches[j].size() == 0)
+    if (m.distance > maxdist_stereo_)
       continue;
-    const auto& m = matches[j][0];
     tracks_lc_[i] = points_left[m.queryIdx];
     tracks_rc_[i] = points_right[m.trainIdx];
-    desc_left.row(m.queryIdx).copyTo(descriptors_lp_.row(i));
+    cpu_desc_left.row(m.queryIdx).copyTo(descriptors_lp_.row(i));
     age_[i] = 0;
     i++;
   }
@@ -209,14 +183,17 @@ void StereoTrackerORB::track(const cv::Mat& img_left, const cv::Mat& img_right)
 
   std::vector<cv::KeyPoint> points_left, points_right;
   cv::cuda::GpuMat gpu_points_left, gpu_points_right;
-  cv::cuda::GpuMat descriptors_left, descriptors_right;
+  cv::cuda::GpuMat gpu_desc_left, gpu_desc_right;
   detector_->detectAndComputeAsync(gpuimg_left_, cv::cuda::GpuMat(), gpu_points_left,
-                                   descriptors_left, false, cuda_stream_);
+                                   gpu_desc_left, false, cuda_stream_);
   detector_->detectAndComputeAsync(gpuimg_right_, cv::cuda::GpuMat(), gpu_points_right,
-                                   descriptors_right, false, cuda_stream_);
+                                   gpu_desc_right, false, cuda_stream_);
   cuda_stream_.waitForCompletion();
   detector_->convert(gpu_points_left, points_left);
   detector_->convert(gpu_points_right, points_right);
+  cv::Mat descriptors_left, descriptors_right;
+  gpu_desc_left.download(descriptors_left);
+  gpu_desc_right.download(descriptors_right);
 
   //DrawKeypoints(img_lc_, points_lc_, "keypoints left");
   //DrawKeypoints(img_rc_, points_right, "keypoints right");
@@ -224,35 +201,17 @@ void StereoTrackerORB::track(const cv::Mat& img_left, const cv::Mat& img_right)
 
   // Perform stereo and teporal matching independently
   //int k = 3;
-  std::vector<std::vector<size_t>> row_indices;
-  SortInRows(points_right, img_rows_, row_indices);
-  cv::cuda::GpuMat gpu_temp_matches, gpu_stereo_matches;
-  cv::Mat cpu_mask_stereo, cpu_mask_temp;
-  cv::cuda::GpuMat mask_stereo, mask_temp;
+  std::vector<std::vector<size_t>> row_indices, row_indices_left;
+  hamming::SortInRows(points_right, img_rows_, row_indices);
+  hamming::SortInRows(points_left, img_rows_, row_indices_left);
+  hamming::CandidateLists candidates_stereo, candidates_temp;
   std::vector<cv::DMatch> temp_matches_compact, stereo_matches_compact;
-  ApplyEpipolarConstraint(points_left, points_right, row_indices, cpu_mask_stereo);
-  mask_stereo.upload(cpu_mask_stereo);
-  matcher_->matchAsync(descriptors_left, descriptors_right, gpu_stereo_matches,
-                       mask_stereo, cuda_stream_);
-  //matcher_->match(descriptors_left, descriptors_right, stereo_matches_compact, mask_stereo);
-
-  ApplyTemporalConstraint(points_left, cpu_mask_temp);
-  mask_temp.upload(cpu_mask_temp);
-  matcher_->matchAsync(descriptors_lp_, descriptors_left, gpu_temp_matches,
-                       mask_temp, cuda_stream_);
-  cuda_stream_.waitForCompletion();
-  //matcher_->match(descriptors_lp_, descriptors_left, temp_matches, mask_temp);
-
-  matcher_->matchConvert(gpu_stereo_matches, stereo_matches_compact);
-  matcher_->matchConvert(gpu_temp_matches, temp_matches_compact);
-
-  //auto start = std::chrono::system_clock::now();
-  //cv::Mat tmatches, smatches;
-  //gpu_temp_matches.download(tmatches);
-  //gpu_stereo_matches.download(smatches);
-  //std::chrono::duration<double> elapsed = std::chrono::system_clock::now() - start;
-  //std::cout << "[Matching]: Time = " << elapsed.count() << " sec\n";
-  //std::cout << tmatches.rows << " x " << tmatches.cols << "\n" << smatches.size() << "\n";
+  ApplyEpipolarConstraint(points_left, points_right, row_indices, candidates_stereo);
+  hamming::MatchCandidates(descriptors_left, descriptors_right, candidates_stereo,
+                           stereo_matches_compact);
+  ApplyTemporalConstraint(points_left, row_indices_left, candidates_temp);
+  hamming::MatchCandidates(descriptors_lp_, descriptors_left, candidates_temp,
+                           temp_matches_compact);
 
   //DrawStereoMatches(points_left, points_right, stereo_matches, img_lc_);
 
@@ -342,54 +301,59 @@ void StereoTrackerORB::ApplyEpipolarConstraint(
     const std::vector<cv::KeyPoint>& points_left,
     const std::vector<cv::KeyPoint>& points_right,
     const std::vector<std::vector<size_t>>& row_indices,
-    cv::Mat& mask) const {
-  mask = cv::Mat::zeros(points_left.size(), points_right.size(), CV_8U);
+    hamming::CandidateLists& candidates) const {
   int row_range = std::ceil(max_epipolar_diff_);
-  #pragma omp parallel for
-  for (size_t i = 0; i < points_left.size(); i++) {
-    //for (size_t j = 0; j < points_right.size(); j++) {
-    //  const cv::KeyPoint& left = points_left[i];
-    //  const cv::KeyPoint& right = points_right[j];
-    //  double disp = left.pt.x - right.pt.x;
-    //  if (std::abs(left.pt.y - right.pt.y) <= max_epipolar_diff_ && disp >= 0 && disp <= max_disp_)
-    //    mask.at<uint8_t>(i,j) = 1;
-    //}
-    int row = points_left[i].pt.y;
+  auto append = [&](int i, std::vector<int>& out) {
+    const cv::KeyPoint& left = points_left[i];
+    int row = left.pt.y;
     int start_row = std::max(0, row - row_range);
     int end_row = std::min((int)row_indices.size()-1, row + row_range);
-    const cv::KeyPoint& left = points_left[i];
     for (int j = start_row; j <= end_row; j++) {
-      for (size_t right_idx : row_indices[j]) {
-        const cv::KeyPoint& right = points_right[right_idx];
-        double disp = left.pt.x - right.pt.x;
-        if (disp < 0)
-          continue;
-        if (std::abs(left.pt.y - right.pt.y) <= max_epipolar_diff_ && disp <= max_disp_)
-          mask.at<uint8_t>(i,right_idx) = 1;
+      // rows are sorted by x, skip to the max disparity and stop at zero disparity
+      const std::vector<size_t>& bin = row_indices[j];
+      auto it = std::lower_bound(bin.begin(), bin.end(), left.pt.x - max_disp_,
+                                 [&points_right](size_t idx, double x) {
+                                   return points_right[idx].pt.x < x;
+                                 });
+      for (; it != bin.end(); ++it) {
+        const cv::KeyPoint& right = points_right[*it];
+        if (right.pt.x > left.pt.x)
+          break;
+        if (std::abs(left.pt.y - right.pt.y) <= max_epipolar_diff_)
+          out.push_back(*it);
       }
     }
-  }
+  };
+  hamming::BuildCandidateLists(points_left.size(), append, candidates);
 }
 
 void StereoTrackerORB::ApplyTemporalConstraint(
     const std::vector<cv::KeyPoint>& points_curr,
-    cv::Mat& mask) const {
-  mask = cv::Mat::zeros(tracks_lp_.size(), points_curr.size(), CV_8U);
-  std::vector<size_t> active;
+    const std::vector<std::vector<size_t>>& row_indices,
+    hamming::CandidateLists& candidates) const {
   // take all active (age > 0) and potential matches (age == 0)
-  for (size_t i = 0; i < age_.size(); i++)
-    if (age_[i] >= 0)
-      active.push_back(i);
-  #pragma omp parallel for
-  for (size_t i = 0; i < active.size(); i++) {
-    const cv::KeyPoint& prev = tracks_lp_[active[i]];
-    for (size_t j = 0; j < points_curr.size(); j++) {
-      const cv::KeyPoint& curr = points_curr[j];
-      if (std::abs(prev.pt.y - curr.pt.y) <= max_ydiff_ &&
-          std::abs(prev.pt.x - curr.pt.x) <= max_xdiff_)
-        mask.at<uint8_t>(active[i],j) = 1;
+  auto append = [&](int i, std::vector<int>& out) {
+    if (age_[i] < 0)
+      return;
+    const cv::KeyPoint& prev = tracks_lp_[i];
+    int start_row = std::max(0, (int)std::floor(prev.pt.y - max_ydiff_));
+    int end_row = std::min((int)row_indices.size()-1, (int)std::floor(prev.pt.y + max_ydiff_));
+    for (int j = start_row; j <= end_row; j++) {
+      const std::vector<size_t>& bin = row_indices[j];
+      auto it = std::lower_bound(bin.begin(), bin.end(), prev.pt.x - max_xdiff_,
+                                 [&points_curr](size_t idx, double x) {
+                                   return points_curr[idx].pt.x < x;
+                                 });
+      for (; it != bin.end(); ++it) {
+        const cv::KeyPoint& curr = points_curr[*it];
+        if (curr.pt.x - prev.pt.x > max_xdiff_)
+          break;
+        if (std::abs(prev.pt.y - curr.pt.y) <= max_ydiff_)
+          out.push_back(*it);
+      }
     }
-  }
+  };
+  hamming::BuildCandidateLists(tracks_lp_.size(), append, candidates);
 }
 
 }   // namespace track
@@ -2,6 +2,7 @@
 #define TRACKER_STEREO_STEREO_TRACKER_ORB_
 
 #include "stereo_tracker_base.h"
+#include "../base/hamming_matcher.h"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/cuda.hpp>
@@ -44,8 +45,10 @@ class StereoTrackerORB : public StereoTrackerBase {
   void ApplyEpipolarConstraint(const std::vector<cv::KeyPoint>& points_left,
                                const std::vector<cv::KeyPoint>& points_right,
                                const std::vector<std::vector<size_t>>& row_indices,
-                               cv::Mat& mask) const;
-  void ApplyTemporalConstraint(const std::vector<cv::KeyPoint>& points_curr, cv::Mat& mask) const;
+                               hamming::CandidateLists& candidates) const;
+  void ApplyTemporalConstraint(const std::vector<cv::KeyPoint>& points_curr,
+                               const std::vector<std::vector<size_t>>& row_indices,
+                               hamming::CandidateLists& candidates) const;
 
   size_t max_tracks_;
   int max_xdiff_, max_ydiff_;
@@ -54,9 +57,8 @@ class StereoTrackerORB : public StereoTrackerBase {
   int maxdist_temp_, maxdist_stereo_;
   cv::cuda::Stream cuda_stream_;
   cv::Ptr<cv::cuda::ORB> detector_;
-  cv::Ptr<cv::cuda::DescriptorMatcher> matcher_;
   cv::cuda::GpuMat gpuimg_left_, gpuimg_right_;
-  cv::cuda::GpuMat descriptors_lp_;
+  cv::Mat descriptors_lp_;
 
   cv::Mat img_lp_, img_rp_, img_lc_, img_rc_;
   std::vector<cv::KeyPoint> tracks_lp_, tracks_rp_, tracks_lc_, tracks_rc_;
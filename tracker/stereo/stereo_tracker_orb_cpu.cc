@@ -0,0 +1,282 @@
+#include "stereo_tracker_orb_cpu.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+
+namespace track {
+
+namespace {
+
+// stripes per image, the left and right stripes are extracted in the same parallel loop
+const int kStripes = 8;
+// ORB descriptor size in bytes
+const int kDescSize = 32;
+
+// concatenates the stripe results in stripe order
+void GatherStripes(const std::vector<std::vector<cv::KeyPoint>>& stripe_points,
+                   const std::vector<cv::Mat>& stripe_descriptors, int first, int last,
+                   std::vector<cv::KeyPoint>& points, cv::Mat& descriptors) {
+  size_t total = 0;
+  for (int s = first; s < last; s++)
+    total += stripe_points[s].size();
+  points.clear();
+  points.reserve(total);
+  descriptors.create(total, kDescSize, CV_8U);
+  for (int s = first; s < last; s++) {
+    if (stripe_points[s].empty())
+      continue;
+    std::memcpy(descriptors.ptr<uint8_t>(points.size()), stripe_descriptors[s].ptr<uint8_t>(0),
+                stripe_points[s].size() * kDescSize);
+    points.insert(points.end(), stripe_points[s].begin(), stripe_points[s].end());
+  }
+}
+
+}
+
+StereoTrackerORBcpu::StereoTrackerORBcpu(size_t max_tracks, size_t max_xdiff, double max_epipolar_diff,
+                                         size_t max_disp, size_t max_disp_diff, int patch_size,
+                                         float scale_factor, int num_levels,
+                                         int maxdist_stereo, int maxdist_temp) :
+      max_tracks_(max_tracks), max_xdiff_(max_xdiff), max_epipolar_diff_(max_epipolar_diff),
+      max_disp_(max_disp), max_disp_diff_(max_disp_diff), maxdist_temp_(maxdist_temp),
+      maxdist_stereo_(maxdist_stereo) {
+  max_ydiff_ = max_xdiff / 2;
+  verbose_ = false;
+
+  // same settings as the GPU detector, the feature budget is split over the stripes
+  int stripe_features = (2*max_tracks_ + kStripes - 1) / kStripes;
+  for (int s = 0; s < 2*kStripes; s++)
+    detectors_.push_back(cv::ORB::create(stripe_features, scale_factor, num_levels, patch_size, 0, 2,
+                                         cv::ORB::HARRIS_SCORE, patch_size));
+  // ORB drops points closer than patch_size to the border on every pyramid level
+  stripe_halo_ = std::ceil(patch_size * std::pow(scale_factor, num_levels - 1)) + 1;
+}
+
+void StereoTrackerORBcpu::DetectAndCompute(
+    const cv::Mat& img_left, const cv::Mat& img_right,
+    std::vector<cv::KeyPoint>& points_left, cv::Mat& descriptors_left,
+    std::vector<cv::KeyPoint>& points_right, cv::Mat& descriptors_right) {
+  const int rows = img_left.rows;
+  std::vector<std::vector<cv::KeyPoint>> stripe_points(2*kStripes);
+  std::vector<cv::Mat> stripe_descriptors(2*kStripes);
+  #pragma omp parallel for schedule(dynamic)
+  for (int s = 0; s < 2*kStripes; s++) {
+    const cv::Mat& img = (s < kStripes) ? img_left : img_right;
+    const int stripe = s % kStripes;
+    const int y0 = rows * stripe / kStripes;
+    const int y1 = rows * (stripe + 1) / kStripes;
+    const int roi_y0 = std::max(0, y0 - stripe_halo_);
+    const int roi_y1 = std::min(rows, y1 + stripe_halo_);
+    std::vector<cv::KeyPoint> points;
+    cv::Mat descriptors;
+    detectors_[s]->detectAndCompute(img.rowRange(roi_y0, roi_y1), cv::noArray(), points, descriptors);
+
+    // keep only the points inside the stripe, the halo belongs to the neighbours
+    std::vector<cv::KeyPoint>& kept = stripe_points[s];
+    cv::Mat& kept_descriptors = stripe_descriptors[s];
+    kept_descriptors.create(points.size(), kDescSize, CV_8U);
+    for (size_t i = 0; i < points.size(); i++) {
+      cv::KeyPoint kpt = points[i];
+      kpt.pt.y += roi_y0;
+      if (kpt.pt.y < y0 || kpt.pt.y >= y1)
+        continue;
+      descriptors.row(i).copyTo(kept_descriptors.row(kept.size()));
+      kept.push_back(kpt);
+    }
+  }
+  GatherStripes(stripe_points, stripe_descriptors, 0, kStripes, points_left, descriptors_left);
+  GatherStripes(stripe_points, stripe_descriptors, kStripes, 2*kStripes, points_right,
+                descriptors_right);
+}
+
+void StereoTrackerORBcpu::init(const cv::Mat& img_left, const cv::Mat& img_right) {
+  assert(img_left.type() == CV_8U && img_right.type() == CV_8U);
+  img_rows_ = img_left.rows;
+  img_cols_ = img_left.cols;
+  tracks_lp_.resize(max_tracks_);
+  tracks_rp_.resize(max_tracks_);
+  tracks_lc_.resize(max_tracks_);
+  tracks_rc_.resize(max_tracks_);
+  age_.assign(max_tracks_, -1);
+  descriptors_lp_.create(max_tracks_, kDescSize, CV_8U);
+
+  std::vector<cv::KeyPoint> points_left, points_right;
+  cv::Mat desc_left, desc_right;
+  DetectAndCompute(img_left, img_right, points_left, desc_left, points_right, desc_right);
+  std::vector<std::vector<size_t>> row_indices;
+  hamming::SortInRows(points_right, img_rows_, row_indices);
+  hamming::CandidateLists candidates;
+  ApplyEpipolarConstraint(points_left, points_right, row_indices, candidates);
+  std::vector<cv::DMatch> matches;
+  hamming::MatchCandidates(desc_left, desc_right, candidates, matches);
+
+  size_t i = 0;
+  for (const auto& m : matches) {
+    if (i >= max_tracks_)
+      break;
+    if (m.distance > maxdist_stereo_)
+      continue;
+    tracks_lc_[i] = points_left[m.queryIdx];
+    tracks_rc_[i] = points_right[m.trainIdx];
+    desc_left.row(m.queryIdx).copyTo(descriptors_lp_.row(i));
+    age_[i] = 0;
+    i++;
+  }
+  if (verbose_) {
+    std::cout << "Features detected = " << points_left.size() << " -- " << points_right.size() << "\n";
+    std::cout << "Stereo matched = " << i << "\n";
+  }
+}
+
+void StereoTrackerORBcpu::track(const cv::Mat& img_left, const cv::Mat& img_right) {
+  std::swap(tracks_lp_, tracks_lc_);
+  std::swap(tracks_rp_, tracks_rc_);
+
+  std::vector<cv::KeyPoint> points_left, points_right;
+  cv::Mat descriptors_left, descriptors_right;
+  DetectAndCompute(img_left, img_right, points_left, descriptors_left, points_right,
+                   descriptors_right);
+
+  // stereo and temporal matching are independent
+  std::vector<std::vector<size_t>> row_indices, row_indices_left;
+  hamming::SortInRows(points_right, img_rows_, row_indices);
+  hamming::SortInRows(points_left, img_rows_, row_indices_left);
+  hamming::CandidateLists candidates_stereo, candidates_temp;
+  std::vector<cv::DMatch> temp_matches_compact, stereo_matches_compact;
+  ApplyEpipolarConstraint(points_left, points_right, row_indices, candidates_stereo);
+  hamming::MatchCandidates(descriptors_left, descriptors_right, candidates_stereo,
+                           stereo_matches_compact);
+  ApplyTemporalConstraint(points_left, row_indices_left, candidates_temp);
+  hamming::MatchCandidates(descriptors_lp_, descriptors_left, candidates_temp,
+                           temp_matches_compact);
+
+  temp_matches_status_.assign(tracks_lp_.size(), false);
+  std::vector<int> stereo_matches(points_left.size(), -1);
+  std::vector<bool> used_matches(points_left.size(), false);
+  for (const auto& m : stereo_matches_compact)
+    if (m.distance <= maxdist_stereo_)
+      stereo_matches[m.queryIdx] = m.trainIdx;
+  for (const auto& m : temp_matches_compact) {
+    int curr_idx = m.trainIdx;
+    if (stereo_matches[curr_idx] >= 0 && m.distance <= maxdist_temp_) {
+      used_matches[curr_idx] = true;
+      temp_matches_status_[m.queryIdx] = true;
+      tracks_lc_[m.queryIdx] = points_left[curr_idx];
+      tracks_rc_[m.queryIdx] = points_right[stereo_matches[curr_idx]];
+      age_[m.queryIdx]++;
+      descriptors_left.row(curr_idx).copyTo(descriptors_lp_.row(m.queryIdx));
+    }
+    else age_[m.queryIdx] = -1;
+  }
+
+  for (size_t i = 0; i < age_.size(); i++) {
+    // clear unmatched potential tracks [age == 0] and older tracks [age > 0] to make room for new ones
+    if (temp_matches_status_[i] == false && age_[i] >= 0)
+      age_[i] = -1;
+  }
+
+  size_t cnt = 0;
+  for (size_t i = 0; i < used_matches.size() && cnt < age_.size(); i++) {
+    int right_idx = stereo_matches[i];
+    if (used_matches[i] == false && right_idx >= 0) {
+      while (cnt < age_.size()) {
+        if (age_[cnt] < 0) {
+          tracks_lc_[cnt] = points_left[i];
+          tracks_rc_[cnt] = points_right[right_idx];
+          descriptors_left.row(i).copyTo(descriptors_lp_.row(cnt));
+          age_[cnt++] = 0;
+          break;
+        }
+        cnt++;
+      }
+    }
+  }
+
+  if (verbose_)
+    std::cout << "Matched tracks = " << countActiveTracks() << "\n";
+}
+
+void StereoTrackerORBcpu::ApplyEpipolarConstraint(
+    const std::vector<cv::KeyPoint>& points_left,
+    const std::vector<cv::KeyPoint>& points_right,
+    const std::vector<std::vector<size_t>>& row_indices,
+    hamming::CandidateLists& candidates) const {
+  int row_range = std::ceil(max_epipolar_diff_);
+  auto append = [&](int i, std::vector<int>& out) {
+    const cv::KeyPoint& left = points_left[i];
+    int row = left.pt.y;
+    int start_row = std::max(0, row - row_range);
+    int end_row = std::min((int)row_indices.size()-1, row + row_range);
+    for (int j = start_row; j <= end_row; j++) {
+      // rows are sorted by x, skip to the max disparity and stop at zero disparity
+      const std::vector<size_t>& bin = row_indices[j];
+      auto it = std::lower_bound(bin.begin(), bin.end(), left.pt.x - max_disp_,
+                                 [&points_right](size_t idx, double x) {
+                                   return points_right[idx].pt.x < x;
+                                 });
+      for (; it != bin.end(); ++it) {
+        const cv::KeyPoint& right = points_right[*it];
+        if (right.pt.x > left.pt.x)
+          break;
+        if (std::abs(left.pt.y - right.pt.y) <= max_epipolar_diff_)
+          out.push_back(*it);
+      }
+    }
+  };
+  hamming::BuildCandidateLists(points_left.size(), append, candidates);
+}
+
+void StereoTrackerORBcpu::ApplyTemporalConstraint(
+    const std::vector<cv::KeyPoint>& points_curr,
+    const std::vector<std::vector<size_t>>& row_indices,
+    hamming::CandidateLists& candidates) const {
+  // take all active (age > 0) and potential matches (age == 0)
+  auto append = [&](int i, std::vector<int>& out) {
+    if (age_[i] < 0)
+      return;
+    const cv::KeyPoint& prev = tracks_lp_[i];
+    int start_row = std::max(0, (int)std::floor(prev.pt.y - max_ydiff_));
+    int end_row = std::min((int)row_indices.size()-1, (int)std::floor(prev.pt.y + max_ydiff_));
+    for (int j = start_row; j <= end_row; j++) {
+      const std::vector<size_t>& bin = row_indices[j];
+      auto it = std::lower_bound(bin.begin(), bin.end(), prev.pt.x - max_xdiff_,
+                                 [&points_curr](size_t idx, double x) {
+                                   return points_curr[idx].pt.x < x;
+                                 });
+      for (; it != bin.end(); ++it) {
+        const cv::KeyPoint& curr = points_curr[*it];
+        if (curr.pt.x - prev.pt.x > max_xdiff_)
+          break;
+        if (std::abs(prev.pt.y - curr.pt.y) <= max_ydiff_)
+          out.push_back(*it);
+      }
+    }
+  };
+  hamming::BuildCandidateLists(tracks_lp_.size(), append, candidates);
+}
+
+FeatureInfo StereoTrackerORBcpu::featureLeft(int i) const {
+  FeatureInfo feat;
+  feat.age_ = age_[i];
+  feat.prev_.x_ = tracks_lp_[i].pt.x;
+  feat.prev_.y_ = tracks_lp_[i].pt.y;
+  feat.curr_.x_ = tracks_lc_[i].pt.x;
+  feat.curr_.y_ = tracks_lc_[i].pt.y;
+  return feat;
+}
+
+FeatureInfo StereoTrackerORBcpu::featureRight(int i) const {
+  FeatureInfo feat;
+  feat.age_ = age_[i];
+  feat.prev_.x_ = tracks_rp_[i].pt.x;
+  feat.prev_.y_ = tracks_rp_[i].pt.y;
+  feat.curr_.x_ = tracks_rc_[i].pt.x;
+  feat.curr_.y_ = tracks_rc_[i].pt.y;
+  return feat;
+}
+
+}   // namespace track
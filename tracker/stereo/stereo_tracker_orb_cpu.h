@@ -0,0 +1,67 @@
+#ifndef TRACKER_STEREO_STEREO_TRACKER_ORB_CPU_
+#define TRACKER_STEREO_STEREO_TRACKER_ORB_CPU_
+
+#include "stereo_tracker_base.h"
+#include "../base/hamming_matcher.h"
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/features2d/features2d.hpp>
+
+namespace track {
+
+// CPU version of StereoTrackerORB with the same matching logic. ORB features are extracted
+// in parallel over horizontal image stripes and matched like in StereoTrackerORB, through the
+// hamming::MatchCandidates lists given by the epipolar and temporal constraints.
+class StereoTrackerORBcpu : public StereoTrackerBase {
+ public:
+  StereoTrackerORBcpu(size_t max_tracks, size_t max_xdiff, double max_epipolar_diff,
+                      size_t max_disp, size_t max_disp_diff, int patch_size,
+                      float scale_factor, int num_levels,
+                      int maxdist_stereo, int maxdist_temp);
+  void init(const cv::Mat& img_left, const cv::Mat& img_right) override;
+  void track(const cv::Mat& img_left, const cv::Mat& img_right) override;
+  int countFeatures() const override { return max_tracks_; }
+  FeatureInfo featureLeft(int i) const override;
+  FeatureInfo featureRight(int i) const override;
+  void removeTrack(int i) override { age_[i] = -1; }
+  bool IsAlive(int i) const override { return age_[i] > 0; }
+  int countActiveTracks() const override {
+    int cnt = 0;
+    for (int a : age_)
+      if (a > 0)
+        cnt++;
+    return cnt;
+  }
+
+ private:
+  void DetectAndCompute(const cv::Mat& img_left, const cv::Mat& img_right,
+                        std::vector<cv::KeyPoint>& points_left, cv::Mat& descriptors_left,
+                        std::vector<cv::KeyPoint>& points_right, cv::Mat& descriptors_right);
+  void ApplyEpipolarConstraint(const std::vector<cv::KeyPoint>& points_left,
+                               const std::vector<cv::KeyPoint>& points_right,
+                               const std::vector<std::vector<size_t>>& row_indices,
+                               hamming::CandidateLists& candidates) const;
+  void ApplyTemporalConstraint(const std::vector<cv::KeyPoint>& points_curr,
+                               const std::vector<std::vector<size_t>>& row_indices,
+                               hamming::CandidateLists& candidates) const;
+
+  size_t max_tracks_;
+  int max_xdiff_, max_ydiff_;
+  double max_epipolar_diff_;
+  int max_disp_, max_disp_diff_;
+  int maxdist_temp_, maxdist_stereo_;
+  // stripe extractors, the halo rows give them the full ORB border inside the image
+  std::vector<cv::Ptr<cv::ORB>> detectors_;
+  int stripe_halo_;
+  cv::Mat descriptors_lp_;
+
+  std::vector<cv::KeyPoint> tracks_lp_, tracks_rp_, tracks_lc_, tracks_rc_;
+  std::vector<int> age_;
+  std::vector<bool> temp_matches_status_;
+  int img_rows_ = 0, img_cols_ = 0;
+  bool verbose_ = false;
+};
+
+} // namespace track
+
+#endif  // TRACKER_STEREO_STEREO_TRACKER_ORB_CPU_
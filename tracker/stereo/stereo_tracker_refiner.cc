@@ -14,7 +14,7 @@ StereoTrackerRefiner::StereoTrackerRefiner(
     StereoTrackerBase* tracker,
     FeatureRefinerBase* refiner,
     bool debug_on)
-  : tracker_(tracker), refiner_(refiner), debug_on_(debug_on)
+  : tracker_(tracker), refiner_(refiner), curr_(0), debug_on_(debug_on)
 {
   max_feats_ = tracker->countFeatures();
   points_lp_.resize(max_feats_);
@@ -22,6 +22,11 @@ StereoTrackerRefiner::StereoTrackerRefiner(
   points_lc_.resize(max_feats_);
   points_rc_.resize(max_feats_);
   age_.resize(max_feats_);
+  // build as many pyramid levels as the refiner uses
+  for(int slot = 0; slot < 2; slot++) {
+    imgset_left_[slot].numLevels_ = refiner_->levels();
+    imgset_right_[slot].numLevels_ = refiner_->levels();
+  }
   if(debug_on_) {
     fdata_lp_.resize(max_feats_);
     fdata_rp_.resize(max_feats_);
@@ -62,12 +67,21 @@ void StereoTrackerRefiner::track(const cv::Mat& img_left, const cv::Mat& img_rig
 
 void StereoTrackerRefiner::init(core::Image& img_left, core::Image& img_right)
 {
-  imgset_left_prev_.compute(img_left);
-  imgset_right_prev_.compute(img_right);
+  curr_ = 0;
+  imgset_left_[curr_].compute(img_left);
+  imgset_right_[curr_].compute(img_right);
 }
 
 void StereoTrackerRefiner::track(core::Image& img_left, core::Image& img_right)
 {
+  // advance the ring, the image sets of the last frame become the previous ones
+  // and the new frame is computed into the buffers of the frame before
+  curr_ = 1 - curr_;
+  core::ImageSetExact& imgset_left = imgset_left_[curr_];
+  core::ImageSetExact& imgset_right = imgset_right_[curr_];
+  core::ImageSetExact& imgset_left_prev = imgset_left_[1 - curr_];
+  core::ImageSetExact& imgset_right_prev = imgset_right_[1 - curr_];
+
   // copy current to prev
   points_lp_ = points_lc_;
   points_rp_ = points_rc_;
@@ -78,12 +92,11 @@ void StereoTrackerRefiner::track(core::Image& img_left, core::Image& img_right)
   std::map<int, core::Point> refined_left, refined_right, refined_new_rp;
 
   assert(tracker_->countFeatures() <= max_feats_);
+  const TrackBatch tracks = tracker_->GetTrackBatch();
   int i;
-  for(i = 0; i < tracker_->countFeatures(); i++)
+  for(i = 0; i < tracks.size; i++)
   {
-    FeatureInfo f_left = tracker_->featureLeft(i);
-    FeatureInfo f_right = tracker_->featureRight(i);
-    int age = f_left.age_;
+    int age = tracks.age[i];
     age_[i] = age;
 
     // if dead or newly added - remove it from refiner
@@ -94,14 +107,15 @@ void StereoTrackerRefiner::track(core::Image& img_left, core::Image& img_right)
     if(age >= 1) {
       // if it is a first track then add the feature reference point for refinement
       if(age == 1) {
-        points_lp_[i] = f_left.prev_;
+        const core::Point left_prev = tracks.leftPrev(i);
+        points_lp_[i] = left_prev;
 
         if(debug_on_)
-          fdata_lp_[i].setpos(f_left.prev_.x_, f_left.prev_.y_);
+          fdata_lp_[i].setpos(left_prev.x_, left_prev.y_);
 
-        new_references.insert(std::pair<int,core::Point>(i, f_left.prev_));
+        new_references.insert(std::pair<int,core::Point>(i, left_prev));
         // add it for refinement in right image also
-        refined_new_rp.insert(std::pair<int,core::Point>(i, f_right.prev_));
+        refined_new_rp.insert(std::pair<int,core::Point>(i, tracks.rightPrev(i)));
         //std::cout << f_left.prev_ << "\n";
         //std::cout << f_right.prev_ << "\n";
         // dont need this
@@ -110,20 +124,20 @@ void StereoTrackerRefiner::track(core::Image& img_left, core::Image& img_right)
       }
 
       // add feature track points for refinement
-      refined_left.insert(std::pair<int,core::Point>(i, f_left.curr_));
-      refined_right.insert(std::pair<int,core::Point>(i, f_right.curr_));
+      refined_left.insert(std::pair<int,core::Point>(i, tracks.leftCurr(i)));
+      refined_right.insert(std::pair<int,core::Point>(i, tracks.rightCurr(i)));
     }
   }
 
   // add new track reference points to refiner using prev imgset
-  refiner_->addFeatures(imgset_left_prev_, new_references);
+  refiner_->addFeatures(imgset_left_prev, new_references);
 
   // first refine new tracks (age == 1) in previous right image
-  refiner_->refineFeatures(imgset_right_prev_, refined_new_rp);
+  refiner_->refineFeatures(imgset_right_prev, refined_new_rp);
   // update points positions
   int converged_cnt = 0;
   for(auto pt : refined_new_rp) {
-    refiner::FeatureData fdata = refiner_->getFeature(pt.first);
+    const refiner::FeatureData& fdata = refiner_->getFeature(pt.first);
     core::Point rpt = fdata.pt();
     auto status = fdata.status_;
     if(status == refiner::FeatureData::OK) {
@@ -143,14 +157,14 @@ void StereoTrackerRefiner::track(core::Image& img_left, core::Image& img_right)
   
   converged_cnt = 0;
   // compute new images
-  imgset_left_.compute(img_left);
+  imgset_left.compute(img_left);
   // refine the points in current frames
-  refiner_->refineFeatures(imgset_left_, refined_left);
+  refiner_->refineFeatures(imgset_left, refined_left);
   // update current points positions
   // TODO - check refiner::FeatureData
   // refiner_->getFeature(id);
   for(auto pt : refined_left) {
-    refiner::FeatureData fdata = refiner_->getFeature(pt.first);
+    const refiner::FeatureData& fdata = refiner_->getFeature(pt.first);
     core::Point rpt = fdata.pt();
     auto status = fdata.status_;
     if(status == refiner::FeatureData::OK) {
@@ -172,10 +186,11 @@ void StereoTrackerRefiner::track(core::Image& img_left, core::Image& img_right)
 
   // refine in next right image
   converged_cnt = 0;
-  imgset_right_.compute(img_right);
-  refiner_->refineFeatures(imgset_right_, refined_right);
+  // computed only now, ImageSetExact::compute and refineFeatures both use the whole OpenMP team
+  imgset_right.compute(img_right);
+  refiner_->refineFeatures(imgset_right, refined_right);
   for(auto pt : refined_right) {
-    refiner::FeatureData fdata = refiner_->getFeature(pt.first);
+    const refiner::FeatureData& fdata = refiner_->getFeature(pt.first);
     core::Point rpt = fdata.pt();
     auto status = fdata.status_;
     if(status == refiner::FeatureData::OK) {
@@ -196,12 +211,6 @@ void StereoTrackerRefiner::track(core::Image& img_left, core::Image& img_right)
             << refined_right.size() << "\n";
 
   //filterBadTracks();
-
-  imgset_left_prev_ = imgset_left_;
-  imgset_right_prev_ = imgset_right_;
-  // TODO: replace this by = imgset_right;
-  //imgset_left_prev_.compute(img_left);
-  //imgset_right_prev_.compute(img_right);
 }
 
 int StereoTrackerRefiner::countFeatures() const
@@ -234,6 +243,22 @@ FeatureInfo StereoTrackerRefiner::featureRight(int i) const
   return feat;
 }
 
+TrackBatch StereoTrackerRefiner::GetTrackBatch() const
+{
+  TrackBatch batch;
+  batch.size = countFeatures();
+  batch.lp_x = ViewX(points_lp_);
+  batch.lp_y = ViewY(points_lp_);
+  batch.lc_x = ViewX(points_lc_);
+  batch.lc_y = ViewY(points_lc_);
+  batch.rp_x = ViewX(points_rp_);
+  batch.rp_y = ViewY(points_rp_);
+  batch.rc_x = ViewX(points_rc_);
+  batch.rc_y = ViewY(points_rc_);
+  batch.age = StridedView<int>(age_.data(), 1);
+  return FinishBatch(batch);
+}
+
 void StereoTrackerRefiner::removeTrack(int id)
 {
   tracker_->removeTrack(id);
@@ -16,11 +16,13 @@ class StereoTrackerRefiner : public StereoTrackerBase
   virtual void track(const cv::Mat& img_left, const cv::Mat& img_right);
   virtual void init(core::Image& img_left, core::Image& img_right);
   virtual void track(core::Image& img_left, core::Image& img_right);
+  virtual void SetMotionPrior(const MotionPrior& prior) { tracker_->SetMotionPrior(prior); }
   virtual int countFeatures() const;
   virtual int countActiveTracks() const;
   virtual void removeTrack(int id);
   virtual FeatureInfo featureLeft(int i) const;
   virtual FeatureInfo featureRight(int i) const;
+  virtual TrackBatch GetTrackBatch() const;
 
   void printStats() const;
   void debug() const;
@@ -30,8 +32,10 @@ class StereoTrackerRefiner : public StereoTrackerBase
 
  private:
   refiner::FeatureRefinerBase* refiner_;
-  core::ImageSetExact imgset_left_, imgset_left_prev_;
-  core::ImageSetExact imgset_right_, imgset_right_prev_;
+  // two-slot ring, slot curr_ holds the current frame and the other one the previous
+  core::ImageSetExact imgset_left_[2];
+  core::ImageSetExact imgset_right_[2];
+  int curr_;
   cv::Mat img_lp_, img_rp_;
   std::vector<core::Point> points_lp_, points_rp_, points_lc_, points_rc_;
   std::vector<int> age_;
@@ -102,6 +102,22 @@ track::FeatureInfo StereoTrackerSim::featureRight(int i) const
 }
 
 
+track::TrackBatch StereoTrackerSim::GetTrackBatch() const
+{
+   TrackBatch batch;
+   batch.size = countFeatures();
+   batch.lp_x = ViewX(feats_left_, &FeatureInfo::prev_);
+   batch.lp_y = ViewY(feats_left_, &FeatureInfo::prev_);
+   batch.lc_x = ViewX(feats_left_, &FeatureInfo::curr_);
+   batch.lc_y = ViewY(feats_left_, &FeatureInfo::curr_);
+   batch.rp_x = ViewX(feats_right_, &FeatureInfo::prev_);
+   batch.rp_y = ViewY(feats_right_, &FeatureInfo::prev_);
+   batch.rc_x = ViewX(feats_right_, &FeatureInfo::curr_);
+   batch.rc_y = ViewY(feats_right_, &FeatureInfo::curr_);
+   batch.age = ViewAge(feats_left_);
+   return FinishBatch(batch);
+}
+
 bool StereoTrackerSim::readStringList(const std::string& filename, std::vector<std::string>& strlist)
 {
    strlist.resize(0);
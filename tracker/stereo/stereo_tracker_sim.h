@@ -21,6 +21,7 @@ public:
    virtual int countFeatures() const;
    virtual FeatureInfo featureLeft(int i) const;
    virtual FeatureInfo featureRight(int i) const;
+   virtual TrackBatch GetTrackBatch() const;
    virtual void removeTrack(int id) {}
 
 protected: